@@ -0,0 +1,22 @@
+#ifndef FIDSTR_OBJECT_CACHE_HPP
+#define FIDSTR_OBJECT_CACHE_HPP
+
+#include <string>
+
+#include "rodsType.h"
+#include "../../lustre_irods_connector/src/lru_cache.hpp"
+
+// What a lustre fidstr resolves to in the catalog.  For a collection coll_id is the same as
+// object_id.
+struct fidstr_object_info {
+    rodsLong_t object_id;
+    bool is_collection;
+    rodsLong_t coll_id;
+};
+
+// LRU cache of lustre fidstr -> catalog object so that lookups do not have to go through the
+// R_META_MAIN / R_OBJT_METAMAP join each time.  An agent handles one request at a time so this
+// does no locking.  The capacity is sent with each request so it can change between requests.
+typedef lru_cache<std::string, fidstr_object_info> fidstr_object_cache;
+
+#endif
@@ -41,6 +41,10 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <map>
+#include <set>
+#include <cstdlib>
+#include <algorithm>
 
 // capn proto
 #pragma push_macro("LIST")
@@ -59,6 +63,7 @@
 #include "inout_structs.h"
 #include "database_routines.hpp"
 #include "irods_lustre_operations.hpp"
+#include "fidstr_object_cache.hpp"
 
 #define MAX_BIND_VARS 32000
 extern const char *cllBindVars[MAX_BIND_VARS];
@@ -136,6 +141,11 @@ const std::string insert_user_ownership_data_object_sql = "insert into R_OBJT_AC
 
 const std::string get_user_id_sql = "select user_id from R_USER_MAIN where user_name = ?";
 
+const std::string get_collection_id_and_inheritance_sql = "select coll_id, coll_inheritance from R_COLL_MAIN where coll_name = ?";
+
+const std::string copy_collection_access_sql = "insert into R_OBJT_ACCESS (object_id, user_id, access_type_id, create_ts, modify_ts) "
+                   "select ?, user_id, access_type_id, ?, ? from R_OBJT_ACCESS where object_id = ?";
+
 #if defined(POSTGRES_ICAT) 
     const std::string update_filepath_on_collection_rename_sql = "update R_DATA_MAIN set data_path = overlay(data_path placing ? from 1 for char_length(?)) where data_path like ?";
 #elif defined(COCKROACHDB_ICAT)
@@ -149,7 +159,7 @@ const std::string get_user_id_sql = "select user_id from R_USER_MAIN where user_
 // return values:
 //    1 - no rows found but no other error
 //    0 - row found
-//    -1 - error encountered
+//    < 0 - error encountered
 int find_irods_path_with_avu(rsComm_t *_conn, const std::string& attr, const std::string& value, const std::string& unit, bool is_collection, std::string& irods_path) {
 
     genQueryInp_t  gen_inp;
@@ -176,17 +186,17 @@ int find_irods_path_with_avu(rsComm_t *_conn, const std::string& attr, const std
 
     int status = rsGenQuery(_conn, &gen_inp, &gen_out);
 
-    if ( status < 0 || !gen_out ) {
+    if ( CAT_NO_ROWS_FOUND == status || (status >= 0 && gen_out && gen_out->rowCnt < 1) ) {
         freeGenQueryOut(&gen_out);
         clearGenQueryInp(&gen_inp);
-        return -2;
+        rodsLog(LOG_NOTICE, "No object with AVU [%s, %s, %s] found.\n", attr.c_str(), value.c_str(), unit == "" ? "null": unit.c_str());
+        return 1;
     }
 
-    if (gen_out->rowCnt < 1) {
+    if ( status < 0 || !gen_out ) {
         freeGenQueryOut(&gen_out);
         clearGenQueryInp(&gen_inp);
-        rodsLog(LOG_NOTICE, "No object with AVU [%s, %s, %s] found.\n", attr.c_str(), value.c_str(), unit == "" ? "null": unit.c_str());
-        return -1;
+        return status < 0 ? status : SYS_INTERNAL_NULL_INPUT_ERR;
     }
 
     sqlResult_t* coll_names = getSqlResultByInx(gen_out, COL_COLL_NAME);
@@ -205,49 +215,22 @@ int find_irods_path_with_avu(rsComm_t *_conn, const std::string& attr, const std
     return 0;
 }
 
-// Returns the path in irods for a file in lustre based on the mapping in register_map.  
+// Returns the path in irods for a file in lustre based on the mapping in register_map.  The
+// longest matching lustre path prefix is used.
 // If the prefix is not in register_map then the function returns -1, otherwise it returns 0.
-int lustre_path_to_irods_path(const std::string& lustre_path, const std::vector<std::pair<std::string, std::string> >& register_map,
+int lustre_path_to_irods_path(const std::string& lustre_path, const register_path_map& register_map,
         std::string& irods_path) {
 
-    for (auto& iter : register_map) {
-        const std::string& lustre_path_prefix = iter.first;
-        if (lustre_path.compare(0, lustre_path_prefix.length(), lustre_path_prefix) == 0) {
-            irods_path = iter.second + lustre_path.substr(lustre_path_prefix.length());
-            return 0;
-        }
-    }
-
-    return -1;
+    return register_map.lustre_to_irods.translate(lustre_path, irods_path) ? 0 : -1;
 }
 
 // Returns the path in lustre for a data object in irods based on the mapping in register_map.  
+// The longest matching irods path prefix is used.
 // If the prefix is not in register_map then the function returns -1, otherwise it returns 0.
-int irods_path_to_lustre_path(const std::string& irods_path, const std::vector<std::pair<std::string, std::string> >& register_map,
+int irods_path_to_lustre_path(const std::string& irods_path, const register_path_map& register_map,
         std::string& lustre_path) {
 
-    // make sure we match the longest possible match
-    size_t match_length = 0; 
-    std::string matched_irods_path_prefix;
-    std::string matched_lustre_prefix;
-
-    for (auto& iter : register_map) {
-        const std::string& irods_path_prefix = iter.second;
-        if (irods_path.compare(0, irods_path_prefix.length(), irods_path_prefix) == 0) { 
-            if (irods_path_prefix.length() > match_length) {
-                match_length = irods_path_prefix.length();
-                matched_irods_path_prefix = irods_path_prefix;
-                matched_lustre_prefix = iter.first;
-            }
-        }
-    }    
-
-    if (match_length > 0) { 
-        lustre_path = matched_lustre_prefix + irods_path.substr(matched_irods_path_prefix.length());
-        return 0;
-    }    
-
-    return -1;
+    return register_map.irods_to_lustre.translate(irods_path, lustre_path) ? 0 : -1;
 }
 
 int get_user_id(rsComm_t* _comm, icatSessionStruct *icss, rodsLong_t& user_id, bool direct_db_access_flag) {
@@ -262,7 +245,185 @@ int get_user_id(rsComm_t* _comm, icatSessionStruct *icss, rodsLong_t& user_id, b
     return 0;
 }
 
-void handle_create(const std::vector<std::pair<std::string, std::string> >& register_map, 
+// Lives for the whole agent process so lookups are shared by every request on the connection.
+// Entries are dropped when the object is unlinked, removed or renamed, and the whole cache is
+// cleared whenever a transaction is rolled back or fails to commit since it may hold ids that
+// were never committed.  Rolling back to an entry savepoint only drops what was cached since the
+// savepoint was set.
+static fidstr_object_cache object_cache(0);
+
+// When a whole change map is applied in one transaction the handlers must not commit or roll
+// back on their own.  rs_handle_lustre_records instead puts each entry in a savepoint and commits
+// once at the end.
+static bool single_transaction_mode = false;
+
+// fidstrs cached since the last entry savepoint was set
+static std::vector<std::string> fidstrs_cached_since_savepoint;
+
+void set_fidstr_object_cache_size(size_t max_entries) {
+    object_cache.set_capacity(max_entries);
+}
+
+void log_fidstr_object_cache_counts() {
+    rodsLog(LOG_DEBUG, "fidstr object cache [size=%zu][hits=%llu][misses=%llu]", object_cache.size(),
+            object_cache.hit_count(), object_cache.miss_count());
+}
+
+static void cache_object(const std::string& fidstr, const fidstr_object_info& info) {
+    object_cache.insert(fidstr, info);
+    if (single_transaction_mode) {
+        fidstrs_cached_since_savepoint.push_back(fidstr);
+    }
+}
+
+const std::string entry_savepoint_name = "lustre_entry";
+
+void set_single_transaction_mode(bool enabled) {
+    single_transaction_mode = enabled;
+}
+
+int commit_direct_db_changes(icatSessionStruct *icss) {
+    if (single_transaction_mode) {
+        return 0;
+    }
+    int status = cmlExecuteNoAnswerSql("commit", icss);
+    if (status != 0) {
+        object_cache.clear();
+    }
+    return status;
+}
+
+void rollback_direct_db_changes(icatSessionStruct *icss) {
+    if (single_transaction_mode) {
+        return;
+    }
+    object_cache.clear();
+    cmlExecuteNoAnswerSql("rollback", icss);
+}
+
+int commit_single_transaction(icatSessionStruct *icss) {
+    int status = cmlExecuteNoAnswerSql("commit", icss);
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Error committing change map.  Error is %i", status);
+        object_cache.clear();
+    }
+    return status;
+}
+
+void rollback_single_transaction(icatSessionStruct *icss) {
+    object_cache.clear();
+    fidstrs_cached_since_savepoint.clear();
+    cmlExecuteNoAnswerSql("rollback", icss);
+}
+
+int set_entry_savepoint(icatSessionStruct *icss) {
+    fidstrs_cached_since_savepoint.clear();
+    int status = cmlExecuteNoAnswerSql(("savepoint " + entry_savepoint_name).c_str(), icss);
+    if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
+        rodsLog(LOG_ERROR, "Error setting savepoint %s.  Error is %i", entry_savepoint_name.c_str(), status);
+        return status;
+    }
+    return 0;
+}
+
+int release_entry_savepoint(icatSessionStruct *icss) {
+    fidstrs_cached_since_savepoint.clear();
+#if defined(ORA_ICAT)
+    // oracle has no release, the savepoint is simply replaced by the next one
+    return 0;
+#else
+    int status = cmlExecuteNoAnswerSql(("release savepoint " + entry_savepoint_name).c_str(), icss);
+    if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
+        rodsLog(LOG_ERROR, "Error releasing savepoint %s.  Error is %i", entry_savepoint_name.c_str(), status);
+        return status;
+    }
+    return 0;
+#endif
+}
+
+int rollback_to_entry_savepoint(icatSessionStruct *icss) {
+    for (auto& fidstr : fidstrs_cached_since_savepoint) {
+        object_cache.erase(fidstr);
+    }
+    fidstrs_cached_since_savepoint.clear();
+    int status = cmlExecuteNoAnswerSql(("rollback to savepoint " + entry_savepoint_name).c_str(), icss);
+    if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
+        rodsLog(LOG_ERROR, "Error rolling back to savepoint %s.  Error is %i", entry_savepoint_name.c_str(), status);
+        return status;
+    }
+    return 0;
+}
+
+// Gets the coll_id of the collection with the lustre_identifier fidstr, only going to the catalog
+// when it is not in the object cache.
+static int get_collection_id_from_fidstr(const std::string& fidstr, rodsLong_t& coll_id, icatSessionStruct *icss) {
+
+    fidstr_object_info info;
+    if (object_cache.lookup(fidstr, info) && info.is_collection) {
+        coll_id = info.object_id;
+        return 0;
+    }
+
+    std::vector<std::string> bindVars;
+    bindVars.push_back(fidstr);
+    int status = cmlGetIntegerValueFromSql(get_collection_id_from_fidstr_sql.c_str(), &coll_id, bindVars, icss);
+    if (status == 0) {
+        cache_object(fidstr, fidstr_object_info{coll_id, true, coll_id});
+    }
+    return status;
+}
+
+// Another agent may have removed a collection since it was cached.  Before cached coll_id's are
+// used to insert new objects they are checked against R_COLL_MAIN with a primary key lookup,
+// which is much cheaper than resolving the fidstr again.  Entries whose collection is gone are
+// removed from both fidstr_to_collection_id_map and the cache.
+static void confirm_cached_collection_ids(std::map<std::string, rodsLong_t>& fidstr_to_collection_id_map, icatSessionStruct *icss) {
+
+    // oracle allows at most 1000 entries in an in list
+    const size_t maximum_ids_per_query = 1000;
+
+    std::set<rodsLong_t> found_ids;
+    auto iter = fidstr_to_collection_id_map.begin();
+    while (iter != fidstr_to_collection_id_map.end()) {
+
+        std::string query_sql = "select coll_id from R_COLL_MAIN where coll_id in (";
+        for (size_t i = 0; i < maximum_ids_per_query && iter != fidstr_to_collection_id_map.end(); ++i, ++iter) {
+            if (i > 0) {
+                query_sql += ", ";
+            }
+            query_sql += std::to_string(iter->second);
+        }
+        query_sql += ")";
+
+        std::vector<std::string> emptyBindVars;
+        int stmt_num;
+        int status = cmlGetFirstRowFromSqlBV(query_sql.c_str(), emptyBindVars, &stmt_num, icss);
+        if (CAT_NO_ROWS_FOUND != status) {
+            if (status < 0) {
+                // look all of them up again
+                rodsLog(LOG_ERROR, "confirming cached collection ids - query %s, failure %d", query_sql.c_str(), status);
+                cllFreeStatement(icss, stmt_num);
+                found_ids.clear();
+                break;
+            }
+            do {
+                found_ids.insert(strtoll(icss->stmtPtr[stmt_num]->resultValue[0], nullptr, 10));
+            } while (cmlGetNextRowFromStatement(stmt_num, icss) == 0);
+        }
+        cllFreeStatement(icss, stmt_num);
+    }
+
+    for (iter = fidstr_to_collection_id_map.begin(); iter != fidstr_to_collection_id_map.end();) {
+        if (found_ids.find(iter->second) == found_ids.end()) {
+            object_cache.erase(iter->first);
+            iter = fidstr_to_collection_id_map.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+int handle_create(const register_path_map& register_map, 
         const int64_t& resource_id, const std::string& resource_name, const std::string& fidstr, 
         const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
@@ -275,7 +436,7 @@ void handle_create(const std::vector<std::pair<std::string, std::string> >& regi
     if (lustre_path_to_irods_path(lustre_path.c_str(), register_map, irods_path) < 0) {
         rodsLog(LOG_NOTICE, "Skipping entry because lustre_path [%s] is not in register_map.",
                    lustre_path.c_str()); 
-        return;
+        return 0;
     }
 
 
@@ -304,7 +465,7 @@ void handle_create(const std::vector<std::pair<std::string, std::string> >& regi
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error during registration object %s.  Error getting collection id for collection with fidstr=%s.  Error is %i", 
                     fidstr.c_str(), parent_fidstr.c_str(),  status);
-            return;
+            return status;
         }
 
         // insert data object
@@ -320,15 +481,15 @@ void handle_create(const std::vector<std::pair<std::string, std::string> >& regi
         status = cmlExecuteNoAnswerSql(insert_data_obj_sql.c_str(), icss);
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error registering object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
 
 #if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
+        status = commit_direct_db_changes(icss);
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error committing insertion of new data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         } 
 #endif
 
@@ -339,14 +500,14 @@ void handle_create(const std::vector<std::pair<std::string, std::string> >& regi
         status = cmlExecuteNoAnswerSql(insert_user_ownership_data_object_sql.c_str(), icss);
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error adding onwership to object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
 #if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
+        status = commit_direct_db_changes(icss);
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error committing ownership of new data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 #endif
 
@@ -358,7 +519,7 @@ void handle_create(const std::vector<std::pair<std::string, std::string> >& regi
         rodsLog(LOG_NOTICE, "Return value from chlAddAVUMetdata = %i", status);
         if (status < 0) {
             rodsLog(LOG_ERROR, "Error adding %s metadata to object %s.  Error is %i", fidstr_avu_key.c_str(), fidstr.c_str(), status);
-            return;
+            return status;
         }
 
     } else {
@@ -374,7 +535,7 @@ void handle_create(const std::vector<std::pair<std::string, std::string> >& regi
         //status = filePathReg(_comm, &dataObjInp, resource_name.c_str());
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error registering object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
         // freeKeyValPairStruct(&dataobjInp.condInput);
@@ -390,245 +551,261 @@ void handle_create(const std::vector<std::pair<std::string, std::string> >& regi
         status = rsModAVUMetadata(_comm, &modAVUMetadataInp);
         if (status < 0) {
             rodsLog(LOG_ERROR, "Error adding %s metadata to object %s.  Error is %i", fidstr_avu_key.c_str(), fidstr.c_str(), status);
-            return;
+            return status;
         }
 
 
     }
+
+    return 0;
 }
 
-void handle_batch_create(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id,
+// Inserts rows into a table with "<insert_prefix> values <row_template>, <row_template>, ..." where
+// row_template holds bind_vars_per_row placeholders and bind_values holds the values for all of the
+// rows in order.  The values are always bound rather than written into the SQL so names with quotes
+// in them are safe.  Rows are sent in chunks of a power of two in size (up to maximum_rows_per_statement
+// and the bind variable limit) so that only a few distinct statements are ever sent and the
+// database can reuse them from its statement cache instead of parsing a new statement every batch.
+static int execute_bulk_insert(const std::string& insert_prefix, const std::string& row_template, size_t bind_vars_per_row,
+        const std::vector<std::string>& bind_values, int64_t maximum_rows_per_statement, icatSessionStruct *icss) {
+
+    if (0 == bind_vars_per_row || 0 != bind_values.size() % bind_vars_per_row) {
+        rodsLog(LOG_ERROR, "execute_bulk_insert received %lu values for rows of %lu", bind_values.size(), bind_vars_per_row);
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    size_t row_count = bind_values.size() / bind_vars_per_row;
+    size_t max_rows = MAX_BIND_VARS / bind_vars_per_row;
+    if (maximum_rows_per_statement > 0 && static_cast<size_t>(maximum_rows_per_statement) < max_rows) {
+        max_rows = maximum_rows_per_statement;
+    }
+
+    size_t chunk_limit = 1;
+    while (chunk_limit * 2 <= max_rows) {
+        chunk_limit *= 2;
+    }
+
+    std::string sql;
+    size_t sql_row_count = 0;
+    size_t row = 0;
+    while (row < row_count) {
+
+        size_t chunk_rows = chunk_limit;
+        while (chunk_rows > row_count - row) {
+            chunk_rows /= 2;
+        }
+
+        if (chunk_rows != sql_row_count) {
+            sql = insert_prefix + " values ";
+            for (size_t i = 0; i < chunk_rows; ++i) {
+                if (i > 0) {
+                    sql += ", ";
+                }
+                sql += row_template;
+            }
+            sql_row_count = chunk_rows;
+        }
+
+        cllBindVarCount = 0;
+        for (size_t i = row * bind_vars_per_row; i < (row + chunk_rows) * bind_vars_per_row; ++i) {
+            cllBindVars[cllBindVarCount++] = bind_values[i].c_str();
+        }
+
+        int status = cmlExecuteNoAnswerSql(sql.c_str(), icss);
+        if (status != 0) {
+            rodsLog(LOG_ERROR, "Error performing bulk insert of %lu rows.  Error is %i.  SQL is %s.", chunk_rows, status, insert_prefix.c_str());
+            return status;
+        }
+
+        row += chunk_rows;
+    }
+
+    return 0;
+}
+
+int handle_batch_create(const register_path_map& register_map, const int64_t& resource_id,
         const std::string& resource_name, const std::vector<std::string>& fidstr_list, const std::vector<std::string>& lustre_path_list,
         const std::vector<std::string>& object_name_list, const std::vector<std::string>& parent_fidstr_list,
         const std::vector<int64_t>& file_size_list, const int64_t& maximum_records_per_sql_command, rsComm_t* _comm, icatSessionStruct *icss, 
-        const rodsLong_t& user_id, bool set_metadata_for_storage_tiering_time_violation, const std::string& metadata_key_for_storage_tiering_time_violation) {
+        const rodsLong_t& user_id, bool set_metadata_for_storage_tiering_time_violation, const std::string& metadata_key_for_storage_tiering_time_violation,
+        std::vector<size_t>& failed_indices) {
 
     size_t insert_count = fidstr_list.size();
     int status;
 
     if (insert_count == 0) {
-        return;
+        return 0;
     }
 
     if (lustre_path_list.size() != insert_count || object_name_list.size() != insert_count ||
             parent_fidstr_list.size() != insert_count || file_size_list.size() != insert_count) {
 
         rodsLog(LOG_ERROR, "Handle batch create.  Received lists of differing size");
-        return;
+        return SYS_INVALID_INPUT_PARAM;
     }
 
     std::vector<rodsLong_t> data_obj_sequences;
     std::vector<rodsLong_t> metadata_sequences;
-    cmlGetNSeqVals(icss, insert_count, data_obj_sequences);
-
-    if (set_metadata_for_storage_tiering_time_violation) {
-        cmlGetNSeqVals(icss, insert_count+1, metadata_sequences);
-    } else {
-        cmlGetNSeqVals(icss, insert_count, metadata_sequences);
+    status = cmlGetNSeqVals(icss, insert_count, data_obj_sequences);
+    if (status == 0) {
+        // the storage tiering access time AVU takes one more
+        status = cmlGetNSeqVals(icss, set_metadata_for_storage_tiering_time_violation ? insert_count+1 : insert_count,
+                metadata_sequences);
+    }
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Handle batch create.  Error getting sequence values.  Error is %i", status);
+        return status;
     }
 
-    // insert into R_DATA_MAIN
- 
-    std::string insert_sql(200 + insert_count*140, 0);
-    insert_sql = "insert into R_DATA_MAIN (data_id, coll_id, data_name, data_repl_num, data_type_name, "
-                             "data_size, resc_name, data_path, data_owner_name, data_owner_zone, data_is_dirty, data_map_id, resc_id) "
-                        "values ";
-
-    // cache the collection id's from parent_fidstr
+    // look up the collection id's from parent_fidstr.  Entries whose parent collection can not
+    // be found are reported back as failed and left out of the inserts.  Parents in the object
+    // cache are confirmed first and the rest are looked up by fidstr.
     std::map<std::string, rodsLong_t> fidstr_to_collection_id_map;
+    std::vector<rodsLong_t> coll_id_list(insert_count);
+    std::vector<size_t> insert_list;
 
     for (size_t i = 0; i < insert_count; ++i) {
+        fidstr_object_info info;
+        if (fidstr_to_collection_id_map.find(parent_fidstr_list[i]) == fidstr_to_collection_id_map.end() &&
+                object_cache.lookup(parent_fidstr_list[i], info) && info.is_collection) {
+            fidstr_to_collection_id_map[parent_fidstr_list[i]] = info.object_id;
+        }
+    }
+    if (!fidstr_to_collection_id_map.empty()) {
+        confirm_cached_collection_ids(fidstr_to_collection_id_map, icss);
+    }
 
-        rodsLong_t coll_id;
+    for (size_t i = 0; i < insert_count; ++i) {
 
         auto iter = fidstr_to_collection_id_map.find(parent_fidstr_list[i]);
 
         if (iter != fidstr_to_collection_id_map.end()) {
-            coll_id = iter->second;
+            coll_id_list[i] = iter->second;
         } else {
-            std::vector<std::string> bindVars;
-            bindVars.push_back(parent_fidstr_list[i]);
-            status = cmlGetIntegerValueFromSql(get_collection_id_from_fidstr_sql.c_str(), &coll_id, bindVars, icss );
+            status = get_collection_id_from_fidstr(parent_fidstr_list[i], coll_id_list[i], icss);
             if (status != 0) {
                 rodsLog(LOG_ERROR, "Error during registration object %s.  Error getting collection id for collection with fidstr=%s.  Error is %i", 
                         fidstr_list[i].c_str(), parent_fidstr_list[i].c_str(), status);
+                failed_indices.push_back(i);
                 continue;
             }
 
-            fidstr_to_collection_id_map[parent_fidstr_list[i]] = coll_id;
+            fidstr_to_collection_id_map[parent_fidstr_list[i]] = coll_id_list[i];
         }
 
-        insert_sql += "(" + std::to_string(data_obj_sequences[i]) + ", " + std::to_string(coll_id) + ", '" + object_name_list[i] + "', " +
-            std::to_string(0) +  ", 'generic', " + std::to_string(file_size_list[i]) + ", 'EMPTY_RESC_NAME', '" + lustre_path_list[i] + "', '" + 
-            _comm->clientUser.userName + "', '" + _comm->clientUser.rodsZone + "', 0, 0, " + std::to_string(resource_id) + ")";
-
-        if (i < insert_count - 1) {
-            insert_sql += ", ";
-        }
+        insert_list.push_back(i);
     }
 
-    cllBindVarCount = 0;
-    status = cmlExecuteNoAnswerSql(insert_sql.c_str(), icss);
-    if (status != 0) {
-        rodsLog(LOG_ERROR, "Error performing batch insert of objects.  Error is %i.  SQL is %s.", status, insert_sql.c_str());
-        return;
+    if (insert_list.empty()) {
+        return 0;
     }
 
-#if !defined(COCKROACHDB_ICAT)
-    status =  cmlExecuteNoAnswerSql("commit", icss);
-    if (status != 0) {
-        rodsLog(LOG_ERROR, "Error committing insert into R_META_MAIN.  Error is %i", status);
-        return;
-    } 
-#endif
-
-    // Insert into R_META_MAIN
-    
-    insert_sql = "insert into R_META_MAIN (meta_id, meta_attr_name, meta_attr_value) values ";
+    std::string user_id_str = std::to_string(user_id);
+    std::string resource_id_str = std::to_string(resource_id);
+    std::vector<std::string> bind_values;
 
-    for (size_t i = 0; i < insert_count; ++i) {
-        insert_sql += "(" + std::to_string(metadata_sequences[i]) + ", '" + fidstr_avu_key + "', '" + 
-            fidstr_list[i] + "')";
+    // insert into R_DATA_MAIN
 
-        if (i < insert_count - 1) {
-            insert_sql += ", ";
-        }
+    bind_values.clear();
+    bind_values.reserve(insert_list.size() * 8);
+    for (size_t i : insert_list) {
+        bind_values.push_back(std::to_string(data_obj_sequences[i]));
+        bind_values.push_back(std::to_string(coll_id_list[i]));
+        bind_values.push_back(object_name_list[i]);
+        bind_values.push_back(std::to_string(file_size_list[i]));
+        bind_values.push_back(lustre_path_list[i]);
+        bind_values.push_back(_comm->clientUser.userName);
+        bind_values.push_back(_comm->clientUser.rodsZone);
+        bind_values.push_back(resource_id_str);
     }
 
-    cllBindVarCount = 0;
-    status = cmlExecuteNoAnswerSql(insert_sql.c_str(), icss);
+    status = execute_bulk_insert("insert into R_DATA_MAIN (data_id, coll_id, data_name, data_repl_num, data_type_name, "
+                             "data_size, resc_name, data_path, data_owner_name, data_owner_zone, data_is_dirty, data_map_id, resc_id)",
+                             "(?, ?, ?, 0, 'generic', ?, 'EMPTY_RESC_NAME', ?, ?, ?, 0, 0, ?)", 8, bind_values,
+                             maximum_records_per_sql_command, icss);
     if (status != 0) {
-        rodsLog(LOG_ERROR, "Error performing batch insert into R_META_MAIN.  Error is %i.  SQL is %s.", status, insert_sql.c_str());
-        return;
+        rodsLog(LOG_ERROR, "Error performing batch insert of objects.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
     }
 
-#if !defined(COCKROACHDB_ICAT)
-    status =  cmlExecuteNoAnswerSql("commit", icss);
-    if (status != 0) {
-        rodsLog(LOG_ERROR, "Error committing insert into R_META_MAIN.  Error is %i", status);
-        return;
-    } 
-#endif
+    // Insert into R_META_MAIN
 
-    // if we are setting the access time metadata for storage tiering
-    if (set_metadata_for_storage_tiering_time_violation) {
-        // Insert access time into R_META_MAIN
+    bind_values.clear();
+    for (size_t i : insert_list) {
+        bind_values.push_back(std::to_string(metadata_sequences[i]));
+        bind_values.push_back(fidstr_avu_key);
+        bind_values.push_back(fidstr_list[i]);
+    }
 
-        time_t now = time(NULL);
-    
-        insert_sql = "insert into R_META_MAIN (meta_id, meta_attr_name, meta_attr_value) values (" +
-                     std::to_string(metadata_sequences[insert_count])  + ", '" + 
-                     metadata_key_for_storage_tiering_time_violation + "', '" +
-                     std::to_string(now) + "')";
+    // if we are setting the access time metadata for storage tiering the one AVU is shared by all of the objects
+    if (set_metadata_for_storage_tiering_time_violation) {
+        bind_values.push_back(std::to_string(metadata_sequences[insert_count]));
+        bind_values.push_back(metadata_key_for_storage_tiering_time_violation);
+        bind_values.push_back(std::to_string(time(NULL)));
+    }
 
-    cllBindVarCount = 0;
-    status = cmlExecuteNoAnswerSql(insert_sql.c_str(), icss);
+    status = execute_bulk_insert("insert into R_META_MAIN (meta_id, meta_attr_name, meta_attr_value)", "(?, ?, ?)", 3, bind_values,
+            maximum_records_per_sql_command, icss);
     if (status != 0) {
-        rodsLog(LOG_ERROR, "Error inserting metadata into R_META_MAIN for %s.  Error is %i.  SQL is %s.", 
-                    metadata_key_for_storage_tiering_time_violation.c_str(), status, insert_sql.c_str());
-        return;
+        rodsLog(LOG_ERROR, "Error performing batch insert into R_META_MAIN.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
     }
 
-#if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
-        if (status != 0) {
-           rodsLog(LOG_ERROR, "Error committing insert into R_META_MAIN.  Error is %i", status);
-        return;
-    } 
-#endif
-
-    } // set_metadata_for_storage_tiering_time_violation
-
-
     // Insert into R_OBJT_METMAP
 
-    insert_sql = "insert into R_OBJT_METAMAP (object_id, meta_id) values ";
-
-    for (size_t i = 0; i < insert_count; ++i) {
-        insert_sql += "(" + std::to_string(data_obj_sequences[i]) + ", " + std::to_string(metadata_sequences[i]) + ")";
-
-        if (i < insert_count - 1) {
-            insert_sql += ", ";
+    bind_values.clear();
+    for (size_t i : insert_list) {
+        bind_values.push_back(std::to_string(data_obj_sequences[i]));
+        bind_values.push_back(std::to_string(metadata_sequences[i]));
+        if (set_metadata_for_storage_tiering_time_violation) {
+            bind_values.push_back(std::to_string(data_obj_sequences[i]));
+            bind_values.push_back(std::to_string(metadata_sequences[insert_count]));
         }
     }
- 
-    cllBindVarCount = 0;
-    status = cmlExecuteNoAnswerSql(insert_sql.c_str(), icss);
-    if (status != 0) {
-        rodsLog(LOG_ERROR, "Error performing batch insert into R_OBJT_METAMAP.  Error is %i.  SQL is %s.", status, insert_sql.c_str());
-        return;
-    }
 
-#if !defined(COCKROACHDB_ICAT)
-    status =  cmlExecuteNoAnswerSql("commit", icss);
+    status = execute_bulk_insert("insert into R_OBJT_METAMAP (object_id, meta_id)", "(?, ?)", 2, bind_values,
+            maximum_records_per_sql_command, icss);
     if (status != 0) {
-        rodsLog(LOG_ERROR, "Error committing insert into R_OBJT_METAMAP.  Error is %i", status);
-        return;
-    } 
-#endif
-
-    
-    // if we are setting the access time metadata for storage tiering
-    if (set_metadata_for_storage_tiering_time_violation) {
-
-        insert_sql = "insert into R_OBJT_METAMAP (object_id, meta_id) values ";
-
-        for (size_t i = 0; i < insert_count; ++i) {
-            insert_sql += "(" + std::to_string(data_obj_sequences[i]) + ", " + std::to_string(metadata_sequences[insert_count]) + ")";
-
-            if (i < insert_count - 1) {
-                insert_sql += ", ";
-            }
-        }
- 
-        cllBindVarCount = 0;
-        status = cmlExecuteNoAnswerSql(insert_sql.c_str(), icss);
-        if (status != 0) {
-            rodsLog(LOG_ERROR, "Error performing batch insert into R_OBJT_METAMAP.  Error is %i.  SQL is %s.", status, insert_sql.c_str());
-            return;
-        }
-
-#if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
-        if (status != 0) {
-            rodsLog(LOG_ERROR, "Error committing insert into R_OBJT_METAMAP for storage tiering time metadata.  Error is %i", status);
-            return;
-        } 
-#endif
-
-    } // set_metadata_for_storage_tiering_time_violation
-
+        rodsLog(LOG_ERROR, "Error performing batch insert into R_OBJT_METAMAP.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
+    }
 
     // insert user ownership
-    //insert into R_OBJT_ACCESS (object_id, user_id, access_type_id) values (?, ?, 1200) 
-    insert_sql = "insert into R_OBJT_ACCESS (object_id, user_id, access_type_id) values ";
 
-    for (size_t i = 0; i < insert_count; ++i) {
-        insert_sql += "(" + std::to_string(data_obj_sequences[i]) + ", " + std::to_string(user_id) + ", 1200)";
-
-        if (i < insert_count - 1) {
-            insert_sql += ", ";
-        }
+    bind_values.clear();
+    for (size_t i : insert_list) {
+        bind_values.push_back(std::to_string(data_obj_sequences[i]));
+        bind_values.push_back(user_id_str);
     }
- 
-    cllBindVarCount = 0;
-    status = cmlExecuteNoAnswerSql(insert_sql.c_str(), icss);
+
+    status = execute_bulk_insert("insert into R_OBJT_ACCESS (object_id, user_id, access_type_id)", "(?, ?, 1200)", 2, bind_values,
+            maximum_records_per_sql_command, icss);
     if (status != 0) {
-        rodsLog(LOG_ERROR, "Error performing batch insert into R_OBJT_ACCESS.  Error is %i.  SQL is %s.", status, insert_sql.c_str());
-        return;
+        rodsLog(LOG_ERROR, "Error performing batch insert into R_OBJT_ACCESS.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
     }
 
 #if !defined(COCKROACHDB_ICAT)
-    status =  cmlExecuteNoAnswerSql("commit", icss);
+    status = commit_direct_db_changes(icss);
     if (status != 0) {
-        rodsLog(LOG_ERROR, "Error committing insert into R_OBJT_ACCESS.  Error is %i", status);
-        return;
-    } 
+        rodsLog(LOG_ERROR, "Error committing batch registration of objects.  Error is %i", status);
+        return status;
+    }
 #endif
+
+    for (size_t i : insert_list) {
+        cache_object(fidstr_list[i], fidstr_object_info{data_obj_sequences[i], false, coll_id_list[i]});
+    }
+
+    return 0;
 }
 
 
-void handle_mkdir(const std::vector<std::pair<std::string, std::string> >& register_map, 
+int handle_mkdir(const register_path_map& register_map, 
         const int64_t& resource_id, const std::string& resource_name, const std::string& fidstr, 
         const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
@@ -641,7 +818,7 @@ void handle_mkdir(const std::vector<std::pair<std::string, std::string> >& regis
     if (lustre_path_to_irods_path(lustre_path, register_map, irods_path) < 0) {
         rodsLog(LOG_NOTICE, "Skipping mkdir on lustre_path [%s] which is not in register_map.",
                lustre_path.c_str());
-        return;
+        return 0;
     }
 
     if (direct_db_access_flag) { 
@@ -657,7 +834,7 @@ void handle_mkdir(const std::vector<std::pair<std::string, std::string> >& regis
         // if collection already exists (-809000), do not consider it an error
         if (0 > status && -809000 != status) {
             rodsLog(LOG_ERROR, "Error registering collection %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         } 
 
         // add lustre_identifier metadata
@@ -668,7 +845,7 @@ void handle_mkdir(const std::vector<std::pair<std::string, std::string> >& regis
         rodsLog(LOG_NOTICE, "Return value from chlAddAVUMetadata = %i", status);
         if (status < 0) {
             rodsLog(LOG_ERROR, "Error adding %s metadata to object %s.  Error is %i", fidstr_avu_key.c_str(), fidstr.c_str(), status);
-            return;
+            return status;
         }
 
     } else {
@@ -683,7 +860,7 @@ void handle_mkdir(const std::vector<std::pair<std::string, std::string> >& regis
         // if collection already exists (-809000), do not consider it an error
         if (0 > status && -809000 != status) {
             rodsLog(LOG_ERROR, "Error registering collection %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         } 
 
         // add lustre_identifier metadata
@@ -697,15 +874,282 @@ void handle_mkdir(const std::vector<std::pair<std::string, std::string> >& regis
         status = rsModAVUMetadata(_comm, &modAVUMetadataInp);
         if (status < 0) {
             rodsLog(LOG_ERROR, "Error adding %s metadata to object %s.  Error is %i", fidstr_avu_key.c_str(), fidstr.c_str(), status);
-            return;
+            return status;
+        }
+
+
+    }
+
+    return 0;
+}
+
+// Looks up a collection by its irods path.  Returns 0 and sets coll_id and inheritance if it
+// exists, CAT_NO_ROWS_FOUND if it does not and the error code otherwise.
+static int get_collection_id_and_inheritance(const std::string& coll_name, rodsLong_t& coll_id, bool& inheritance,
+        icatSessionStruct *icss) {
+
+    std::vector<std::string> bindVars;
+    bindVars.push_back(coll_name);
+    int stmt_num;
+    int status = cmlGetFirstRowFromSqlBV(get_collection_id_and_inheritance_sql.c_str(), bindVars, &stmt_num, icss);
+    if (CAT_NO_ROWS_FOUND == status) {
+        return status;
+    }
+    if (status < 0) {
+        rodsLog(LOG_ERROR, "Error looking up collection %s.  Error is %i", coll_name.c_str(), status);
+        return status;
+    }
+
+    if (icss->stmtPtr[stmt_num]->numOfCols != 2) {
+        rodsLog(LOG_ERROR, "Looking up collection %s, unexpected number of columns %d", coll_name.c_str(),
+                icss->stmtPtr[stmt_num]->numOfCols);
+        cllFreeStatement(icss, stmt_num);
+        return SYS_INTERNAL_ERR;
+    }
+
+    try {
+        coll_id = boost::lexical_cast<rodsLong_t>(icss->stmtPtr[stmt_num]->resultValue[0]);
+    } catch (boost::bad_lexical_cast&) {
+        rodsLog(LOG_ERROR, "Looking up collection %s, invalid coll_id %s", coll_name.c_str(), icss->stmtPtr[stmt_num]->resultValue[0]);
+        cllFreeStatement(icss, stmt_num);
+        return SYS_INTERNAL_ERR;
+    }
+    inheritance = (0 == strcmp(icss->stmtPtr[stmt_num]->resultValue[1], "1"));
+
+    cllFreeStatement(icss, stmt_num);
+    return 0;
+}
+
+// Registers the collections for the mkdir entries of a batch with a few bulk inserts in place of a
+// chlRegColl and chlAddAVUMetadata call per directory.  The entries must be in changelog order.  A
+// collection is registered only if its parent is already in the catalog or comes earlier in the
+// batch, otherwise the entry is added to failed_indices to be retried.  As with chlRegColl a
+// collection under a parent with inheritance set gets a copy of the parent's permissions,
+// otherwise the user is made the owner.
+int handle_batch_mkdir(const register_path_map& register_map, const std::vector<std::string>& fidstr_list,
+        const std::vector<std::string>& lustre_path_list, const int64_t& maximum_records_per_sql_command,
+        rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, std::vector<size_t>& failed_indices) {
+
+    size_t mkdir_count = fidstr_list.size();
+    int status;
+
+    if (mkdir_count == 0) {
+        return 0;
+    }
+
+    if (lustre_path_list.size() != mkdir_count) {
+        rodsLog(LOG_ERROR, "Handle batch mkdir.  Received lists of differing size");
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    std::vector<rodsLong_t> collection_sequences;
+    std::vector<rodsLong_t> metadata_sequences;
+    status = cmlGetNSeqVals(icss, mkdir_count, collection_sequences);
+    if (status == 0) {
+        status = cmlGetNSeqVals(icss, mkdir_count, metadata_sequences);
+    }
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Handle batch mkdir.  Error getting sequence values.  Error is %i", status);
+        return status;
+    }
+
+    // Collections looked up so far or registered earlier in the batch keyed by irods path.  A
+    // coll_id of 0 means the collection is not in the catalog.
+    std::map<std::string, std::pair<rodsLong_t, bool> > known_collections;
+    auto lookup_collection = [&known_collections, icss](const std::string& coll_name, rodsLong_t& coll_id, bool& inheritance) -> int {
+        auto iter = known_collections.find(coll_name);
+        if (iter == known_collections.end()) {
+            coll_id = 0;
+            inheritance = false;
+            int lookup_status = get_collection_id_and_inheritance(coll_name, coll_id, inheritance, icss);
+            if (lookup_status != 0 && lookup_status != CAT_NO_ROWS_FOUND) {
+                return lookup_status;
+            }
+            iter = known_collections.insert(std::make_pair(coll_name, std::make_pair(coll_id, inheritance))).first;
+        }
+        coll_id = iter->second.first;
+        inheritance = iter->second.second;
+        return 0;
+    };
+
+    std::vector<std::string> irods_path_list(mkdir_count);
+    std::vector<std::string> parent_path_list(mkdir_count);
+    std::vector<rodsLong_t> coll_id_list(mkdir_count);
+    std::vector<rodsLong_t> parent_coll_id_list(mkdir_count);
+    std::vector<bool> inheritance_list(mkdir_count);
+    std::vector<size_t> new_collection_list;    // entries that need a collection
+    std::vector<size_t> metadata_list;          // entries that need the lustre_identifier AVU
+
+    for (size_t i = 0; i < mkdir_count; ++i) {
+
+        if (lustre_path_to_irods_path(lustre_path_list[i], register_map, irods_path_list[i]) < 0) {
+            rodsLog(LOG_NOTICE, "Skipping mkdir on lustre_path [%s] which is not in register_map.",
+                   lustre_path_list[i].c_str());
+            continue;
+        }
+
+        rodsLong_t coll_id;
+        bool inheritance;
+        status = lookup_collection(irods_path_list[i], coll_id, inheritance);
+        if (status != 0) {
+            failed_indices.push_back(i);
+            continue;
+        }
+
+        // the collection already exists, only add the AVU if it is not already there
+        if (coll_id != 0) {
+            rodsLong_t registered_coll_id;
+            status = get_collection_id_from_fidstr(fidstr_list[i], registered_coll_id, icss);
+            if (status == CAT_NO_ROWS_FOUND) {
+                coll_id_list[i] = coll_id;
+                metadata_list.push_back(i);
+            } else if (status != 0) {
+                rodsLog(LOG_ERROR, "Error looking up collection with fidstr=%s.  Error is %i", fidstr_list[i].c_str(), status);
+                failed_indices.push_back(i);
+            }
+            continue;
+        }
+
+        parent_path_list[i] = boost::filesystem::path(irods_path_list[i]).parent_path().string();
+        rodsLong_t parent_coll_id;
+        bool parent_inheritance;
+        status = lookup_collection(parent_path_list[i], parent_coll_id, parent_inheritance);
+        if (status != 0 || parent_coll_id == 0) {
+            rodsLog(LOG_ERROR, "Error registering collection %s.  Parent collection %s is not registered.",
+                    irods_path_list[i].c_str(), parent_path_list[i].c_str());
+            failed_indices.push_back(i);
+            continue;
+        }
+
+        coll_id_list[i] = collection_sequences[i];
+        parent_coll_id_list[i] = parent_coll_id;
+        inheritance_list[i] = parent_inheritance;
+        known_collections[irods_path_list[i]] = std::make_pair(coll_id_list[i], parent_inheritance);
+        new_collection_list.push_back(i);
+        metadata_list.push_back(i);
+    }
+
+    if (metadata_list.empty()) {
+        return 0;
+    }
+
+    char now_str[MAX_NAME_LEN];
+    getNowStr(now_str);
+    std::string user_id_str = std::to_string(user_id);
+    std::vector<std::string> bind_values;
+
+    // insert into R_COLL_MAIN
+
+    for (size_t i : new_collection_list) {
+        bind_values.push_back(std::to_string(coll_id_list[i]));
+        bind_values.push_back(parent_path_list[i]);
+        bind_values.push_back(irods_path_list[i]);
+        bind_values.push_back(_comm->clientUser.userName);
+        bind_values.push_back(_comm->clientUser.rodsZone);
+        bind_values.push_back(inheritance_list[i] ? "1" : "");
+        bind_values.push_back(now_str);
+        bind_values.push_back(now_str);
+    }
+
+    status = execute_bulk_insert("insert into R_COLL_MAIN (coll_id, parent_coll_name, coll_name, coll_owner_name, coll_owner_zone, "
+                             "coll_inheritance, coll_type, coll_info1, coll_info2, create_ts, modify_ts)",
+                             "(?, ?, ?, ?, ?, ?, '', '', '', ?, ?)", 8, bind_values, maximum_records_per_sql_command, icss);
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Error performing batch insert into R_COLL_MAIN.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
+    }
+
+    // insert user ownership for collections that do not inherit their parent's permissions
+
+    bind_values.clear();
+    for (size_t i : new_collection_list) {
+        if (!inheritance_list[i]) {
+            bind_values.push_back(std::to_string(coll_id_list[i]));
+            bind_values.push_back(user_id_str);
+            bind_values.push_back(now_str);
+            bind_values.push_back(now_str);
         }
+    }
+
+    status = execute_bulk_insert("insert into R_OBJT_ACCESS (object_id, user_id, access_type_id, create_ts, modify_ts)",
+                             "(?, ?, 1200, ?, ?)", 4, bind_values, maximum_records_per_sql_command, icss);
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Error performing batch insert into R_OBJT_ACCESS.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
+    }
+
+    // copy the permissions for the rest, in order so a parent registered in this batch has its
+    // permissions before they are copied to its children
+
+    for (size_t i : new_collection_list) {
+        if (inheritance_list[i]) {
+            std::string coll_id_str = std::to_string(coll_id_list[i]);
+            std::string parent_coll_id_str = std::to_string(parent_coll_id_list[i]);
+            cllBindVars[0] = coll_id_str.c_str();
+            cllBindVars[1] = now_str;
+            cllBindVars[2] = now_str;
+            cllBindVars[3] = parent_coll_id_str.c_str();
+            cllBindVarCount = 4;
+            status = cmlExecuteNoAnswerSql(copy_collection_access_sql.c_str(), icss);
+            if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
+                rodsLog(LOG_ERROR, "Error copying permissions to collection %s.  Error is %i", irods_path_list[i].c_str(), status);
+                rollback_direct_db_changes(icss);
+                return status;
+            }
+        }
+    }
+
+    // Insert into R_META_MAIN
+
+    bind_values.clear();
+    for (size_t i : metadata_list) {
+        bind_values.push_back(std::to_string(metadata_sequences[i]));
+        bind_values.push_back(fidstr_avu_key);
+        bind_values.push_back(fidstr_list[i]);
+    }
 
+    status = execute_bulk_insert("insert into R_META_MAIN (meta_id, meta_attr_name, meta_attr_value)", "(?, ?, ?)", 3, bind_values,
+            maximum_records_per_sql_command, icss);
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Error performing batch insert into R_META_MAIN.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
+    }
+
+    // Insert into R_OBJT_METAMAP
+
+    bind_values.clear();
+    for (size_t i : metadata_list) {
+        bind_values.push_back(std::to_string(coll_id_list[i]));
+        bind_values.push_back(std::to_string(metadata_sequences[i]));
+    }
+
+    status = execute_bulk_insert("insert into R_OBJT_METAMAP (object_id, meta_id)", "(?, ?)", 2, bind_values,
+            maximum_records_per_sql_command, icss);
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Error performing batch insert into R_OBJT_METAMAP.  Error is %i.", status);
+        rollback_direct_db_changes(icss);
+        return status;
+    }
+
+#if !defined(COCKROACHDB_ICAT)
+    status = commit_direct_db_changes(icss);
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Error committing batch registration of collections.  Error is %i", status);
+        return status;
+    }
+#endif
 
+    for (size_t i : metadata_list) {
+        cache_object(fidstr_list[i], fidstr_object_info{coll_id_list[i], true, coll_id_list[i]});
     }
 
+    return 0;
 }
 
-void handle_other(const std::vector<std::pair<std::string, std::string> >& register_map, 
+int handle_other(const register_path_map& register_map, 
         const int64_t& resource_id, const std::string& resource_name, const std::string& fidstr, 
         const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
@@ -721,18 +1165,19 @@ void handle_other(const std::vector<std::pair<std::string, std::string> >& regis
         cllBindVarCount = 2;
         status = cmlExecuteNoAnswerSql(update_data_size_sql.c_str(), icss);
 
-        if (status != 0) {
+        // no rows updated just means the object is not registered
+        if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
             rodsLog(LOG_ERROR, "Error updating data_object_size for data_object %s.  Error is %i", fidstr.c_str(), status);
-            cmlExecuteNoAnswerSql("rollback", icss);
-            return;
+            rollback_direct_db_changes(icss);
+            return status;
         }
 
 #if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
+        status = commit_direct_db_changes(icss);
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error committing update to data_object_size for data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         } 
 #endif
 
@@ -742,6 +1187,9 @@ void handle_other(const std::vector<std::pair<std::string, std::string> >& regis
        
         // look up object based on fidstr
         status = find_irods_path_with_avu(_comm, fidstr_avu_key, fidstr, "", false, irods_path); 
+        if (status != 0) {
+            return status < 0 ? status : 0;
+        }
 
         // modify the file size
         modDataObjMeta_t modDataObjMetaInp;
@@ -771,14 +1219,151 @@ rodsLog(LOG_ERROR, "modDataObjMetaInp.regParam->len= %d", modDataObjMetaInp.regP
 
         if ( status < 0 ) {
             rodsLog(LOG_ERROR, "Error updating data object rename for data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
+        }
+
+    }
+
+    return 0;
+}
+
+// Applies the size updates for the OTHER entries of a batch.  For each group of up to
+// maximum_records_per_sql_command entries the data_id's that are not in the object cache are
+// looked up with one query and the sizes and modify times are set with one update statement
+// rather than a statement per entry.  Entries that are not registered are skipped.
+int handle_batch_other(const std::vector<std::string>& fidstr_list, const std::vector<int64_t>& file_size_list,
+        const std::vector<int64_t>& timestamp_list, const int64_t& maximum_records_per_sql_command, icatSessionStruct *icss) {
+
+    size_t update_count = fidstr_list.size();
+    int status;
+
+    if (update_count == 0) {
+        return 0;
+    }
+
+    if (file_size_list.size() != update_count || timestamp_list.size() != update_count) {
+        rodsLog(LOG_ERROR, "Handle batch other.  Received lists of differing size");
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    size_t batch_size = MAX_BIND_VARS;
+    if (maximum_records_per_sql_command > 0 && static_cast<size_t>(maximum_records_per_sql_command) < batch_size) {
+        batch_size = maximum_records_per_sql_command;
+    }
+
+    for (size_t batch_begin = 0; batch_begin < update_count; batch_begin += batch_size) {
+
+        size_t batch_end = std::min(batch_begin + batch_size, update_count);
+
+        // if a fidstr is in the batch more than once the last entry wins
+        std::map<std::string, size_t> fidstr_to_index_map;
+        for (size_t i = batch_begin; i < batch_end; ++i) {
+            fidstr_to_index_map[fidstr_list[i]] = i;
+        }
+
+        // data_id and the index of the entry with its new size
+        std::map<std::string, size_t> data_id_to_index_map;
+        std::vector<std::string> bindVars;
+        std::string query_objects_sql = "select R_DATA_MAIN.data_id, R_DATA_MAIN.coll_id, R_META_MAIN.meta_attr_value from R_DATA_MAIN "
+                "inner join R_OBJT_METAMAP on R_DATA_MAIN.data_id = R_OBJT_METAMAP.object_id "
+                "inner join R_META_MAIN on R_META_MAIN.meta_id = R_OBJT_METAMAP.meta_id "
+                "where R_META_MAIN.meta_attr_name = '" + fidstr_avu_key + "' and R_META_MAIN.meta_attr_value in (";
+        for (auto& iter : fidstr_to_index_map) {
+            fidstr_object_info info;
+            if (object_cache.lookup(iter.first, info) && !info.is_collection) {
+                data_id_to_index_map[std::to_string(info.object_id)] = iter.second;
+                continue;
+            }
+            if (!bindVars.empty()) {
+                query_objects_sql += ", ";
+            }
+            query_objects_sql += "?";
+            bindVars.push_back(iter.first);
+        }
+        query_objects_sql += ")";
+
+        if (!bindVars.empty()) {
+
+            // there is one row per replica
+            int stmt_num;
+            status = cmlGetFirstRowFromSqlBV(query_objects_sql.c_str(), bindVars, &stmt_num, icss);
+            if (CAT_NO_ROWS_FOUND != status) {
+                if (status < 0) {
+                    rodsLog(LOG_ERROR, "retrieving objects for size update - query %s, failure %d", query_objects_sql.c_str(), status);
+                    cllFreeStatement(icss, stmt_num);
+                    return status;
+                }
+
+                if (icss->stmtPtr[stmt_num]->numOfCols != 3) {
+                    rodsLog(LOG_ERROR, "cmlGetFirstRowFromSqlBV for query %s, unexpected number of columns %d", query_objects_sql.c_str(),
+                            icss->stmtPtr[stmt_num]->numOfCols);
+                    cllFreeStatement(icss, stmt_num);
+                    return SYS_INTERNAL_ERR;
+                }
+
+                do {
+                    const char *data_id = icss->stmtPtr[stmt_num]->resultValue[0];
+                    const char *coll_id = icss->stmtPtr[stmt_num]->resultValue[1];
+                    const char *fidstr = icss->stmtPtr[stmt_num]->resultValue[2];
+                    auto iter = fidstr_to_index_map.find(fidstr);
+                    if (iter != fidstr_to_index_map.end()) {
+                        data_id_to_index_map[data_id] = iter->second;
+                        cache_object(fidstr, fidstr_object_info{strtoll(data_id, nullptr, 10), false, strtoll(coll_id, nullptr, 10)});
+                    }
+                } while (cmlGetNextRowFromStatement(stmt_num, icss) == 0);
+            }
+
+            cllFreeStatement(icss, stmt_num);
+        }
+
+        // nothing in this batch is registered
+        if (data_id_to_index_map.empty()) {
+            continue;
+        }
+
+        // The data_id's come from the catalog and the sizes and times are integers so they are
+        // written into the statement.  This keeps the case expressions typed the same way on
+        // every database.
+        std::string size_cases;
+        std::string modify_ts_cases;
+        std::string data_id_list;
+        char timestamp_str[50];
+        for (auto& iter : data_id_to_index_map) {
+            const std::string& data_id = iter.first;
+            size_t i = iter.second;
+            snprintf(timestamp_str, sizeof(timestamp_str), "%011lld", static_cast<long long>(timestamp_list[i]));
+            size_cases += " when " + data_id + " then " + std::to_string(file_size_list[i]);
+            modify_ts_cases += " when " + data_id + " then '" + timestamp_str + "'";
+            if (!data_id_list.empty()) {
+                data_id_list += ", ";
+            }
+            data_id_list += data_id;
         }
 
+        std::string update_sql = "update R_DATA_MAIN set data_size = case data_id" + size_cases + " end, "
+                "modify_ts = case data_id" + modify_ts_cases + " end where data_id in (" + data_id_list + ")";
+
+        cllBindVarCount = 0;
+        status = cmlExecuteNoAnswerSql(update_sql.c_str(), icss);
+        if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
+            rodsLog(LOG_ERROR, "Error performing batch update of data_size for %lu objects.  Error is %i", data_id_to_index_map.size(), status);
+            rollback_direct_db_changes(icss);
+            return status;
+        }
     }
 
+#if !defined(COCKROACHDB_ICAT)
+    status = commit_direct_db_changes(icss);
+    if (status != 0) {
+        rodsLog(LOG_ERROR, "Error committing batch update of data_size.  Error is %i", status);
+        return status;
+    }
+#endif
+
+    return 0;
 }
 
-void handle_rename_file(const std::vector<std::pair<std::string, std::string> >& register_map, 
+int handle_rename_file(const register_path_map& register_map, 
         const int64_t& resource_id, const std::string& resource_name, const std::string& fidstr, 
         const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
@@ -788,6 +1373,9 @@ rodsLog(LOG_ERROR, "lustre_path: %s", lustre_path.c_str());
 
     int status;
 
+    // the parent collection may have changed
+    object_cache.erase(fidstr);
+
     if (direct_db_access_flag) { 
 
         // update data_name, data_path, and coll_id
@@ -798,18 +1386,18 @@ rodsLog(LOG_ERROR, "lustre_path: %s", lustre_path.c_str());
         cllBindVarCount = 4;
         status = cmlExecuteNoAnswerSql(update_data_object_for_rename_sql.c_str(), icss);
 
-        if (status != 0) {
+        if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
             rodsLog(LOG_ERROR, "Error updating data object rename for data_object %s.  Error is %i", fidstr.c_str(), status);
-            cmlExecuteNoAnswerSql("rollback", icss);
-            return;
+            rollback_direct_db_changes(icss);
+            return status;
         }
 
 #if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
+        status = commit_direct_db_changes(icss);
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error committing update to data object rename for data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 #endif
     } else {
@@ -821,14 +1409,14 @@ rodsLog(LOG_ERROR, "lustre_path: %s", lustre_path.c_str());
         status = find_irods_path_with_avu(_comm, fidstr_avu_key, fidstr, "", false, old_irods_path); 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error renaming data object %s.  Could not find object by fidstr.", fidstr.c_str());
-            return;
+            return status < 0 ? status : 0;
         }
 
         // look up new parent path based on parent fidstr
         status = find_irods_path_with_avu(_comm, fidstr_avu_key, parent_fidstr, "", true, new_parent_irods_path); 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error renaming data object %s.  Could not find object by fidstr.", parent_fidstr.c_str());
-            return;
+            return status < 0 ? status : 0;
         }
 
         std::string new_irods_path = new_parent_irods_path + "/" + object_name;
@@ -851,7 +1439,7 @@ rodsLog(LOG_ERROR, "lustre_path: %s", lustre_path.c_str());
 
         if ( status < 0 ) {
             rodsLog(LOG_ERROR, "Error updating data object rename for data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
         // rename the data object 
@@ -868,14 +1456,15 @@ rodsLog(LOG_ERROR, "lustre_path: %s", lustre_path.c_str());
 
         if ( status < 0 ) {
             rodsLog(LOG_ERROR, "Error updating data object rename for data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
     }
 
+    return 0;
 }
 
-void handle_rename_dir(const std::vector<std::pair<std::string, std::string> >& register_map, 
+int handle_rename_dir(const register_path_map& register_map, 
         const int64_t& resource_id, const std::string& resource_name, const std::string& fidstr, 
         const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
@@ -883,6 +1472,9 @@ void handle_rename_dir(const std::vector<std::pair<std::string, std::string> >&
 
     int status;
 
+    // the coll_id does not change but renamed objects are always dropped from the cache
+    object_cache.erase(fidstr);
+
     // determine the old irods path and new irods path for the collection
     std::string old_irods_path;
     std::string new_parent_irods_path;
@@ -892,14 +1484,14 @@ void handle_rename_dir(const std::vector<std::pair<std::string, std::string> >&
     status = find_irods_path_with_avu(_comm, fidstr_avu_key, fidstr, "", true, old_irods_path); 
     if (status != 0) {
     rodsLog(LOG_ERROR, "Error renaming data object %s.  Could not find object by fidstr.", fidstr.c_str());
-        return;
+        return status < 0 ? status : 0;
     }
 
     // look up new parent path based on the new parent fidstr
     status = find_irods_path_with_avu(_comm, fidstr_avu_key, parent_fidstr, "", true, new_parent_irods_path); 
     if (status != 0) {
         rodsLog(LOG_ERROR, "Error renaming data object %s.  Could not find object by fidstr.", parent_fidstr.c_str());
-        return;
+        return status < 0 ? status : 0;
     }
 
     // use object_name to get new irods path
@@ -924,7 +1516,8 @@ rodsLog(LOG_ERROR, "%s:%i - %s()", __FILE__, __LINE__, __FUNCTION__);
         std::string parent_path(parent_path_cstr);
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error looking up parent collection for rename for collection %s.  Error is %i", fidstr.c_str(), status);
-            cmlExecuteNoAnswerSql("rollback", icss);
+            rollback_direct_db_changes(icss);
+            return status;
         }
 
         collection_path = parent_path + irods::get_virtual_path_separator().c_str() + object_name;
@@ -941,16 +1534,16 @@ rodsLog(LOG_ERROR, "%s:%i - %s()", __FILE__, __LINE__, __FUNCTION__);
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error updating collection object rename for collection %s.  Error is %i", fidstr.c_str(), status);
-            cmlExecuteNoAnswerSql("rollback", icss);
-            return;
+            rollback_direct_db_changes(icss);
+            return status;
         }
 
 #if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
+        status = commit_direct_db_changes(icss);
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error committing update to collection rename for collection %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 #endif
 
@@ -965,12 +1558,12 @@ rodsLog(LOG_ERROR, "%s:%i - %s()", __FILE__, __LINE__, __FUNCTION__);
 
             if (irods_path_to_lustre_path(old_irods_path, register_map, old_lustre_path) < 0) {
                 rodsLog(LOG_ERROR, "%s - could not convert old irods path [%s] to old lustre path .  skipping.\n", old_irods_path.c_str(), old_lustre_path.c_str());
-                return;
+                return 0;
             }
 
             if (irods_path_to_lustre_path(new_irods_path, register_map, new_lustre_path) < 0) {
                 rodsLog(LOG_ERROR, "%s - could not convert new irods path [%s] to new lustre path .  skipping.\n", new_irods_path.c_str(), new_lustre_path.c_str());
-                return;
+                return 0;
             }
 
             std::string like_clause = old_lustre_path + "/%";
@@ -1003,21 +1596,21 @@ rodsLog(LOG_ERROR, "%s:%i - %s()", __FILE__, __LINE__, __FUNCTION__);
 
             if ( status < 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
                 rodsLog(LOG_ERROR, "Error updating data objects after collection move for collection %s.  Error is %i", fidstr.c_str(), status);
-                cmlExecuteNoAnswerSql("rollback", icss);
-                return;
+                rollback_direct_db_changes(icss);
+                return status;
             }
 
 #if !defined(COCKROACHDB_ICAT)
-            status =  cmlExecuteNoAnswerSql("commit", icss);
+            status = commit_direct_db_changes(icss);
             if (status != 0) {
                 rodsLog(LOG_ERROR, "Error committing data object update after collection move for collection %s.  Error is %i", fidstr.c_str(), status);
-                return;
+                return status;
             } 
 #endif
 
         } catch(const std::out_of_range& e) {
             rodsLog(LOG_ERROR, "Error updating data objects after collection move for collection %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return SYS_INTERNAL_ERR;
         }
 
 
@@ -1034,16 +1627,17 @@ rodsLog(LOG_ERROR, "%s:%i - %s()", __FILE__, __LINE__, __FUNCTION__);
         status = rsDataObjRename( _comm, &dataObjRenameInp );
         if ( status < 0 ) {
             rodsLog(LOG_ERROR, "Error updating data object rename for data_object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
         // TODO: Issue 6 - Handle update of data object physical paths using iRODS API's 
 
     }
 
+    return 0;
 }
 
-void handle_unlink(const std::vector<std::pair<std::string, std::string> >& register_map, 
+int handle_unlink(const register_path_map& register_map, 
         const int64_t& resource_id, const std::string& resource_name, const std::string& fidstr, 
         const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
@@ -1051,16 +1645,18 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
 
     int status;
 
+    object_cache.erase(fidstr);
+
     if (direct_db_access_flag) { 
 
         cllBindVars[0] = fidstr.c_str();
         cllBindVarCount = 1;
         status = cmlExecuteNoAnswerSql(unlink_sql.c_str(), icss);
 
-        if (status != 0) {
+        if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
             rodsLog(LOG_ERROR, "Error deleting data object %s.  Error is %i", fidstr.c_str(), status);
-            cmlExecuteNoAnswerSql("rollback", icss);
-            return;
+            rollback_direct_db_changes(icss);
+            return status;
         }
 
         // delete the metadata on the data object 
@@ -1075,11 +1671,11 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
 
 
 #if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
+        status = commit_direct_db_changes(icss);
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error committing delete for data object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 #endif
 
@@ -1093,7 +1689,7 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
         if (status != 0) {
             // Log as debug since this is a normal condition when the data object is not in register map.
             rodsLog(LOG_DEBUG, "Error unregistering data object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status < 0 ? status : 0;
         }
 
         // unregister the data object
@@ -1106,21 +1702,27 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error unregistering data object %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
 
     }
+
+    return 0;
 }
 
 #if !defined(COCKROACHDB_ICAT)
 
-    void handle_batch_unlink(const std::vector<std::string>& fidstr_list, const int64_t& resource_id, 
+    int handle_batch_unlink(const std::vector<std::string>& fidstr_list, const int64_t& resource_id, 
             const int64_t& maximum_records_per_sql_command, rsComm_t* _comm, icatSessionStruct *icss) {
     
         //size_t transactions_per_update = 1;
         int64_t delete_count = fidstr_list.size();
         int status;
+
+        for (auto& fidstr : fidstr_list) {
+            object_cache.erase(fidstr);
+        }
     
         // delete from R_DATA_MAIN
     
@@ -1159,7 +1761,7 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
                 if ( status < 0 ) {
                     rodsLog(LOG_ERROR, "retrieving object for unlink - query %s, failure %d", query_objects_sql.c_str(), status);
                     cllFreeStatement(icss, stmt_num);
-                    return;
+                    return status;
                 }
     
                 size_t nCols = icss->stmtPtr[stmt_num]->numOfCols;
@@ -1167,7 +1769,7 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
                 if (nCols != 1) {
                     rodsLog(LOG_ERROR, "cmlGetFirstRowFromSqlBV for query %s, unexpected number of columns %d", query_objects_sql.c_str(), nCols);
                     cllFreeStatement(icss, stmt_num);
-                    return;
+                    return SYS_INTERNAL_ERR;
                 }
     
                 object_id_list.push_back(icss->stmtPtr[stmt_num]->resultValue[0]);
@@ -1179,6 +1781,12 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
             }
     
             cllFreeStatement(icss, stmt_num);
+
+            // nothing in this batch is registered
+            if (object_id_list.empty()) {
+                batch_begin += maximum_records_per_sql_command;
+                continue;
+            }
     
     
             // Now do the delete for objects on resc_id
@@ -1198,15 +1806,15 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
     
             cllBindVarCount = 0;
             status = cmlExecuteNoAnswerSql(delete_sql.c_str(), icss);
-            if (status != 0) {
+            if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
                 rodsLog(LOG_ERROR, "Error performing batch delete from R_DATA_MAIN.  Error is %i.  SQL is %s.", status, delete_sql.c_str());
-                return;
+                return status;
             }
     
-            status =  cmlExecuteNoAnswerSql("commit", icss);
+            status = commit_direct_db_changes(icss);
             if (status != 0) {
                 rodsLog(LOG_ERROR, "Error committing batched deletion from R_DATA_MAIN.  Error is %i", status);
-                return;
+                return status;
             }
     
             // get a list of these deleted replicas that no longer have replicas so we can delete their metadata from the map
@@ -1235,7 +1843,7 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
                 if ( 0 > status ) {
                     rodsLog(LOG_ERROR, "retrieving objects to remove metadata - query %s, failure %d", query_objects_sql.c_str(), status);
                     cllFreeStatement(icss, stmt_num);
-                    return;
+                    return status;
                 }
         
                 size_t nCols = icss->stmtPtr[stmt_num]->numOfCols;
@@ -1243,7 +1851,7 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
                 if (nCols != 1) {
                     rodsLog(LOG_ERROR, "cmlGetFirstRowFromSqlBV for query %s, unexpected number of columns %d", query_objects_sql.c_str(), nCols);
                     cllFreeStatement(icss, stmt_num);
-                    return;
+                    return SYS_INTERNAL_ERR;
                 }
         
                 object_id_with_no_replicas_list.push_back(icss->stmtPtr[stmt_num]->resultValue[0]);
@@ -1276,32 +1884,37 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
                 status = cmlExecuteNoAnswerSql(delete_sql.c_str(), icss);
                 if (status != 0) {
                     rodsLog(LOG_ERROR, "Error performing batch delete from R_DATA_MAIN.  Error is %i.  SQL is %s.", status, delete_sql.c_str());
-                    return;
+                    return status;
                 }
         
-                status =  cmlExecuteNoAnswerSql("commit", icss);
+                status = commit_direct_db_changes(icss);
                 if (status != 0) {
                     rodsLog(LOG_ERROR, "Error committing batched deletion of data objects.  Error is %i", status);
-                    return;
+                    return status;
                 }
             }
     
             batch_begin += maximum_records_per_sql_command;
     
         }
-    
+
+        return 0;
     }
 
 #endif // !defined(COCKROACHDB_ICAT)
 
 #if defined(COCKROACHDB_ICAT)
 
-    void handle_batch_unlink(const std::vector<std::string>& fidstr_list, const int64_t& maximum_records_per_sql_command, rsComm_t* _comm, icatSessionStruct *icss) {
+    int handle_batch_unlink(const std::vector<std::string>& fidstr_list, const int64_t& maximum_records_per_sql_command, rsComm_t* _comm, icatSessionStruct *icss) {
 
         //size_t transactions_per_update = 1;
         int64_t delete_count = fidstr_list.size();
         int status;
 
+        for (auto& fidstr : fidstr_list) {
+            object_cache.erase(fidstr);
+        }
+
         // delete from R_DATA_MAIN
 
         std::string query_objects_sql(220 + maximum_records_per_sql_command*20, 0); 
@@ -1340,7 +1953,7 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
                 if ( status < 0 ) {
                     rodsLog(LOG_ERROR, "retrieving object for unlink - query %s, failure %d", query_objects_sql.c_str(), status);
                     cllFreeStatement(stmt_num);
-                    return;
+                    return status;
                 }
     
                 
@@ -1349,7 +1962,7 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
                 if (nCols != 1) {
                     rodsLog(LOG_ERROR, "cmlGetFirstRowFromSqlBV for query %s, unexpected number of columns %d", query_objects_sql.c_str(), nCols);
                     cllFreeStatement(stmt_num);
-                    return;
+                    return SYS_INTERNAL_ERR;
                 }
     
                 object_id_list.push_back(result_sets[stmt_num]->get_value(0));
@@ -1362,6 +1975,12 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
 
             cllFreeStatement(stmt_num);
 
+            // nothing in this batch is registered
+            if (object_id_list.empty()) {
+                batch_begin += maximum_records_per_sql_command;
+                continue;
+            }
+
             // Now do the delete
             
             delete_sql = "delete from R_DATA_MAIN where data_id in (";
@@ -1378,9 +1997,9 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
 
             cllBindVarCount = 0;
             status = cmlExecuteNoAnswerSql(delete_sql.c_str(), icss);
-            if (status != 0) {
+            if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
                 rodsLog(LOG_ERROR, "Error performing batch delete from R_DATA_MAIN.  Error is %i.  SQL is %s.", status, delete_sql.c_str());
-                return;
+                return status;
             }
 
 //            status =  cmlExecuteNoAnswerSql("commit", icss);
@@ -1406,9 +2025,9 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
 
             cllBindVarCount = 0;
             status = cmlExecuteNoAnswerSql(delete_sql.c_str(), icss);
-            if (status != 0) {
+            if (status != 0 && status != CAT_SUCCESS_BUT_WITH_NO_INFO) {
                 rodsLog(LOG_ERROR, "Error performing batch delete from R_DATA_MAIN.  Error is %i.  SQL is %s.", status, delete_sql.c_str());
-                return;
+                return status;
             }
 
 //            status =  cmlExecuteNoAnswerSql("commit", icss);
@@ -1421,10 +2040,11 @@ void handle_unlink(const std::vector<std::pair<std::string, std::string> >& regi
 
         }
 
+        return 0;
     }
 #endif // defined(COCKROACHDB_ICAT)
 
-void handle_rmdir(const std::vector<std::pair<std::string, std::string> >& register_map, 
+int handle_rmdir(const register_path_map& register_map, 
         const int64_t& resource_id, const std::string& resource_name, const std::string& fidstr, 
         const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
@@ -1432,6 +2052,8 @@ void handle_rmdir(const std::vector<std::pair<std::string, std::string> >& regis
 
     int status;
 
+    object_cache.erase(fidstr);
+
     if (direct_db_access_flag) { 
 
 
@@ -1442,7 +2064,7 @@ void handle_rmdir(const std::vector<std::pair<std::string, std::string> >& regis
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error deleting directory %s.  Error is %i", fidstr.c_str(), status);
-            cmlExecuteNoAnswerSql("rollback", icss);
+            rollback_direct_db_changes(icss);
             return;
         }*/
 
@@ -1457,11 +2079,11 @@ void handle_rmdir(const std::vector<std::pair<std::string, std::string> >& regis
         }
 
 #if !defined(COCKROACHDB_ICAT)
-        status =  cmlExecuteNoAnswerSql("commit", icss);
+        status = commit_direct_db_changes(icss);
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error committing delete for collection %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 #endif
 
@@ -1475,7 +2097,7 @@ void handle_rmdir(const std::vector<std::pair<std::string, std::string> >& regis
         if (status != 0) {
             // Log as debug since this is a normal condition when the collection is not in register map.
             rodsLog(LOG_DEBUG, "Error deleting directory %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status < 0 ? status : 0;
         }
 
         // remove the collection 
@@ -1488,36 +2110,36 @@ void handle_rmdir(const std::vector<std::pair<std::string, std::string> >& regis
 
         if (status != 0) {
             rodsLog(LOG_ERROR, "Error deleting directory %s.  Error is %i", fidstr.c_str(), status);
-            return;
+            return status;
         }
 
 
     }
+
+    return 0;
 }
 
-void handle_write_fid(const std::vector<std::pair<std::string, std::string> >& register_map, const std::string& lustre_path, 
+int handle_write_fid(const register_path_map& register_map, const std::string& lustre_path, 
                 const std::string& fidstr, rsComm_t* _comm, icatSessionStruct *icss, bool direct_db_access_flag) {
 
     std::string irods_path;
     if (lustre_path_to_irods_path(lustre_path, register_map, irods_path) < 0) {
         rodsLog(LOG_NOTICE, "Skipping handle_write_fid on lustre_path [%s] which is not in register_map.",
                lustre_path.c_str());
-        return;
+        return 0;
     }
 
     // query metadata to see if it already exists
     if (direct_db_access_flag) {
         rodsLong_t coll_id;
-        std::vector<std::string> bindVars;
-        bindVars.push_back(fidstr);
-        if (cmlGetIntegerValueFromSql(get_collection_id_from_fidstr_sql.c_str(), &coll_id, bindVars, icss ) != CAT_NO_ROWS_FOUND) {
-            return;
+        if (get_collection_id_from_fidstr(fidstr, coll_id, icss) != CAT_NO_ROWS_FOUND) {
+            return 0;
         }
     } else {
         int status = find_irods_path_with_avu(_comm, fidstr_avu_key, fidstr, "", true, irods_path); 
         if (status == 0) {
             // found a row which means the avu is already there, just return     
-            return;
+            return 0;
         } 
     }
 
@@ -1533,6 +2155,7 @@ void handle_write_fid(const std::vector<std::pair<std::string, std::string> >& r
     // ignore error code because the fid metadata likely already exists on the root collection
     rsModAVUMetadata(_comm, &modAVUMetadataInp);
 
+    return 0;
 }
 
 
@@ -43,54 +43,100 @@
 #ifndef IRODS_LUSTRE_OPERATIONS_H
 #define IRODS_LUSTRE_OPERATIONS_H
 
-void handle_create(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id, 
+#include "../../lustre_irods_connector/src/register_map.hpp"
+
+// The register_map received from the connector compiled for lookups in both directions.  This
+// is built once per request and shared by all of the entries.
+struct register_path_map {
+    explicit register_path_map(const std::vector<std::pair<std::string, std::string> >& register_map)
+        : lustre_to_irods(register_map)
+        , irods_to_lustre(register_map, true) {}
+
+    register_map_trie lustre_to_irods;
+    register_map_trie irods_to_lustre;
+};
+
+// The handlers return 0 when the change has been applied or when there is nothing to do for it
+// (for example the path is not in the register map) and the iRODS error code otherwise.  A
+// non-zero return means the connector should retry the entry.  The batch handlers fail as a
+// whole except for handle_batch_create and handle_batch_mkdir which add the positions of
+// individual entries they could not insert to failed_indices.
+
+int handle_create(const register_path_map& register_map, const int64_t& resource_id, 
         const std::string& resource_name, const std::string& fidstr, const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
         rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, bool direct_db_access);
 
-void handle_batch_create(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id,
+int handle_batch_create(const register_path_map& register_map, const int64_t& resource_id,
         const std::string& resource_name, const std::vector<std::string>& fidstr_list, const std::vector<std::string>& lustre_path_list,
         const std::vector<std::string>& object_name_list, const std::vector<std::string>& parent_fidstr_list,
         const std::vector<int64_t>& file_size_list, const int64_t& maximum_records_per_sql_command, rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id,
-        bool set_metadata_for_storage_tiering_time_violation, const std::string& metadata_key_for_storage_tiering_time_violation);
+        bool set_metadata_for_storage_tiering_time_violation, const std::string& metadata_key_for_storage_tiering_time_violation,
+        std::vector<size_t>& failed_indices);
 
-void handle_mkdir(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id, 
+int handle_mkdir(const register_path_map& register_map, const int64_t& resource_id, 
         const std::string& resource_name, const std::string& fidstr, const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
         rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, bool direct_db_access);
 
-void handle_other(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id, 
+int handle_batch_mkdir(const register_path_map& register_map, const std::vector<std::string>& fidstr_list,
+        const std::vector<std::string>& lustre_path_list, const int64_t& maximum_records_per_sql_command,
+        rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, std::vector<size_t>& failed_indices);
+
+int handle_other(const register_path_map& register_map, const int64_t& resource_id, 
         const std::string& resource_name, const std::string& fidstr, const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
         rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, bool direct_db_access);
 
-void handle_rename_file(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id, 
+int handle_batch_other(const std::vector<std::string>& fidstr_list, const std::vector<int64_t>& file_size_list,
+        const std::vector<int64_t>& timestamp_list, const int64_t& maximum_records_per_sql_command, icatSessionStruct *icss);
+
+int handle_rename_file(const register_path_map& register_map, const int64_t& resource_id, 
         const std::string& resource_name, const std::string& fidstr, const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
         rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, bool direct_db_access);
 
-void handle_rename_dir(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id, 
+int handle_rename_dir(const register_path_map& register_map, const int64_t& resource_id, 
         const std::string& resource_name, const std::string& fidstr, const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
         rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, bool direct_db_access);
 
-void handle_unlink(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id, 
+int handle_unlink(const register_path_map& register_map, const int64_t& resource_id, 
         const std::string& resource_name, const std::string& fidstr, const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
         rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, bool direct_db_access);
 
-void handle_batch_unlink(const std::vector<std::string>& fidstr_list, const int64_t& resource_id, 
+int handle_batch_unlink(const std::vector<std::string>& fidstr_list, const int64_t& resource_id, 
         const int64_t& maximum_records_per_sql_command, rsComm_t* _comm, icatSessionStruct *icss); 
 
-void handle_rmdir(const std::vector<std::pair<std::string, std::string> >& register_map, const int64_t& resource_id, 
+int handle_rmdir(const register_path_map& register_map, const int64_t& resource_id, 
         const std::string& resource_name, const std::string& fidstr, const std::string& lustre_path, const std::string& object_name, 
         const ChangeDescriptor::ObjectTypeEnum& object_type, const std::string& parent_fidstr, const int64_t& file_size,
         rsComm_t* _comm, icatSessionStruct *icss, const rodsLong_t& user_id, bool direct_db_access);
 
-void handle_write_fid(const std::vector<std::pair<std::string, std::string> >& register_map, const std::string& lustre_path, 
+int handle_write_fid(const register_path_map& register_map, const std::string& lustre_path, 
         const std::string& fidstr, rsComm_t* _comm, icatSessionStruct *icss, bool direct_db_access);
 
 
 
 int get_user_id(rsComm_t* _comm, icatSessionStruct *icss, rodsLong_t& user_id, bool direct_db_access_flag);
+
+// Sets the number of entries kept in the agent's fidstr to catalog object cache.  0 disables it.
+void set_fidstr_object_cache_size(size_t max_entries);
+
+// Logs the size and the hit and miss counts of the fidstr object cache.
+void log_fidstr_object_cache_counts();
+
+// Direct db transaction control.  The handlers commit with commit_direct_db_changes and roll back
+// with rollback_direct_db_changes which do nothing while single transaction mode is set.  In that
+// mode the caller brackets each entry with a savepoint and calls commit_single_transaction once
+// the change map has been applied.  The savepoint functions return 0 on success.
+void set_single_transaction_mode(bool enabled);
+int commit_direct_db_changes(icatSessionStruct *icss);
+void rollback_direct_db_changes(icatSessionStruct *icss);
+int commit_single_transaction(icatSessionStruct *icss);
+void rollback_single_transaction(icatSessionStruct *icss);
+int set_entry_savepoint(icatSessionStruct *icss);
+int release_entry_savepoint(icatSessionStruct *icss);
+int rollback_to_entry_savepoint(icatSessionStruct *icss);
 #endif
@@ -92,6 +92,7 @@ static irods::error serialize_irodsLustreApiOut_ptr_ptr( boost::any _p,
         if(tmp && *tmp ) {
             irodsLustreApiOut_t*  l = *tmp;
             _out["status"] = boost::lexical_cast<std::string>(l->status);
+            _out["failed_entry_count"] = boost::lexical_cast<std::string>(l->failed_entry_count);
         }
         else {
             _out["status"] = -1;
@@ -114,6 +115,33 @@ static irods::error serialize_irodsLustreApiOut_ptr_ptr( boost::any _p,
     #define CALL_IRODS_LUSTRE_API_INP_OUT NULL 
 #endif
 
+// Keeps the changes made since the entry's savepoint if status is 0 and undoes them otherwise.
+// Returns the status of the entry.  If the savepoint can not be rolled back the transaction is
+// marked broken so that none of it is committed.
+static int end_entry_savepoint(icatSessionStruct *icss, int status, bool& transaction_broken) {
+    if (0 == status) {
+        status = release_entry_savepoint(icss);
+    }
+    if (0 != status && 0 != rollback_to_entry_savepoint(icss)) {
+        transaction_broken = true;
+    }
+    return status;
+}
+
+// Ends the current transaction when a change map is applied in a single transaction.  The entries
+// applied since the last commit are only done once they are committed so they are all marked failed
+// if the commit does not go through or if an earlier savepoint could not be rolled back.
+static void end_single_transaction(icatSessionStruct *icss, bool& transaction_broken,
+        std::vector<int>& uncommitted_entries, std::vector<int>& failed_entries) {
+
+    if (transaction_broken || 0 != commit_single_transaction(icss)) {
+        rollback_single_transaction(icss);
+        failed_entries.insert(failed_entries.end(), uncommitted_entries.begin(), uncommitted_entries.end());
+    }
+    uncommitted_entries.clear();
+    transaction_broken = false;
+}
+
 // =-=-=-=-=-=-=-
 // api function to be referenced by the entry
 
@@ -131,12 +159,13 @@ int rs_handle_lustre_records( rsComm_t* _comm, irodsLustreApiInp_t* _inp, irodsL
     bool direct_db_modification_requested = (irods_api_update_type == "direct");
 
     // read and populate the register_map which holds a mapping of lustre paths to irods paths
-    std::vector<std::pair<std::string, std::string> > register_map;
+    std::vector<std::pair<std::string, std::string> > register_map_entries;
     for (RegisterMapEntry::Reader entry : changeMap.getRegisterMap()) {
         std::string lustre_path(entry.getLustrePath().cStr());
         std::string irods_register_path(entry.getIrodsRegisterPath().cStr());
-        register_map.push_back(std::make_pair(lustre_path, irods_register_path));
+        register_map_entries.push_back(std::make_pair(lustre_path, irods_register_path));
     }
+    register_path_map register_map(register_map_entries);
 
 
 
@@ -190,6 +219,8 @@ int rs_handle_lustre_records( rsComm_t* _comm, irodsLustreApiInp_t* _inp, irodsL
     // setup the output struct
     ( *_out ) = ( irodsLustreApiOut_t* )malloc( sizeof( irodsLustreApiOut_t ) );
     ( *_out )->status = 0;
+    ( *_out )->failed_entry_count = 0;
+    ( *_out )->failed_entries = nullptr;
 
     rodsLong_t user_id;
 
@@ -209,8 +240,27 @@ int rs_handle_lustre_records( rsComm_t* _comm, irodsLustreApiInp_t* _inp, irodsL
     int64_t maximum_records_per_sql_command = changeMap.getMaximumRecordsPerSqlCommand(); 
     bool set_metadata_for_storage_tiering_time_violation = changeMap.getSetMetadataForStorageTieringTimeViolation();
     std::string metadata_key_for_storage_tiering_time_violation = changeMap.getMetadataKeyForStorageTieringTimeViolation();
+    set_fidstr_object_cache_size(changeMap.getFidstrObjectCacheSize());
+
+    // Apply the whole change map in one transaction so the commit cost is paid once per batch
+    // rather than for every statement.  Each entry is put in a savepoint so a failed entry can be
+    // undone without losing the rest.  write_fid goes through an iRODS routine which commits on
+    // its own, so the pending changes are committed before it and it is applied outside of a
+    // savepoint.
+    bool single_transaction = direct_db_modification_requested && changeMap.getSingleTransactionPerBatch();
+#if defined(COCKROACHDB_ICAT)
+    single_transaction = false;
+#endif
+    bool transaction_broken = false;
+    std::vector<int> uncommitted_entries;
+    set_single_transaction_mode(single_transaction);
+
+    // positions of entries that failed and need to be retried by the connector
+    std::vector<int> failed_entries;
+    int entry_index = -1;
 
     // for batched file inserts 
+    std::vector<int> entry_index_list_for_create;
     std::vector<std::string> fidstr_list_for_create;
     std::vector<std::string> lustre_path_list;
     std::vector<std::string> object_name_list;
@@ -218,10 +268,60 @@ int rs_handle_lustre_records( rsComm_t* _comm, irodsLustreApiInp_t* _inp, irodsL
     std::vector<int64_t> file_size_list;
 
     // for batched file deletes
+    std::vector<int> entry_index_list_for_unlink;
     std::vector<std::string> fidstr_list_for_unlink;
 
+    // for batched size updates
+    std::vector<int> entry_index_list_for_other;
+    std::vector<std::string> fidstr_list_for_other;
+    std::vector<int64_t> file_size_list_for_other;
+    std::vector<int64_t> timestamp_list_for_other;
+
+    // for batched directory inserts
+    std::vector<int> entry_index_list_for_mkdir;
+    std::vector<std::string> fidstr_list_for_mkdir;
+    std::vector<std::string> lustre_path_list_for_mkdir;
+
+    // Registers the mkdir entries collected so far.  This is done before any entry that may
+    // depend on the new collections so that the changelog order is kept.
+    auto register_pending_mkdirs = [&]() {
+        if (fidstr_list_for_mkdir.empty()) {
+            return;
+        }
+
+        std::vector<size_t> failed_mkdirs;
+        int mkdir_status = single_transaction ? set_entry_savepoint(icss) : 0;
+        if (0 == mkdir_status) {
+            mkdir_status = handle_batch_mkdir(register_map, fidstr_list_for_mkdir, lustre_path_list_for_mkdir,
+                    maximum_records_per_sql_command, _comm, icss, user_id, failed_mkdirs);
+            if (single_transaction) {
+                mkdir_status = end_entry_savepoint(icss, mkdir_status, transaction_broken);
+            }
+        }
+        if (mkdir_status != 0) {
+            failed_entries.insert(failed_entries.end(), entry_index_list_for_mkdir.begin(), entry_index_list_for_mkdir.end());
+        } else {
+            std::vector<bool> mkdir_failed(entry_index_list_for_mkdir.size(), false);
+            for (size_t i : failed_mkdirs) {
+                failed_entries.push_back(entry_index_list_for_mkdir[i]);
+                mkdir_failed[i] = true;
+            }
+            for (size_t i = 0; single_transaction && i < entry_index_list_for_mkdir.size(); ++i) {
+                if (!mkdir_failed[i]) {
+                    uncommitted_entries.push_back(entry_index_list_for_mkdir[i]);
+                }
+            }
+        }
+
+        entry_index_list_for_mkdir.clear();
+        fidstr_list_for_mkdir.clear();
+        lustre_path_list_for_mkdir.clear();
+    };
+
     for (ChangeDescriptor::Reader entry : changeMap.getEntries()) {
 
+        ++entry_index;
+
         const ChangeDescriptor::EventTypeEnum event_type = entry.getEventType();
         std::string fidstr(entry.getFidstr().cStr());
         std::string lustre_path(entry.getLustrePath().cStr());
@@ -230,75 +330,204 @@ int rs_handle_lustre_records( rsComm_t* _comm, irodsLustreApiInp_t* _inp, irodsL
         std::string parent_fidstr(entry.getParentFidstr().cStr());
         int64_t file_size = entry.getFileSize();
 
+        // unused trailing entries
+        if (fidstr.empty()) {
+            continue;
+        }
+
         // Handle changes in iRODS
 
+        status = 0;
+
+        bool batched_entry = direct_db_modification_requested && (event_type == ChangeDescriptor::EventTypeEnum::CREATE ||
+                event_type == ChangeDescriptor::EventTypeEnum::UNLINK || event_type == ChangeDescriptor::EventTypeEnum::MKDIR ||
+                event_type == ChangeDescriptor::EventTypeEnum::OTHER);
+        bool commits_on_its_own = direct_db_modification_requested && event_type == ChangeDescriptor::EventTypeEnum::WRITE_FID;
+        bool in_savepoint = single_transaction && !batched_entry && !commits_on_its_own;
+
+        // renames, removals and write_fid may refer to collections created earlier in the batch
+        if (direct_db_modification_requested && (event_type == ChangeDescriptor::EventTypeEnum::RENAME ||
+                event_type == ChangeDescriptor::EventTypeEnum::RMDIR || event_type == ChangeDescriptor::EventTypeEnum::WRITE_FID)) {
+            register_pending_mkdirs();
+        }
+
+        if (single_transaction && commits_on_its_own) {
+            end_single_transaction(icss, transaction_broken, uncommitted_entries, failed_entries);
+        } else if (in_savepoint && 0 != set_entry_savepoint(icss)) {
+            failed_entries.push_back(entry_index);
+            continue;
+        }
+
         if (event_type == ChangeDescriptor::EventTypeEnum::CREATE) {
             if (direct_db_modification_requested) {
+                entry_index_list_for_create.push_back(entry_index);
                 fidstr_list_for_create.push_back(fidstr);
                 lustre_path_list.push_back(lustre_path);
                 object_name_list.push_back(object_name);
                 parent_fidstr_list.push_back(parent_fidstr);
                 file_size_list.push_back(file_size);
             } else {
-                handle_create(register_map, resource_id, resource_name,
+                status = handle_create(register_map, resource_id, resource_name,
                         fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
                         _comm, icss, user_id, direct_db_modification_requested);
             }
         } else if (event_type == ChangeDescriptor::EventTypeEnum::MKDIR) {
-            handle_mkdir(register_map, resource_id, resource_name,
-                    fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
-                    _comm, icss, user_id, direct_db_modification_requested);
+            if (direct_db_modification_requested) {
+                entry_index_list_for_mkdir.push_back(entry_index);
+                fidstr_list_for_mkdir.push_back(fidstr);
+                lustre_path_list_for_mkdir.push_back(lustre_path);
+            } else {
+                status = handle_mkdir(register_map, resource_id, resource_name,
+                        fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
+                        _comm, icss, user_id, direct_db_modification_requested);
+            }
         } else if (event_type == ChangeDescriptor::EventTypeEnum::OTHER) {
-            handle_other(register_map, resource_id, resource_name,
-                    fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
-                    _comm, icss, user_id, direct_db_modification_requested);
+            if (direct_db_modification_requested) {
+                entry_index_list_for_other.push_back(entry_index);
+                fidstr_list_for_other.push_back(fidstr);
+                file_size_list_for_other.push_back(file_size);
+                timestamp_list_for_other.push_back(entry.getTimestamp());
+            } else {
+                status = handle_other(register_map, resource_id, resource_name,
+                        fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
+                        _comm, icss, user_id, direct_db_modification_requested);
+            }
         } else if (event_type == ChangeDescriptor::EventTypeEnum::RENAME and object_type == ChangeDescriptor::ObjectTypeEnum::FILE) {
-            handle_rename_file(register_map, resource_id, resource_name,
+            status = handle_rename_file(register_map, resource_id, resource_name,
                     fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
                     _comm, icss, user_id, direct_db_modification_requested);
         } else if (event_type == ChangeDescriptor::EventTypeEnum::RENAME and object_type == ChangeDescriptor::ObjectTypeEnum::DIR) {
-            handle_rename_dir(register_map, resource_id, resource_name,
+            status = handle_rename_dir(register_map, resource_id, resource_name,
                     fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
                     _comm, icss, user_id, direct_db_modification_requested);
         } else if (event_type == ChangeDescriptor::EventTypeEnum::UNLINK) {
             if (direct_db_modification_requested) {
+                entry_index_list_for_unlink.push_back(entry_index);
                 fidstr_list_for_unlink.push_back(fidstr);
             } else {
-                handle_unlink(register_map, resource_id, resource_name,
+                status = handle_unlink(register_map, resource_id, resource_name,
                         fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
                         _comm, icss, user_id, direct_db_modification_requested);
             }
         } else if (event_type == ChangeDescriptor::EventTypeEnum::RMDIR) {
-            handle_rmdir(register_map, resource_id, resource_name,
+            status = handle_rmdir(register_map, resource_id, resource_name,
                     fidstr, lustre_path, object_name, object_type, parent_fidstr, file_size,
                     _comm, icss, user_id, direct_db_modification_requested);
         } else if (event_type == ChangeDescriptor::EventTypeEnum::WRITE_FID) {
-            handle_write_fid(register_map, lustre_path, fidstr, _comm, icss, direct_db_modification_requested);
+            status = handle_write_fid(register_map, lustre_path, fidstr, _comm, icss, direct_db_modification_requested);
         }
 
+        if (in_savepoint) {
+            status = end_entry_savepoint(icss, status, transaction_broken);
+        }
+
+        if (status != 0) {
+            failed_entries.push_back(entry_index);
+        } else if (in_savepoint) {
+            uncommitted_entries.push_back(entry_index);
+        }
 
     }
 
     if (direct_db_modification_requested) {
 
+        // the files created in this batch may be in the new collections
+        register_pending_mkdirs();
+
         if (fidstr_list_for_unlink.size() > 0) {
-            handle_batch_unlink(fidstr_list_for_unlink, resource_id, maximum_records_per_sql_command, _comm, icss);
+            status = single_transaction ? set_entry_savepoint(icss) : 0;
+            if (0 == status) {
+                status = handle_batch_unlink(fidstr_list_for_unlink, resource_id, maximum_records_per_sql_command, _comm, icss);
+                if (single_transaction) {
+                    status = end_entry_savepoint(icss, status, transaction_broken);
+                }
+            }
+            if (status != 0) {
+                failed_entries.insert(failed_entries.end(), entry_index_list_for_unlink.begin(), entry_index_list_for_unlink.end());
+            } else if (single_transaction) {
+                uncommitted_entries.insert(uncommitted_entries.end(), entry_index_list_for_unlink.begin(), entry_index_list_for_unlink.end());
+            }
         }
  
         if (fidstr_list_for_create.size() > 0) {
-            handle_batch_create(register_map, resource_id, resource_name,
-                    fidstr_list_for_create, lustre_path_list, object_name_list, parent_fidstr_list, file_size_list,
-                    maximum_records_per_sql_command, _comm, icss, user_id, set_metadata_for_storage_tiering_time_violation,
-                    metadata_key_for_storage_tiering_time_violation);
+            std::vector<size_t> failed_creates;
+            status = single_transaction ? set_entry_savepoint(icss) : 0;
+            if (0 == status) {
+                status = handle_batch_create(register_map, resource_id, resource_name,
+                        fidstr_list_for_create, lustre_path_list, object_name_list, parent_fidstr_list, file_size_list,
+                        maximum_records_per_sql_command, _comm, icss, user_id, set_metadata_for_storage_tiering_time_violation,
+                        metadata_key_for_storage_tiering_time_violation, failed_creates);
+                if (single_transaction) {
+                    status = end_entry_savepoint(icss, status, transaction_broken);
+                }
+            }
+            if (status != 0) {
+                failed_entries.insert(failed_entries.end(), entry_index_list_for_create.begin(), entry_index_list_for_create.end());
+            } else {
+                std::vector<bool> create_failed(entry_index_list_for_create.size(), false);
+                for (size_t i : failed_creates) {
+                    failed_entries.push_back(entry_index_list_for_create[i]);
+                    create_failed[i] = true;
+                }
+                for (size_t i = 0; single_transaction && i < entry_index_list_for_create.size(); ++i) {
+                    if (!create_failed[i]) {
+                        uncommitted_entries.push_back(entry_index_list_for_create[i]);
+                    }
+                }
+            }
+        }
+
+        // done after the creates so that files created in this batch get their sizes
+        if (fidstr_list_for_other.size() > 0) {
+            status = single_transaction ? set_entry_savepoint(icss) : 0;
+            if (0 == status) {
+                status = handle_batch_other(fidstr_list_for_other, file_size_list_for_other, timestamp_list_for_other,
+                        maximum_records_per_sql_command, icss);
+                if (single_transaction) {
+                    status = end_entry_savepoint(icss, status, transaction_broken);
+                }
+            }
+            if (status != 0) {
+                failed_entries.insert(failed_entries.end(), entry_index_list_for_other.begin(), entry_index_list_for_other.end());
+            } else if (single_transaction) {
+                uncommitted_entries.insert(uncommitted_entries.end(), entry_index_list_for_other.begin(), entry_index_list_for_other.end());
+            }
+        }
+
+        if (single_transaction) {
+            end_single_transaction(icss, transaction_broken, uncommitted_entries, failed_entries);
+            set_single_transaction_mode(false);
         }
     }
 
+    if (failed_entries.size() > 0) {
+        rodsLog(LOG_NOTICE, "Dynamic Lustre API - %lu entries failed", failed_entries.size());
+        ( *_out )->failed_entry_count = failed_entries.size();
+        ( *_out )->failed_entries = static_cast<int*>(malloc(failed_entries.size() * sizeof(int)));
+        memcpy(( *_out )->failed_entries, failed_entries.data(), failed_entries.size() * sizeof(int));
+    }
+
+    if (direct_db_modification_requested) {
+        log_fidstr_object_cache_counts();
+    }
+
     rodsLog(LOG_NOTICE, "Dynamic Lustre API - DONE" );
 
     return 0;
 }
 
 
+// Frees the request buffer.  The server frees the input struct after the call but not what it
+// points to.
+static void clear_irods_lustre_api_inp(void* _inp) {
+    irodsLustreApiInp_t* inp = static_cast<irodsLustreApiInp_t*>(_inp);
+    if (nullptr != inp) {
+        free(inp->buf);
+        inp->buf = nullptr;
+        inp->buflen = 0;
+    }
+}
+
 extern "C" {
     // =-=-=-=-=-=-=-
     // factory function to provide instance of the plugin
@@ -316,7 +545,7 @@ extern "C" {
                                     int( rsComm_t*,irodsLustreApiInp_t*,irodsLustreApiOut_t**)>(
                                         rs_handle_lustre_records), // operation
 								"rs_handle_lustre_records",    // operation name
-                                0,  // null clear fcn
+                                clear_irods_lustre_api_inp,  // clear fcn
                                 (funcPtr)CALL_IRODS_LUSTRE_API_INP_OUT
                               };
         // =-=-=-=-=-=-=-
@@ -0,0 +1,89 @@
+#ifndef BATCH_ACK_HPP
+#define BATCH_ACK_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Result of sending one change map batch to iRODS.  The updater sends this to the accumulator
+// in place of the batch itself since the entries are kept in the change table's in-flight list
+// until the batch is acknowledged.
+//
+// Wire format is the fixed size header optionally followed by a bitmap of entry_count bits
+// (one per entry in the batch, least significant bit first) where a set bit means that entry
+// failed.  The bitmap is only present when the status is BATCH_ACK_PARTIAL.
+enum batch_ack_status_t : uint32_t {
+    BATCH_ACK_PASS = 0,
+    BATCH_ACK_FAIL = 1,
+    BATCH_ACK_PARTIAL = 2
+};
+
+struct batch_ack_header {
+    uint64_t batch_id;
+    uint32_t status;
+    uint32_t entry_count;
+};
+
+inline size_t batch_ack_bitmap_size(uint32_t entry_count) {
+    return (entry_count + 7) / 8;
+}
+
+// Builds an ack into out.  If failed_entries is empty or has no entry set the status is written
+// as given, otherwise the status is written as BATCH_ACK_PARTIAL along with the bitmap.
+inline void encode_batch_ack(uint64_t batch_id, batch_ack_status_t status, uint32_t entry_count,
+        const std::vector<bool>& failed_entries, std::vector<unsigned char>& out) {
+
+    batch_ack_header header{batch_id, status, entry_count};
+
+    bool any_failed = false;
+    for (bool failed : failed_entries) {
+        if (failed) {
+            any_failed = true;
+            break;
+        }
+    }
+    if (BATCH_ACK_PASS == status && any_failed) {
+        header.status = BATCH_ACK_PARTIAL;
+    }
+
+    size_t bitmap_size = BATCH_ACK_PARTIAL == header.status ? batch_ack_bitmap_size(entry_count) : 0;
+    out.assign(sizeof(header) + bitmap_size, 0);
+    memcpy(out.data(), &header, sizeof(header));
+
+    for (size_t i = 0; i < bitmap_size * 8 && i < failed_entries.size(); ++i) {
+        if (failed_entries[i]) {
+            out[sizeof(header) + i / 8] |= 1 << (i % 8);
+        }
+    }
+}
+
+// Parses an ack.  failure_bitmap is set to nullptr unless the status is BATCH_ACK_PARTIAL.
+// Returns false if buf is too short to hold the ack.
+inline bool decode_batch_ack(const unsigned char *buf, size_t buflen, batch_ack_header& header,
+        const unsigned char*& failure_bitmap) {
+
+    failure_bitmap = nullptr;
+    if (nullptr == buf || buflen < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (BATCH_ACK_PARTIAL == header.status) {
+        if (buflen < sizeof(header) + batch_ack_bitmap_size(header.entry_count)) {
+            return false;
+        }
+        failure_bitmap = buf + sizeof(header);
+    }
+    return true;
+}
+
+inline bool batch_ack_entry_failed(const batch_ack_header& header, const unsigned char *failure_bitmap, size_t index) {
+    if (BATCH_ACK_FAIL == header.status) {
+        return true;
+    }
+    if (nullptr == failure_bitmap || index >= header.entry_count) {
+        return false;
+    }
+    return 0 != (failure_bitmap[index / 8] & (1 << (index % 8)));
+}
+
+#endif
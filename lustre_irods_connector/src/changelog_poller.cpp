@@ -11,10 +11,13 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <zmq.h>
-
-// boost headers 
-#include <boost/format.hpp>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 
 // irods headers 
 #include "rodsDef.h"
@@ -44,34 +47,30 @@ static inline bool fid_is_zero(lustre_fid_ptr fid) {
     return get_f_seq_from_lustre_fid(fid) == 0 && get_f_oid_from_lustre_fid(fid) == 0;
 }
 
-static boost::format fid_format_obj("%#llx:0x%x:0x%x");
-
-std::string convert_to_fidstr(lustre_fid_ptr fid) {
-    return str(fid_format_obj % get_f_seq_from_lustre_fid(fid) % 
-            get_f_oid_from_lustre_fid(fid) % 
-            get_f_ver_from_lustre_fid(fid));
+fid_key convert_to_fid(lustre_fid_ptr fid) {
+    return fid_key{get_f_seq_from_lustre_fid(fid), get_f_oid_from_lustre_fid(fid), get_f_ver_from_lustre_fid(fid)};
 }
 
-std::string get_fidstr_from_path(std::string path) {
+fid_key get_fid_from_path(const std::string& path) {
 
     lustre_fid_ptr fidptr;
     
     fidptr = llapi_path2fid_wrapper(path.c_str());
     if (fidptr != nullptr) {
-        std::string fidstr = convert_to_fidstr(fidptr);
+        fid_key fid = convert_to_fid(fidptr);
         free(fidptr);
-        return fidstr;
+        return fid;
     } else {
-        return std::string();
+        return fid_key{};
     }
 }
 
-// for rename - the overwritten file's fidstr
-std::string get_overwritten_fidstr_from_record(changelog_rec_ptr rec) {
-    return convert_to_fidstr(get_cr_tfid_from_changelog_rec(rec)); 
+// for rename - the overwritten file's fid
+fid_key get_overwritten_fid_from_record(changelog_rec_ptr rec) {
+    return convert_to_fid(get_cr_tfid_from_changelog_rec(rec)); 
 }
 
-int get_fidstr_from_record(changelog_rec_ptr rec, std::string& fidstr) {
+int get_fid_from_record(changelog_rec_ptr rec, fid_key& fid) {
 
     if (nullptr == rec) {
         LOG(LOG_ERR, "Null rec sent to %s - %d\n", __FUNCTION__, __LINE__);
@@ -83,23 +82,69 @@ int get_fidstr_from_record(changelog_rec_ptr rec, std::string& fidstr) {
 
     if (get_cr_type_from_changelog_rec(rec) == get_cl_rename()) {
         rnm = changelog_rec_wrapper_rename(rec);
-        fidstr = convert_to_fidstr(get_cr_sfid_from_changelog_ext_rename(rnm));
+        fid = convert_to_fid(get_cr_sfid_from_changelog_ext_rename(rnm));
     } else {
-        fidstr = convert_to_fidstr(get_cr_tfid_from_changelog_rec(rec));
+        fid = convert_to_fid(get_cr_tfid_from_changelog_rec(rec));
     }
 
     return lustre_irods::SUCCESS;
 
 }
 
-int get_full_path_from_record(const std::string& root_path, changelog_rec_ptr rec, std::string& lustre_full_path) {
+// Gets the full path of the directory identified by dir_fid.  The path is served from
+// dir_caches when possible, otherwise it is looked up with fid2path and added to the cache.
+int get_dir_path_from_fid(const std::string& root_path, const fid_key& dir_fid, directory_caches& dir_caches, std::string& dir_path) {
+
+    unsigned long long generation = dir_caches.current_generation();
+    if (dir_caches.lookup_path(dir_fid, dir_path)) {
+        return lustre_irods::SUCCESS;
+    }
+
+    char fidstr[FIDSTR_BUFFER_SIZE];
+    long long recno = -1;
+    int linkno = 0;
+
+    char dir_path_cstr[MAX_NAME_LEN] = {};
+
+    fid_to_fidstr(dir_fid, fidstr, sizeof(fidstr));
+
+    int rc = llapi_fid2path_wrapper(root_path.c_str(), fidstr, dir_path_cstr, MAX_NAME_LEN, &recno, &linkno);
+    if (rc < 0) {
+        return lustre_irods::LLAPI_FID2PATH_ERROR;
+    }
+
+    dir_path = concatenate_paths_with_boost(root_path, dir_path_cstr);
+    dir_caches.insert_path(dir_fid, dir_path, generation);
+
+    return lustre_irods::SUCCESS;
+}
+
+// parent_path is set to the path of the parent directory when the full path was built from it
+// and is left empty otherwise.
+int get_full_path_from_record(const std::string& root_path, changelog_rec_ptr rec, directory_caches& dir_caches, std::string& lustre_full_path,
+        std::string& parent_path) {
+
+    parent_path.clear();
 
     if (nullptr == rec) {
         LOG(LOG_ERR, "Null rec sent to %s - %d\n", __FUNCTION__, __LINE__);
         return lustre_irods::INVALID_OPERAND_ERROR;
     }
 
-    std::string fidstr;
+    // If the record has a parent and name, build the path from the parent directory's path
+    // which is usually cached.  Otherwise fall back to looking up the target fid.
+    fid_key parent_fid = convert_to_fid(get_cr_pfid_from_changelog_rec(rec));
+    if (get_cr_namelen_from_changelog_rec(rec) > 0 && !fid_is_zero(parent_fid)) {
+        if (lustre_irods::SUCCESS == get_dir_path_from_fid(root_path, parent_fid, dir_caches, parent_path)) {
+            std::string object_name(changelog_rec_wrapper_name(rec), get_cr_namelen_from_changelog_rec(rec));
+            lustre_full_path = concatenate_paths_with_boost(parent_path, object_name);
+            return lustre_irods::SUCCESS;
+        }
+        parent_path.clear();
+    }
+
+    fid_key fid;
+    char fidstr[FIDSTR_BUFFER_SIZE];
     long long recno = -1;
     int linkno = 0;
     int rc;
@@ -108,12 +153,13 @@ int get_full_path_from_record(const std::string& root_path, changelog_rec_ptr re
 
     // use fidstr to get path
 
-    rc = get_fidstr_from_record(rec, fidstr);
+    rc = get_fid_from_record(rec, fid);
     if (rc < 0) {
         return rc;
     }
+    fid_to_fidstr(fid, fidstr, sizeof(fidstr));
 
-    rc = llapi_fid2path_wrapper(root_path.c_str(), fidstr.c_str(), lustre_full_path_cstr, MAX_NAME_LEN, &recno, &linkno);
+    rc = llapi_fid2path_wrapper(root_path.c_str(), fidstr, lustre_full_path_cstr, MAX_NAME_LEN, &recno, &linkno);
 
     if (rc < 0) {
         return lustre_irods::LUSTRE_OBJECT_DNE_ERROR;        
@@ -125,7 +171,7 @@ int get_full_path_from_record(const std::string& root_path, changelog_rec_ptr re
     return lustre_irods::SUCCESS;
 }
 
-int not_implemented(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr, 
+int not_implemented(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid, 
         const std::string& object_path, const std::string& lustre_path, change_map_t& change_map) {
     return lustre_irods::SUCCESS;
 }
@@ -134,7 +180,7 @@ int not_implemented(unsigned long long cr_index, const std::string& lustre_root_
 //typedef int (*lustre_operation)(const std::string&, const std::string&, const std::string&, const std::string&, const std::string&, change_map_t&);
 
 //std::vector<lustre_operation> lustre_operators = 
-std::vector<std::function<int(unsigned long long, const std::string&, const std::string&, const std::string&, const std::string&, const std::string&, change_map_t&)> > lustre_operators = 
+std::vector<lustre_operation_t> lustre_operators = 
 {   &not_implemented,           // CL_MARK
     &lustre_create,             // CL_CREATE
     &lustre_mkdir,              // CL_MKDIR
@@ -157,7 +203,117 @@ std::vector<std::function<int(unsigned long long, const std::string&, const std:
     &not_implemented            // CL_ATIME - irods does not have an access time
 };
 
-int handle_record(const std::string& lustre_root_path, const std::vector<std::pair<std::string, std::string> >& register_map, changelog_rec_ptr rec, change_map_t& change_map) {
+// The record types that do something in the change table.
+static bool is_handled_record_type(unsigned int cr_type) {
+    return cr_type < lustre_operators.size() && cr_type < changelog_record_filter::MAX_RECORD_TYPES &&
+        (cr_type == get_cl_rename() || &not_implemented != lustre_operators[cr_type]);
+}
+
+// Returns the record type named type_name (CREAT, MKDIR, etc.) or get_cl_last() if there is none.
+static unsigned int record_type_from_name(const std::string& type_name) {
+    for (unsigned int cr_type = 0; cr_type < get_cl_last(); ++cr_type) {
+        if (0 == strcasecmp(type_name.c_str(), changelog_type2str_wrapper(cr_type))) {
+            return cr_type;
+        }
+    }
+    return get_cl_last();
+}
+
+static std::string record_type_mask_to_names(unsigned long long type_mask) {
+    std::string names;
+    for (unsigned int cr_type = 0; cr_type < get_cl_last() && cr_type < changelog_record_filter::MAX_RECORD_TYPES; ++cr_type) {
+        if (type_mask & (1ULL << cr_type)) {
+            if (!names.empty()) {
+                names += " ";
+            }
+            names += changelog_type2str_wrapper(cr_type);
+        }
+    }
+    return names;
+}
+
+// Converts the record type names from the configuration into a mask.  An empty list selects every
+// type the connector handles.  Types the connector has no handler for are left out of the mask.
+int build_changelog_record_type_mask(const std::vector<std::string>& type_names, unsigned long long& type_mask) {
+
+    type_mask = 0;
+
+    if (type_names.empty()) {
+        for (unsigned int cr_type = 0; cr_type < get_cl_last(); ++cr_type) {
+            if (is_handled_record_type(cr_type)) {
+                type_mask |= 1ULL << cr_type;
+            }
+        }
+        return lustre_irods::SUCCESS;
+    }
+
+    for (const std::string& type_name : type_names) {
+        unsigned int cr_type = record_type_from_name(type_name);
+        if (get_cl_last() == cr_type) {
+            LOG(LOG_ERR, "unknown changelog record type %s in changelog_record_types\n", type_name.c_str());
+            return lustre_irods::CONFIGURATION_ERROR;
+        }
+        if (!is_handled_record_type(cr_type)) {
+            LOG(LOG_WARN, "changelog record type %s is not handled by the connector and will be dropped\n", type_name.c_str());
+            continue;
+        }
+        type_mask |= 1ULL << cr_type;
+    }
+
+    LOG(LOG_INFO, "consuming changelog record types: %s\n", record_type_mask_to_names(type_mask).c_str());
+    return lustre_irods::SUCCESS;
+}
+
+// Compares the record types consumed by the connector with the changelog_mask of the MDT.  The mask
+// is only readable when running on the MDS.  Otherwise the lctl command to set it is logged.
+void check_mdt_changelog_mask(const std::string& mdtname, unsigned long long type_mask) {
+
+    std::string recommended_names = record_type_mask_to_names(type_mask);
+
+    std::ifstream mask_file("/sys/fs/lustre/mdd/" + mdtname + "/changelog_mask");
+    if (!mask_file.is_open()) {
+        mask_file.open("/proc/fs/lustre/mdd/" + mdtname + "/changelog_mask");
+    }
+    if (!mask_file.is_open()) {
+        LOG(LOG_INFO, "changelog_mask for %s is not readable from this host.  Records of other types are dropped by the "
+                "connector, to stop the MDS from recording them run: lctl set_param mdd.%s.changelog_mask=\"%s\"\n",
+                mdtname.c_str(), mdtname.c_str(), recommended_names.c_str());
+        return;
+    }
+
+    unsigned long long mdt_mask = 0;
+    std::string type_name;
+    while (mask_file >> type_name) {
+        unsigned int cr_type = record_type_from_name(type_name);
+        if (cr_type < get_cl_last() && cr_type < changelog_record_filter::MAX_RECORD_TYPES) {
+            mdt_mask |= 1ULL << cr_type;
+        }
+    }
+
+    if (type_mask & ~mdt_mask) {
+        LOG(LOG_ERR, "changelog_mask for %s does not include %s.  These changes will not be sent to iRODS.\n",
+                mdtname.c_str(), record_type_mask_to_names(type_mask & ~mdt_mask).c_str());
+    }
+    if (mdt_mask & ~type_mask) {
+        LOG(LOG_WARN, "changelog_mask for %s includes %s which are dropped by the connector.  To stop the MDS from "
+                "recording them run: lctl set_param mdd.%s.changelog_mask=\"%s\"\n", mdtname.c_str(),
+                record_type_mask_to_names(mdt_mask & ~type_mask).c_str(), mdtname.c_str(), recommended_names.c_str());
+    }
+}
+
+void log_dropped_record_counts(const std::string& mdtname, const changelog_record_filter& record_filter) {
+    std::stringstream counts;
+    for (unsigned int cr_type = 0; cr_type < record_filter.dropped_by_type.size(); ++cr_type) {
+        if (record_filter.dropped_by_type[cr_type] > 0) {
+            counts << "[" << changelog_type2str_wrapper(cr_type) << "=" << record_filter.dropped_by_type[cr_type] << "]";
+        }
+    }
+    LOG(LOG_INFO, "changelog records dropped by type for %s %s\n", mdtname.c_str(), counts.str().c_str());
+}
+
+// Decodes the changelog record into a change_record which will later be applied to the change table.
+int handle_record(const std::string& lustre_root_path, const register_map_trie& register_map, changelog_rec_ptr rec,
+        directory_caches& dir_caches, change_record& record) {
 
     if (nullptr == rec) {
         LOG(LOG_ERR, "Null rec sent to %s - %d\n", __FUNCTION__, __LINE__);
@@ -174,81 +330,101 @@ int handle_record(const std::string& lustre_root_path, const std::vector<std::pa
     unsigned long long cr_index = get_cr_index_from_changelog_rec(rec);
 
     std::string lustre_full_path;
-    std::string fidstr;
+    std::string parent_path;
+    fid_key fid;
+
+    get_fid_from_record(rec, fid);
+    fid_key parent_fid = convert_to_fid(get_cr_pfid_from_changelog_rec(rec));
+
+    // Records that are not on the register map are skipped except for deletes and renames
+    // since the path will not be there for those.
+    bool skip_if_unregistered = cr_type != get_cl_rename() && cr_type != get_cl_unlink() && cr_type != get_cl_rmdir();
+
+    // if the parent directory is already known to be outside of the registered trees skip the
+    // record without resolving its path
+    unsigned long long cache_generation = dir_caches.current_generation();
+    register_map_match_t parent_match = REGISTER_MAP_ANCESTOR;
+    bool has_parent = get_cr_namelen_from_changelog_rec(rec) > 0 && !fid_is_zero(parent_fid);
+    if (has_parent && dir_caches.lookup_parent_match(parent_fid, parent_match) && REGISTER_MAP_OUTSIDE == parent_match && skip_if_unregistered) {
+        LOG(LOG_DBG, "Skipping %s because its parent is not on the register map.\n", fid_to_fidstr(fid).c_str());
+        dir_caches.record_skipped();
+        return lustre_irods::SKIP_RECORD;
+    }
 
-    get_fidstr_from_record(rec, fidstr);
-    int rc = get_full_path_from_record(lustre_root_path, rec, lustre_full_path);
+    int rc = get_full_path_from_record(lustre_root_path, rec, dir_caches, lustre_full_path, parent_path);
     if (lustre_irods::SUCCESS != rc && lustre_irods::LUSTRE_OBJECT_DNE_ERROR != rc) {
         return rc;
     }
 
-
-    // make sure lustre_full_path is in register_map
-    bool in_register_map = false;
-    for (auto& iter : register_map) {
-        const std::string& lustre_path_prefix = iter.first;
-        if (lustre_full_path.compare(0, lustre_path_prefix.length(), lustre_path_prefix) == 0) {
-            in_register_map = true;
-            break;
-        }
+    if (!parent_path.empty() && REGISTER_MAP_ANCESTOR == parent_match) {
+        parent_match = register_map.classify(parent_path);
+        dir_caches.insert_parent_match(parent_fid, parent_match, cache_generation);
     }
 
-    // just skip if the path is not in the register map.  For deletes the path will not be there.
-    if (!in_register_map && cr_type != get_cl_rename() && cr_type != get_cl_unlink() && cr_type != get_cl_rmdir()) {
+    // make sure lustre_full_path is in register_map.  Everything under a registered parent is registered.
+    bool in_register_map = REGISTER_MAP_INSIDE == parent_match || register_map.contains(lustre_full_path);
+
+    // just skip if the path is not in the register map.
+    if (!in_register_map && skip_if_unregistered) {
         LOG(LOG_DBG, "Skipping %s because it is not on the register map.\n", lustre_full_path.c_str());
         return lustre_irods::SKIP_RECORD;
     }
 
-    std::string parent_fidstr = convert_to_fidstr(get_cr_pfid_from_changelog_rec(rec));
-
     std::string object_name(changelog_rec_wrapper_name(rec), get_cr_namelen_from_changelog_rec(rec));
 
+    record.cr_index = cr_index;
+    record.fid = fid;
+    record.parent_fid = parent_fid;
+    record.object_name = object_name;
+    record.lustre_path = lustre_full_path;
+
     if (cr_type == get_cl_rename()) {
 
-        // remove any entries in table 
-        std::string overwritten_fidstr = get_overwritten_fidstr_from_record(rec); 
-        remove_fidstr_from_table(overwritten_fidstr, change_map);
+        // any entries in table for the overwritten file are removed when the record is applied
+        record.is_rename = true;
+        record.operation = nullptr;
+        record.overwritten_fid = get_overwritten_fid_from_record(rec); 
 
-        long long recno = -1;
-        int linkno = 0;
         changelog_ext_rename_ptr rnm = changelog_rec_wrapper_rename(rec);
         std::string old_filename;
         std::string old_lustre_path;
-        std::string old_parent_fid;
         std::string old_parent_path;
 
         //old_filename = std::string(changelog_rec_wrapper_sname(rec)).substr(0, (int)changelog_rec_wrapper_snamelen(rec));
         old_filename = std::string(changelog_rec_wrapper_sname(rec), changelog_rec_wrapper_snamelen(rec));
 
-        old_parent_fid = convert_to_fidstr(get_cr_spfid_from_changelog_ext_rename(rnm));
-
-        char old_parent_path_cstr[MAX_NAME_LEN] = {};
-        rc = llapi_fid2path_wrapper(lustre_root_path.c_str(), old_parent_fid.c_str(), old_parent_path_cstr, MAX_NAME_LEN, &recno, &linkno);
+        rc = get_dir_path_from_fid(lustre_root_path, convert_to_fid(get_cr_spfid_from_changelog_ext_rename(rnm)), dir_caches, old_parent_path);
         if (rc < 0) {
             LOG(LOG_ERR, "llapi_fid2path in %s returned an error.", __FUNCTION__);
             return lustre_irods::LLAPI_FID2PATH_ERROR;
         } 
 
-        old_parent_path = old_parent_path_cstr;
+        old_lustre_path = concatenate_paths_with_boost(old_parent_path, old_filename);
 
-        // add a leading '/' if necessary
-        if (0 == old_parent_path.length() || '/' != old_parent_path[0]) {
-            old_parent_path = "/" + old_parent_path;
-        }
-        // add a trailing '/' if necessar
-        if ('/' != old_parent_path[old_parent_path.length()-1]) {
-             old_parent_path += "/";
-        }
+        // if a directory was moved, any cached paths at or below it are stale for every mdt.  the
+        // same goes for what is known about whether the directories under it are registered
+        // unless it stayed entirely inside or entirely outside of the registered trees.
+        register_map_match_t old_match = register_map.classify(old_lustre_path);
+        bool crossed_register_map = lustre_full_path.empty() || REGISTER_MAP_ANCESTOR == old_match ||
+            old_match != register_map.classify(lustre_full_path);
+        dir_caches.invalidate_rename(fid, record.overwritten_fid, old_lustre_path, crossed_register_map);
 
-        old_lustre_path = lustre_root_path + old_parent_path + old_filename;
-
-        return lustre_rename(cr_index, lustre_root_path, fidstr, parent_fidstr, object_name, lustre_full_path, old_lustre_path, change_map);
+        record.old_lustre_path = old_lustre_path;
     } else {
-        LOG(LOG_DBG, "calling lustre_operators[](%llu, %s, %s, %s, %s, %s, change_map)\n", cr_index, 
-                lustre_root_path.c_str(), fidstr.c_str(), parent_fidstr.c_str(), object_name.c_str(), lustre_full_path.c_str());
-        return lustre_operators[get_cr_type_from_changelog_rec(rec)](cr_index, lustre_root_path, fidstr, parent_fidstr, object_name, lustre_full_path, change_map);
+        LOG(LOG_DBG, "queueing lustre_operators[%u](%llu, %s, %s, %s, %s, %s)\n", cr_type, cr_index, 
+                lustre_root_path.c_str(), fid_to_fidstr(fid).c_str(), fid_to_fidstr(parent_fid).c_str(), object_name.c_str(), lustre_full_path.c_str());
+        if (cr_type == get_cl_rmdir()) {
+            dir_caches.invalidate_rmdir(fid);
+        }
+
+        record.is_rename = false;
+        record.operation = lustre_operators[cr_type];
+        record.overwritten_fid = fid_key{};
+        record.old_lustre_path.clear();
     }
 
+    return lustre_irods::SUCCESS;
+
 }
 
 int start_changelog(const std::string& mdtname, cl_ctx_ptr *ctx, unsigned long long start_cr_index) {
@@ -260,28 +436,137 @@ int finish_changelog(cl_ctx_ptr *ctx) {
     return changelog_wrapper_fini(ctx);
 }
 
+// Clears the changelog up to last_cr_index if either the record or the time watermark in
+// clear_state has been reached, or if force is set.  Otherwise the clear is deferred and
+// counted as a saved clear RPC.
+int clear_changelog_if_needed(const std::string& mdtname, const std::string& changelog_reader,
+        unsigned long long last_cr_index, changelog_clear_state& clear_state, bool force) {
+
+    if (last_cr_index <= clear_state.last_cleared_cr_index) {
+        return lustre_irods::SUCCESS;
+    }
+
+    time_t now = time(NULL);
+
+    if (!force && last_cr_index - clear_state.last_cleared_cr_index < clear_state.record_watermark &&
+            static_cast<unsigned int>(now - clear_state.last_clear_time) < clear_state.interval_seconds) {
+        clear_state.clear_calls_saved++;
+        return lustre_irods::SUCCESS;
+    }
+
+    LOG(LOG_DBG, "changelog_clear(%llu)\n", last_cr_index);
+    int rc = changelog_wrapper_clear(mdtname.c_str(), changelog_reader.c_str(), last_cr_index);
+    if (rc < 0) {
+        LOG(LOG_ERR, "changelog_clear: %s\n", zmq_strerror(-rc));
+        return lustre_irods::CHANGELOG_CLEAR_ERROR;
+    }
+
+    clear_state.last_cleared_cr_index = last_cr_index;
+    clear_state.last_clear_time = now;
+    clear_state.clear_calls++;
+
+    LOG(LOG_DBG, "changelog clear calls [made=%llu][saved=%llu]\n", clear_state.clear_calls, clear_state.clear_calls_saved);
+
+    return lustre_irods::SUCCESS;
+}
+
+static void log_changelog_record(changelog_rec_ptr rec) {
+
+    time_t      secs;
+    struct tm   ts;
+
+    //secs = get_cr_time_from_changelog_rec(rec) >> 30;
+    secs = get_cr_time_from_changelog_rec(rec) >> 30;
+    gmtime_r(&secs, &ts);
+
+    lustre_fid_ptr cr_tfid_ptr = get_cr_tfid_from_changelog_rec(rec);
+
+    LOG(LOG_INFO, "%llu %02d%-5s %02d:%02d:%02d.%06d %04d.%02d.%02d 0x%x t=%#llx:0x%x:0x%x",
+           get_cr_index_from_changelog_rec(rec), get_cr_type_from_changelog_rec(rec), 
+           changelog_type2str_wrapper(get_cr_type_from_changelog_rec(rec)), 
+           ts.tm_hour, ts.tm_min, ts.tm_sec,
+           (int)(get_cr_time_from_changelog_rec(rec) & ((1 << 30) - 1)),
+           ts.tm_year + 1900, ts.tm_mon + 1, ts.tm_mday,
+           get_cr_flags_from_changelog_rec(rec) & get_clf_flagmask(), 
+           get_f_seq_from_lustre_fid(cr_tfid_ptr),
+           get_f_oid_from_lustre_fid(cr_tfid_ptr),
+           get_f_ver_from_lustre_fid(cr_tfid_ptr));
+
+    if (get_cr_flags_from_changelog_rec(rec) & get_clf_jobid_mask()) {
+        LOG(LOG_INFO, " j=%s", (const char *)changelog_rec_wrapper_jobid(rec));
+    }
+
+    if (get_cr_flags_from_changelog_rec(rec) & get_clf_rename_mask()) { 
+        changelog_ext_rename_ptr rnm;
+
+        rnm = changelog_rec_wrapper_rename(rec);
+        if (!fid_is_zero(get_cr_sfid_from_changelog_ext_rename(rnm))) {
+            lustre_fid_ptr cr_sfid_ptr = get_cr_sfid_from_changelog_ext_rename(rnm);
+            lustre_fid_ptr cr_spfid_ptr = get_cr_spfid_from_changelog_ext_rename(rnm);
+            LOG(LOG_DBG, " s=%#llx:0x%x:0x%x sp=%#llx:0x%x:0x%x %.*s", 
+                   get_f_seq_from_lustre_fid(cr_sfid_ptr),
+                   get_f_oid_from_lustre_fid(cr_sfid_ptr),
+                   get_f_ver_from_lustre_fid(cr_sfid_ptr),
+                   get_f_seq_from_lustre_fid(cr_spfid_ptr),
+                   get_f_oid_from_lustre_fid(cr_spfid_ptr),
+                   get_f_ver_from_lustre_fid(cr_spfid_ptr),
+                   (int)changelog_rec_wrapper_snamelen(rec),
+                   changelog_rec_wrapper_sname(rec));
+        }
+    }
+
+    // if rename
+    if (get_cr_namelen_from_changelog_rec(rec)) {
+        lustre_fid_ptr cr_pfid_ptr = get_cr_pfid_from_changelog_rec(rec);
+        LOG(LOG_DBG, " p=%#llx:0x%x:0x%x %.*s", 
+                get_f_seq_from_lustre_fid(cr_pfid_ptr),
+                get_f_oid_from_lustre_fid(cr_pfid_ptr),
+                get_f_ver_from_lustre_fid(cr_pfid_ptr),
+                get_cr_namelen_from_changelog_rec(rec),
+                changelog_rec_wrapper_name(rec));
+    }
+
+    LOG(LOG_INFO, "\n");
+}
+
 // Poll the change log and process.
+// Records are received from llapi in batches of up to read_batch_size into a pre-sized array,
+// then decoded and handed to the change table owner as a group before being freed.
 // Arguments:
 //   mdtname - the name of the mdt
 //   lustre_root_path - the root path of the lustre mount point
-//   change_map - the change map
+//   record_queue - decoded records are pushed here for the change table owner thread
+//   change_table - the change table for this mdt, only used to find how far its journal has got
+//   dir_caches - directory paths and register map verdicts shared by the readers of every mdt
+//   record_filter - the record types to consume and the counts of the records dropped
+//   clear_state - watermark used to coalesce changelog clear calls
 //   ctx - the lustre changelog context 
+//   batch_full - set to true if max_records_to_retrieve records were read before reaching the end of the changelog
 int poll_change_log_and_process(const std::string& mdtname, const std::string& changelog_reader, const std::string& lustre_root_path, 
-        const std::vector<std::pair<std::string, std::string> >& register_map,
-        change_map_t& change_map, cl_ctx_ptr*& ctx, 
-        int max_records_to_retrieve, unsigned long long& last_cr_index) {
+        const register_map_trie& register_map,
+        change_record_queue_t& record_queue, change_table_t& change_table, directory_caches& dir_caches, 
+        changelog_record_filter& record_filter, changelog_clear_state& clear_state,
+        cl_ctx_ptr*& ctx, unsigned int read_batch_size, int max_records_to_retrieve, unsigned long long& last_cr_index,
+        bool& batch_full) {
 
     int                    rc;
     //char                   clid[64] = {0};
-    // the changelog_rec 
-    changelog_rec_ptr rec;
 
     int cntr = 0;
-    int skipped_records = 0;
+    bool end_of_changelog = false;
+    change_record record {};
 
-    while (cntr < max_records_to_retrieve) {
+    if (0 == read_batch_size) {
+        read_batch_size = 1;
+    }
+
+    // the changelog_recs for a batch.  the records themselves are allocated by llapi.
+    std::vector<changelog_rec_ptr> rec_batch;
+    rec_batch.reserve(read_batch_size);
 
-        LOG(LOG_DBG, " change_table size is %zu\n", get_change_table_size(change_map));
+    while (cntr < max_records_to_retrieve && !end_of_changelog) {
+
+        LOG(LOG_DBG, " record queue size is %zu\n", record_queue.size());
 
         if (nullptr == *ctx) {
             rc = start_changelog(mdtname, ctx, last_cr_index+1);
@@ -292,113 +577,100 @@ int poll_change_log_and_process(const std::string& mdtname, const std::string& c
             }
         }
 
-        rc = changelog_wrapper_recv(*ctx, &rec);
-
-        if (1 == rc || -EAGAIN == rc || -EPROTO == rc) {
-             finish_changelog(ctx);
-             *ctx = nullptr;
-             break;
-        } else if (0 != rc) {
-            break;
-        }
-
-        cntr++;
-
-        time_t      secs;
-        struct tm   ts;
-
-        //secs = get_cr_time_from_changelog_rec(rec) >> 30;
-        secs = get_cr_time_from_changelog_rec(rec) >> 30;
-        gmtime_r(&secs, &ts);
-
-        lustre_fid_ptr cr_tfid_ptr = get_cr_tfid_from_changelog_rec(rec);
-
-        LOG(LOG_INFO, "%llu %02d%-5s %02d:%02d:%02d.%06d %04d.%02d.%02d 0x%x t=%#llx:0x%x:0x%x",
-               get_cr_index_from_changelog_rec(rec), get_cr_type_from_changelog_rec(rec), 
-               changelog_type2str_wrapper(get_cr_type_from_changelog_rec(rec)), 
-               ts.tm_hour, ts.tm_min, ts.tm_sec,
-               (int)(get_cr_time_from_changelog_rec(rec) & ((1 << 30) - 1)),
-               ts.tm_year + 1900, ts.tm_mon + 1, ts.tm_mday,
-               get_cr_flags_from_changelog_rec(rec) & get_clf_flagmask(), 
-               get_f_seq_from_lustre_fid(cr_tfid_ptr),
-               get_f_oid_from_lustre_fid(cr_tfid_ptr),
-               get_f_ver_from_lustre_fid(cr_tfid_ptr));
+        // receive a batch of records
+        size_t batch_limit = std::min(static_cast<size_t>(read_batch_size), static_cast<size_t>(max_records_to_retrieve - cntr));
+        rec_batch.clear();
+        while (rec_batch.size() < batch_limit) {
+
+            changelog_rec_ptr rec;
+            rc = changelog_wrapper_recv(*ctx, &rec);
+
+            if (1 == rc || -EAGAIN == rc || -EPROTO == rc) {
+                 finish_changelog(ctx);
+                 *ctx = nullptr;
+                 end_of_changelog = true;
+                 break;
+            } else if (0 != rc) {
+                end_of_changelog = true;
+                break;
+            }
 
-        if (get_cr_flags_from_changelog_rec(rec) & get_clf_jobid_mask()) {
-            LOG(LOG_INFO, " j=%s", (const char *)changelog_rec_wrapper_jobid(rec));
+            rec_batch.push_back(rec);
         }
 
-        if (get_cr_flags_from_changelog_rec(rec) & get_clf_rename_mask()) { 
-            changelog_ext_rename_ptr rnm;
-
-            rnm = changelog_rec_wrapper_rename(rec);
-            if (!fid_is_zero(get_cr_sfid_from_changelog_ext_rename(rnm))) {
-                lustre_fid_ptr cr_sfid_ptr = get_cr_sfid_from_changelog_ext_rename(rnm);
-                lustre_fid_ptr cr_spfid_ptr = get_cr_spfid_from_changelog_ext_rename(rnm);
-                LOG(LOG_DBG, " s=%#llx:0x%x:0x%x sp=%#llx:0x%x:0x%x %.*s", 
-                       get_f_seq_from_lustre_fid(cr_sfid_ptr),
-                       get_f_oid_from_lustre_fid(cr_sfid_ptr),
-                       get_f_ver_from_lustre_fid(cr_sfid_ptr),
-                       get_f_seq_from_lustre_fid(cr_spfid_ptr),
-                       get_f_oid_from_lustre_fid(cr_spfid_ptr),
-                       get_f_ver_from_lustre_fid(cr_spfid_ptr),
-                       (int)changelog_rec_wrapper_snamelen(rec),
-                       changelog_rec_wrapper_sname(rec));
+        LOG(LOG_DBG, "received batch of %zu changelog records\n", rec_batch.size());
+
+        // decode and queue the batch
+        bool last_record_queued = true;
+        for (changelog_rec_ptr& rec : rec_batch) {
+
+            cntr++;
+            last_record_queued = false;
+
+            // drop record types that are not consumed before doing anything else with them
+            unsigned int cr_type = get_cr_type_from_changelog_rec(rec);
+            if (!record_filter.consumes(cr_type)) {
+                record_filter.count_dropped(cr_type);
+                cntr--;
+                last_cr_index = get_cr_index_from_changelog_rec(rec);
+                rc = changelog_wrapper_free(&rec);
+                if (rc < 0) {
+                    LOG(LOG_ERR, "changelog_free: %s\n", zmq_strerror(-rc));
+                }
+                continue;
             }
-        }
 
-        // if rename
-        if (get_cr_namelen_from_changelog_rec(rec)) {
-            lustre_fid_ptr cr_pfid_ptr = get_cr_pfid_from_changelog_rec(rec);
-            LOG(LOG_DBG, " p=%#llx:0x%x:0x%x %.*s", 
-                    get_f_seq_from_lustre_fid(cr_pfid_ptr),
-                    get_f_oid_from_lustre_fid(cr_pfid_ptr),
-                    get_f_ver_from_lustre_fid(cr_pfid_ptr),
-                    get_cr_namelen_from_changelog_rec(rec),
-                    changelog_rec_wrapper_name(rec));
-        }
-
-        LOG(LOG_INFO, "\n");
-
-        rc = handle_record(lustre_root_path, register_map, rec, change_map);
-        if (rc == lustre_irods::SKIP_RECORD) {
-            // if the record is skipped, don't count this against max records
-            cntr--;
-            skipped_records++;
-        } else if (rc < 0) {
-            lustre_fid_ptr cr_tfid_ptr = get_cr_tfid_from_changelog_rec(rec);
-            LOG(LOG_ERR, "handle record failed for %s %#llx:0x%x:0x%x rc = %i\n", 
-                    changelog_type2str_wrapper(get_cr_type_from_changelog_rec(rec)), 
-                    get_f_seq_from_lustre_fid(cr_tfid_ptr),
-                    get_f_oid_from_lustre_fid(cr_tfid_ptr),
-                    get_f_ver_from_lustre_fid(cr_tfid_ptr),
-                    rc);
-        }
+            log_changelog_record(rec);
+
+            rc = handle_record(lustre_root_path, register_map, rec, dir_caches, record);
+            if (rc == lustre_irods::SUCCESS) {
+                // the owner thread drains the queue in batches so this only waits if the 
+                // queue is completely full
+                while (!record_queue.try_push(record)) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                last_record_queued = true;
+            } else if (rc == lustre_irods::SKIP_RECORD) {
+                // if the record is skipped, don't count this against max records
+                cntr--;
+            } else if (rc < 0) {
+                lustre_fid_ptr cr_tfid_ptr = get_cr_tfid_from_changelog_rec(rec);
+                LOG(LOG_ERR, "handle record failed for %s %#llx:0x%x:0x%x rc = %i\n", 
+                        changelog_type2str_wrapper(get_cr_type_from_changelog_rec(rec)), 
+                        get_f_seq_from_lustre_fid(cr_tfid_ptr),
+                        get_f_oid_from_lustre_fid(cr_tfid_ptr),
+                        get_f_ver_from_lustre_fid(cr_tfid_ptr),
+                        rc);
+            }
 
-        last_cr_index = get_cr_index_from_changelog_rec(rec);
-        rc = changelog_wrapper_free(&rec);
-        if (rc < 0) {
-            LOG(LOG_ERR, "changelog_free: %s\n", zmq_strerror(-rc));
+            last_cr_index = get_cr_index_from_changelog_rec(rec);
+            rc = changelog_wrapper_free(&rec);
+            if (rc < 0) {
+                LOG(LOG_ERR, "changelog_free: %s\n", zmq_strerror(-rc));
+            }
         }
 
-        // if we are skipping a bunch of records, go ahead and confirm them periodically
-        if (skipped_records > max_records_to_retrieve) {
-            skipped_records = 0;
-            LOG(LOG_DBG, "changelog_clear(%llu)\n", last_cr_index);
-            rc = changelog_wrapper_clear(mdtname.c_str(), changelog_reader.c_str(), last_cr_index);
-            if (rc < 0) {
-                LOG(LOG_ERR, "changelog_clear: %s\n", zmq_strerror(-rc));
+        // If the batch ended with records that were not queued, send a watermark so the owner
+        // still journals our position.  Otherwise those records could never be cleared.
+        if (!last_record_queued) {
+            record = change_record{};
+            record.cr_index = last_cr_index;
+            record.operation = nullptr;
+            record.is_rename = false;
+            while (!record_queue.try_push(record)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
         }
 
+        // confirm records periodically so that long runs of skipped records do not pile up.
+        // only records that have been written to the journal are cleared.
+        clear_changelog_if_needed(mdtname, changelog_reader, std::min(last_cr_index, get_journaled_cr_index(change_table)), clear_state, false);
     }
 
-    rc = changelog_wrapper_clear(mdtname.c_str(), changelog_reader.c_str(), last_cr_index);
-    if (rc < 0) {
-        LOG(LOG_ERR, "changelog_clear: %s\n", zmq_strerror(-rc));
-    }
+    // if we stopped because of the limit rather than running out of records there are probably more waiting
+    batch_full = !end_of_changelog && max_records_to_retrieve > 0 && cntr >= max_records_to_retrieve;
 
+    dir_caches.log_counts();
 
     return lustre_irods::SUCCESS;
 }
-
@@ -1,23 +1,77 @@
 #ifndef CHANGELOG_POLLER_H
 #define CHANGELOG_POLLER_H
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "lustre_fid.hpp"
+#include "register_map.hpp"
+#include "directory_caches.hpp"
+
 extern "C" {
   #include "llapi_cpp_wrapper.h"
 }
 
-std::string get_fidstr_from_path(std::string path);
+fid_key get_fid_from_path(const std::string& path);
+
+// Watermark used to coalesce llapi_changelog_clear calls.  A clear is only sent to the MDS
+// once record_watermark records or interval_seconds have passed since the last clear.
+struct changelog_clear_state {
+    unsigned int       record_watermark;
+    unsigned int       interval_seconds;
+    unsigned long long last_cleared_cr_index;
+    time_t             last_clear_time;
+    unsigned long long clear_calls;           // clear RPCs sent to the MDS
+    unsigned long long clear_calls_saved;     // clears that were deferred by the watermark
+};
+
+// Changelog record types the reader passes on to the change table.  Records of any other type are
+// freed as soon as they are read and only counted.
+struct changelog_record_filter {
+    static const unsigned int MAX_RECORD_TYPES = 64;
+
+    explicit changelog_record_filter(unsigned long long type_mask)
+        : type_mask(type_mask)
+        , dropped_by_type(MAX_RECORD_TYPES, 0) {}
+
+    bool consumes(unsigned int cr_type) const {
+        return cr_type < MAX_RECORD_TYPES && 0 != (type_mask & (1ULL << cr_type));
+    }
+
+    void count_dropped(unsigned int cr_type) {
+        ++dropped_by_type[std::min(cr_type, MAX_RECORD_TYPES - 1)];
+    }
+
+    unsigned long long type_mask;
+    std::vector<unsigned long long> dropped_by_type;
+};
+
+int build_changelog_record_type_mask(const std::vector<std::string>& type_names, unsigned long long& type_mask);
+
+void check_mdt_changelog_mask(const std::string& mdtname, unsigned long long type_mask);
+
+void log_dropped_record_counts(const std::string& mdtname, const changelog_record_filter& record_filter);
+
+int clear_changelog_if_needed(const std::string& mdtname, const std::string& changelog_reader,
+        unsigned long long last_cr_index, changelog_clear_state& clear_state, bool force);
 
 int start_changelog(const std::string&, cl_ctx_ptr*, unsigned long long start_cr_index);
 
 int poll_change_log_and_process(const std::string& mdtname, 
         const std::string& changelog_reader, 
         const std::string& lustre_root_path, 
-        const std::vector<std::pair<std::string, 
-        std::string> >& register_map,
-        change_map_t& change_map, 
+        const register_map_trie& register_map,
+        change_record_queue_t& record_queue, 
+        change_table_t& change_table, 
+        directory_caches& dir_caches, 
+        changelog_record_filter& record_filter, 
+        changelog_clear_state& clear_state, 
         cl_ctx_ptr*& ctx, 
+        unsigned int read_batch_size, 
         int max_records_to_retrieve, 
-        unsigned long long& last_cr_index); 
+        unsigned long long& last_cr_index, 
+        bool& batch_full); 
 
 
 int finish_changelog(void**);
@@ -35,6 +35,22 @@ int read_key_from_map(const json_map& config_map, const std::string &key, std::s
     return lustre_irods::SUCCESS;
 }
 
+// Reads an optional unsigned integer setting.  If the key is missing value is set to default_value.
+int read_optional_unsigned_int_from_map(const json_map& config_map, const std::string &key, unsigned int& value, unsigned int default_value) {
+    std::string value_str;
+    if (0 != read_key_from_map(config_map, key, value_str, false)) {
+        value = default_value;
+        return lustre_irods::SUCCESS;
+    }
+    try {
+        value = boost::lexical_cast<unsigned int>(value_str);
+    } catch (boost::bad_lexical_cast& e) {
+        LOG(LOG_ERR, "Could not parse %s as an integer.\n", key.c_str());
+        return lustre_irods::CONFIGURATION_ERROR;
+    }
+    return lustre_irods::SUCCESS;
+}
+
 void set_log_level(const std::string& log_level_str) {
     if ("LOG_FATAL" == log_level_str) {
         log_level = LOG_FATAL; 
@@ -85,18 +101,56 @@ int read_config_file(const std::string& filename, lustre_irods_connector_cfg_t *
     std::string maximum_records_to_receive_from_lustre_changelog_str;
     std::string message_receive_timeout_msec_str;
     std::string time_violation_setting_str;
+    std::string single_transaction_setting_str;
 
     try {
         json_map config_map{ json_file{ filename.c_str() } };
 
-        if (0 != read_key_from_map(config_map, "mdtname", config_struct->mdtname)) {
-            LOG(LOG_ERR, "Key mdtname missing from %s\n", filename.c_str());
-            return lustre_irods::CONFIGURATION_ERROR;
-        }
+        // read the MDTs - either an mdt_list array or a single mdtname and changelog_reader
+        if (config_map.end() != config_map.find("mdt_list")) {
+            try {
+                auto &mdt_array(config_map.get<json_array>("mdt_list"));
+
+                for (auto& iter : mdt_array) {
+                    auto mdt_entry = iter.as<json_map>();
+
+                    mdt_cfg_t mdt;
+
+                    if (0 != read_key_from_map(mdt_entry, "mdtname", mdt.mdtname)) {
+                        LOG(LOG_ERR, "Key mdtname missing from entry in mdt_list of json file %s\n", filename.c_str());
+                        return lustre_irods::CONFIGURATION_ERROR;
+                    }
+                    if (0 != read_key_from_map(mdt_entry, "changelog_reader", mdt.changelog_reader)) {
+                        LOG(LOG_ERR, "Key changelog_reader missing from entry in mdt_list of json file %s\n", filename.c_str());
+                        return lustre_irods::CONFIGURATION_ERROR;
+                    }
+                    config_struct->mdt_list.push_back(mdt);
+                }
 
-        if (0 != read_key_from_map(config_map, "changelog_reader", config_struct->changelog_reader)) {
-            LOG(LOG_ERR, "Key changelog_reader missing from %s\n", filename.c_str());
-            return lustre_irods::CONFIGURATION_ERROR;
+            } catch (const std::exception& e) {
+                LOG(LOG_ERR, "Could not read mdt_list array from %s\n", filename.c_str());
+                return lustre_irods::CONFIGURATION_ERROR;
+            }
+
+            if (config_struct->mdt_list.empty()) {
+                LOG(LOG_ERR, "mdt_list in %s is empty\n", filename.c_str());
+                return lustre_irods::CONFIGURATION_ERROR;
+            }
+        } else {
+
+            mdt_cfg_t mdt;
+
+            if (0 != read_key_from_map(config_map, "mdtname", mdt.mdtname)) {
+                LOG(LOG_ERR, "Key mdtname missing from %s\n", filename.c_str());
+                return lustre_irods::CONFIGURATION_ERROR;
+            }
+
+            if (0 != read_key_from_map(config_map, "changelog_reader", mdt.changelog_reader)) {
+                LOG(LOG_ERR, "Key changelog_reader missing from %s\n", filename.c_str());
+                return lustre_irods::CONFIGURATION_ERROR;
+            }
+
+            config_struct->mdt_list.push_back(mdt);
         }
 
         if (0 != read_key_from_map(config_map, "lustre_root_path", config_struct->lustre_root_path)) {
@@ -184,6 +238,13 @@ int read_config_file(const std::string& filename, lustre_irods_connector_cfg_t *
         } 
         LOG(LOG_INFO, "set metadata_key_for_storage_tiering_time_violation=%s\n", config_struct->metadata_key_for_storage_tiering_time_violation.c_str());
 
+        if (0 != read_key_from_map(config_map, "single_transaction_per_batch", single_transaction_setting_str, false)) {
+            config_struct->single_transaction_per_batch = false;
+        } else {
+            std::transform(single_transaction_setting_str.begin(), single_transaction_setting_str.end(), single_transaction_setting_str.begin(), ::tolower);
+            config_struct->single_transaction_per_batch = (single_transaction_setting_str == "true");
+        }
+
         // read register_map
         try {
             auto &register_map_array(config_map.get<json_array>("register_map"));
@@ -211,11 +272,28 @@ int read_config_file(const std::string& filename, lustre_irods_connector_cfg_t *
                 config_struct->register_map.push_back(path_entry_pair);
             }
 
+            config_struct->register_map_lookup = register_map_trie(config_struct->register_map);
+
         } catch (const std::exception& e) {
             LOG(LOG_ERR, "Could not read register_map array from %s\n", filename.c_str());
             return lustre_irods::CONFIGURATION_ERROR;
         }
 
+        // read the optional list of changelog record types to consume
+        if (config_map.end() != config_map.find("changelog_record_types")) {
+            try {
+                auto &record_type_array(config_map.get<json_array>("changelog_record_types"));
+
+                for (auto& iter : record_type_array) {
+                    config_struct->changelog_record_types.push_back(iter.as<std::string>());
+                }
+
+            } catch (const std::exception& e) {
+                LOG(LOG_ERR, "Could not read changelog_record_types array from %s\n", filename.c_str());
+                return lustre_irods::CONFIGURATION_ERROR;
+            }
+        }
+
         // populate config variables
 
         if (0 == read_key_from_map(config_map, "log_level", log_level_str)) {
@@ -286,6 +364,20 @@ int read_config_file(const std::string& filename, lustre_irods_connector_cfg_t *
             return lustre_irods::CONFIGURATION_ERROR;
         }
 
+        // optional tuning parameters
+        if (0 != read_optional_unsigned_int_from_map(config_map, "changelog_record_queue_size", config_struct->changelog_record_queue_size, 8192) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "directory_path_cache_size", config_struct->directory_path_cache_size, 4096) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "register_map_fid_filter_size", config_struct->register_map_fid_filter_size, 65536) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "changelog_poll_min_interval_msec", config_struct->changelog_poll_min_interval_msec, 10) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "changelog_read_batch_size", config_struct->changelog_read_batch_size, 256) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "changelog_clear_record_watermark", config_struct->changelog_clear_record_watermark, 1000) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "changelog_clear_interval_seconds", config_struct->changelog_clear_interval_seconds, 10) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "irods_connection_health_check_seconds", config_struct->irods_connection_health_check_seconds, 60) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "irods_updater_pipeline_depth", config_struct->irods_updater_pipeline_depth, 1) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "change_table_partition_count", config_struct->change_table_partition_count, 1) ||
+                0 != read_optional_unsigned_int_from_map(config_map, "fidstr_object_cache_size", config_struct->fidstr_object_cache_size, 100000)) {
+            return lustre_irods::CONFIGURATION_ERROR;
+        }
 
         // read individual thread connection parameters
         boost::format format_object("thread_%i_connection_parameters");
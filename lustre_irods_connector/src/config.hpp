@@ -3,6 +3,9 @@
 
 #include <map>
 #include <string>
+#include <vector>
+
+#include "register_map.hpp"
 
 const int MAX_CONFIG_VALUE_SIZE = 256;
 
@@ -11,15 +14,21 @@ typedef struct irods_connection_cfg {
     int irods_port;
 } irods_connection_cfg_t;
 
-typedef struct lustre_irods_connector_cfg {
+// An MDT whose changelog is read by this connector.
+typedef struct mdt_cfg {
     std::string mdtname;
     std::string changelog_reader;
+} mdt_cfg_t;
+
+typedef struct lustre_irods_connector_cfg {
+    std::vector<mdt_cfg_t> mdt_list;      // each MDT has its own changelog reader thread and change table
     std::string lustre_root_path;
     //std::string irods_register_path;
     std::string irods_resource_name;
     std::string irods_api_update_type;    // valid values are "direct" and "policy"
     int64_t irods_resource_id;
     unsigned int changelog_poll_interval_seconds;
+    unsigned int changelog_poll_min_interval_msec;
     unsigned int irods_client_connect_failure_retry_seconds;
     std::string irods_client_broadcast_address;
     std::string changelog_reader_broadcast_address;
@@ -30,17 +39,39 @@ typedef struct lustre_irods_connector_cfg {
     unsigned int maximum_records_per_update_to_irods;
     unsigned int maximum_records_to_receive_from_lustre_changelog;
     unsigned int message_receive_timeout_msec;
+    unsigned int changelog_record_queue_size;   // capacity of the queue between the changelog reader and the change table
+    unsigned int directory_path_cache_size;     // number of directory fid to path entries cached by the changelog reader
+    unsigned int register_map_fid_filter_size;  // number of directory fids remembered as inside or outside of the register map
+    unsigned int changelog_read_batch_size;     // number of changelog records received from llapi before decoding them
+    unsigned int changelog_clear_record_watermark;  // clear the changelog after this many records...
+    unsigned int changelog_clear_interval_seconds;  // ...or after this many seconds, whichever comes first
+    unsigned int irods_connection_health_check_seconds;  // check an idle irods connection before reusing it
+    unsigned int irods_updater_pipeline_depth;  // number of batches each updater keeps outstanding on its connection
+    unsigned int change_table_partition_count;  // number of independently locked partitions the change table is split into
+    unsigned int fidstr_object_cache_size;      // number of fidstr to catalog object entries cached by each iRODS agent
 
     // optional parameters for using storage tiering time violation
     bool set_metadata_for_storage_tiering_time_violation;
     std::string metadata_key_for_storage_tiering_time_violation;
 
+    // apply each batch in a single catalog transaction when irods_api_update_type is direct
+    bool single_transaction_per_batch;
+
 
     std::map<int, irods_connection_cfg_t> irods_connection_list;
 
     // map the lustre path to irods path
     std::vector<std::pair<std::string, std::string> > register_map;
 
+    // register_map compiled for matching lustre paths
+    register_map_trie register_map_lookup;
+
+    // names of the changelog record types to consume (as shown by lfs changelog), empty for the default set
+    std::vector<std::string> changelog_record_types;
+
+    // changelog_record_types as a mask of 1 << record type.  Filled in by build_changelog_record_type_mask.
+    unsigned long long changelog_record_type_mask;
+
 } lustre_irods_connector_cfg_t;
 
 
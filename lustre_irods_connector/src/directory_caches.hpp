@@ -0,0 +1,103 @@
+#ifndef DIRECTORY_CACHES_HPP
+#define DIRECTORY_CACHES_HPP
+
+#include <stdio.h>
+#include <mutex>
+#include <string>
+
+#include "lustre_fid.hpp"
+#include "register_map.hpp"
+#include "fid_path_cache.hpp"
+#include "register_map_fid_filter.hpp"
+#include "logging.hpp"
+
+// The directory path cache and the register map fid filter shared by the changelog readers of
+// every MDT.  With DNE a directory can be renamed by a record on one MDT while the records for
+// the files under it are on another, so a RENAME or RMDIR read by any reader has to invalidate
+// what all of the readers have cached.
+//
+// A reader that misses the cache resolves the path with fid2path without holding the lock.  If
+// a rename or rmdir was seen in the meantime the result may already be stale, so it is only
+// cached when the generation has not changed since the reader started resolving it.
+class directory_caches {
+ public:
+   directory_caches(size_t path_cache_size, size_t fid_filter_size)
+       : dir_path_cache(path_cache_size)
+       , parent_filter(fid_filter_size)
+       , generation(0) {}
+
+   // Returns the generation to pass to insert_path and insert_parent_match for the lookups that follow.
+   unsigned long long current_generation() {
+       std::lock_guard<std::mutex> lock(mutex);
+       return generation;
+   }
+
+   bool lookup_path(const fid_key& fid, std::string& path) {
+       std::lock_guard<std::mutex> lock(mutex);
+       return dir_path_cache.lookup(fid, path);
+   }
+
+   void insert_path(const fid_key& fid, const std::string& path, unsigned long long seen_generation) {
+       std::lock_guard<std::mutex> lock(mutex);
+       if (seen_generation == generation) {
+           dir_path_cache.insert(fid, path);
+       }
+   }
+
+   bool lookup_parent_match(const fid_key& fid, register_map_match_t& match) {
+       std::lock_guard<std::mutex> lock(mutex);
+       return parent_filter.lookup(fid, match);
+   }
+
+   void insert_parent_match(const fid_key& fid, register_map_match_t match, unsigned long long seen_generation) {
+       std::lock_guard<std::mutex> lock(mutex);
+       if (seen_generation == generation) {
+           parent_filter.insert(fid, match);
+       }
+   }
+
+   void record_skipped() {
+       std::lock_guard<std::mutex> lock(mutex);
+       parent_filter.record_skipped();
+   }
+
+   // A directory was renamed from old_path.  Any cached paths at or below it are stale and so is
+   // what is known about the directories under it unless clear_filter is false because it stayed
+   // entirely inside or entirely outside of the registered trees.
+   void invalidate_rename(const fid_key& fid, const fid_key& overwritten_fid, const std::string& old_path, bool clear_filter) {
+       std::lock_guard<std::mutex> lock(mutex);
+       ++generation;
+       dir_path_cache.erase(fid);
+       dir_path_cache.erase(overwritten_fid);
+       dir_path_cache.erase_path_and_descendants(old_path);
+       if (clear_filter) {
+           parent_filter.clear();
+       } else {
+           parent_filter.erase(fid);
+           parent_filter.erase(overwritten_fid);
+       }
+   }
+
+   void invalidate_rmdir(const fid_key& fid) {
+       std::lock_guard<std::mutex> lock(mutex);
+       ++generation;
+       dir_path_cache.erase(fid);
+       parent_filter.erase(fid);
+   }
+
+   void log_counts() {
+       std::lock_guard<std::mutex> lock(mutex);
+       LOG(LOG_DBG, "directory path cache [size=%zu][hits=%llu][misses=%llu]\n", dir_path_cache.size(),
+               dir_path_cache.hit_count(), dir_path_cache.miss_count());
+       LOG(LOG_DBG, "register map fid filter [size=%zu][hits=%llu][misses=%llu][skipped=%llu]\n", parent_filter.size(),
+               parent_filter.hit_count(), parent_filter.miss_count(), parent_filter.skipped_count());
+   }
+
+ private:
+   std::mutex mutex;
+   fid_path_cache dir_path_cache;
+   register_map_fid_filter parent_filter;
+   unsigned long long generation;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef FID_PATH_CACHE_HPP
+#define FID_PATH_CACHE_HPP
+
+#include <string>
+
+#include "lustre_fid.hpp"
+#include "lru_cache.hpp"
+
+// LRU cache of directory fid -> full lustre path.  This does no locking.  The changelog readers
+// share one through directory_caches which does.
+class fid_path_cache : public lru_cache<fid_key, std::string, fid_key_hash> {
+ public:
+   explicit fid_path_cache(size_t max_entries) : lru_cache(max_entries) {}
+
+   // Removes the directory at path and every cached directory underneath it.  Used when a
+   // directory is renamed since all of the descendant paths are now stale.
+   void erase_path_and_descendants(const std::string& path) {
+       erase_if([&path](const fid_key&, const std::string& p) {
+           return 0 == p.compare(0, path.length(), path) && (p.length() == path.length() || '/' == p[path.length()]);
+       });
+   }
+};
+
+#endif
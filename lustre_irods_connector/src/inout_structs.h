@@ -7,10 +7,14 @@ typedef struct {
 } irodsLustreApiInp_t;
 #define IrodsLustreApiInp_PI "int buflen; bin *buf(buflen);"
 
+// failed_entries holds the positions in the change map entries list of the entries that could
+// not be applied and should be retried
 typedef struct {
     int status;
+    int failed_entry_count;
+    int *failed_entries;
 } irodsLustreApiOut_t;
-#define IrodsLustreApiOut_PI "int status;"
+#define IrodsLustreApiOut_PI "int status; int failed_entry_count; int *failed_entries(failed_entry_count);"
 
 #endif
 
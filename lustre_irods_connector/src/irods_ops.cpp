@@ -1,5 +1,6 @@
 // irods includes
 #include "rodsClient.h"
+#include "procApiRequest.h"
 #include "parseCommandLine.h"
 #include "rodsPath.h"
 #include "regUtil.h"
@@ -22,10 +23,29 @@
 
 // other includes
 #include <string>
+#include <mutex>
+#include <vector>
 #include <stdio.h>
 #include <boost/filesystem.hpp>
 
+// The client api and pack tables only need to be loaded once per process.  This is done when
+// the first connection is made so that sending a change map is just the procApiRequest.
+static std::once_flag api_table_init_flag;
+
+static void init_client_api_table() {
+    std::call_once(api_table_init_flag, []() {
+        irods::pack_entry_table& pk_tbl = irods::get_pack_table();
+        irods::api_entry_table& api_tbl = irods::get_client_api_table();
+        init_api_table( api_tbl, pk_tbl );
+    });
+}
+
 lustre_irods_connection::~lustre_irods_connection() {
+    disconnect();
+}
+
+void lustre_irods_connection::disconnect() {
+    pending_request_count = 0;
     if (irods_conn) {
         LOG(LOG_DBG, "disconnecting irods - thread %u\n", thread_number);
         rcDisconnect(irods_conn);
@@ -34,38 +54,117 @@ lustre_irods_connection::~lustre_irods_connection() {
     irods_conn = nullptr;    
 }
 
-int lustre_irods_connection::send_change_map_to_irods(irodsLustreApiInp_t *inp) const {
+void lustre_irods_connection::log_connection_stats() const {
+    LOG(LOG_INFO, "irods connection stats - thread %u: connects=%lu connect_failures=%lu health_check_failures=%lu "
+            "last_handshake_usec=%llu avg_handshake_usec=%llu\n", thread_number, connect_count, connect_failure_count,
+            health_check_failure_count, last_handshake_usec, 0 == connect_count ? 0 : total_handshake_usec / connect_count);
+}
 
+// Makes sure there is a usable connection, connecting if there is none.  A connection that has been
+// idle for longer than irods_connection_health_check_seconds is checked with a cheap server info
+// request first and replaced if the check fails.
+int lustre_irods_connection::ensure_irods_connection(const lustre_irods_connector_cfg_t *config_struct_ptr, int thread_number) {
+
+    if (irods_conn && nullptr != config_struct_ptr) {
+        auto idle_time = std::chrono::steady_clock::now() - last_used;
+        if (idle_time >= std::chrono::seconds(config_struct_ptr->irods_connection_health_check_seconds)) {
+            miscSvrInfo_t *server_info = nullptr;
+            int status = rcGetMiscSvrInfo(irods_conn, &server_info);
+            free(server_info);
+            if (status < 0) {
+                LOG(LOG_INFO, "irods connection for thread %d failed health check - %i.  reconnecting.\n", thread_number, status);
+                ++health_check_failure_count;
+                disconnect();
+            } else {
+                last_used = std::chrono::steady_clock::now();
+            }
+        }
+    }
+
+    if (irods_conn) {
+        return 0;
+    }
+
+    return instantiate_irods_connection(config_struct_ptr, thread_number);
+}
+
+// Sends the change map to iRODS and waits for the result.  On success failed_entries is set to the
+// positions of any entries that iRODS could not apply.
+int lustre_irods_connection::send_change_map_to_irods(irodsLustreApiInp_t *inp, std::vector<int>& failed_entries) {
 
     LOG(LOG_DBG,"calling send_change_map_to_irods\n");
 
+    int status = submit_change_map_to_irods(inp);
+    if (0 != status) {
+        return status;
+    }
+
+    return receive_change_map_result(failed_entries);
+}
+
+// Writes the change map request to the connection without waiting for the reply.  The iRODS agent
+// handles requests on a connection one at a time in order, so several requests can be written
+// before the replies are read back with receive_change_map_result.  The agent starts on the next
+// request as soon as it has replied to the previous one instead of waiting a round trip for it.
+int lustre_irods_connection::submit_change_map_to_irods(irodsLustreApiInp_t *inp) {
+
     if (nullptr == inp) {
         LOG(LOG_ERR, "Null inp sent to %s - %d\n", __FUNCTION__, __LINE__);
         return lustre_irods::INVALID_OPERAND_ERROR;
     }    
 
-
     if (!irods_conn) {
-        LOG(LOG_ERR,"Error:  Called send_change_map_to_irods() without an active irods_conn\n");
+        LOG(LOG_ERR,"Error:  Called submit_change_map_to_irods() without an active irods_conn\n");
         return lustre_irods::IRODS_CONNECTION_ERROR;
     }
 
-    irods::pack_entry_table& pk_tbl = irods::get_pack_table();
-    irods::api_entry_table& api_tbl = irods::get_client_api_table();
-    init_api_table( api_tbl, pk_tbl );
+    int api_index = apiTableLookup(15001);
+    if (api_index < 0) {
+        LOG(LOG_ERR, "\nERROR - api 15001 not found in the client api table - %i\n", api_index);
+        return lustre_irods::IRODS_ERROR;
+    }
+
+    int status = sendApiRequest(irods_conn, api_index, inp, NULL);
+    if ( status < 0 ) {
+        LOG(LOG_ERR, "\nERROR - failed to call our api - %i\n", status);
+        return lustre_irods::IRODS_ERROR;
+    }
+
+    irods_conn->apiInx = api_index;
+    ++pending_request_count;
+    return 0;
+}
+
+// Reads the reply to the oldest request written by submit_change_map_to_irods.
+int lustre_irods_connection::receive_change_map_result(std::vector<int>& failed_entries) {
+
+    if (!irods_conn || 0 == pending_request_count) {
+        LOG(LOG_ERR,"Error:  Called receive_change_map_result() without an outstanding request\n");
+        return lustre_irods::IRODS_CONNECTION_ERROR;
+    }
+
+    --pending_request_count;
 
     void *tmp_out = nullptr;
-    int status = procApiRequest( irods_conn, 15001, inp, NULL,
-                             &tmp_out, NULL );
+    int status = readAndProcApiReply(irods_conn, irods_conn->apiInx, &tmp_out, NULL);
 
     int returnVal;
 
     if ( status < 0 ) {
         LOG(LOG_ERR, "\nERROR - failed to call our api - %i\n", status);
         returnVal = lustre_irods::IRODS_ERROR;
+    } else if ( nullptr == tmp_out ) {
+        // a request forwarded to the catalog provider can come back without a result
+        LOG(LOG_ERR, "\nERROR - our api returned %i without a result\n", status);
+        returnVal = lustre_irods::IRODS_ERROR;
     } else {
+        last_used = std::chrono::steady_clock::now();
         irodsLustreApiOut_t* out = static_cast<irodsLustreApiOut_t*>( tmp_out );
         returnVal = out->status;
+        if (nullptr != out->failed_entries) {
+            failed_entries.assign(out->failed_entries, out->failed_entries + out->failed_entry_count);
+            free(out->failed_entries);
+        }
     }
 
     free(tmp_out);
@@ -135,6 +234,9 @@ int lustre_irods_connection::populate_irods_resc_id(lustre_irods_connector_cfg_t
 // Otherwise use the irods environment for everything.
 int lustre_irods_connection::instantiate_irods_connection(const lustre_irods_connector_cfg_t *config_struct_ptr, int thread_number) {
 
+    disconnect();
+    init_client_api_table();
+
     rodsEnv myEnv;
     int status;
     rErrMsg_t errMsg;
@@ -160,11 +262,14 @@ int lustre_irods_connection::instantiate_irods_connection(const lustre_irods_con
         irods_port = myEnv.rodsPort;
     }
 
+    auto handshake_start = std::chrono::steady_clock::now();
+
     LOG(LOG_DBG, "rcConnect being called for thread %d.\n", thread_number);
     irods_conn = rcConnect( irods_host.c_str(), irods_port, myEnv.rodsUserName, myEnv.rodsZone, 1, &errMsg );
     LOG(LOG_DBG, "irods_conn is %i for thread %d.\n", irods_conn != nullptr, thread_number);
 
     if (nullptr == irods_conn) {
+        ++connect_failure_count;
         return lustre_irods::IRODS_CONNECTION_ERROR;
     }
 
@@ -172,10 +277,18 @@ int lustre_irods_connection::instantiate_irods_connection(const lustre_irods_con
     if (0 != status) {
         rcDisconnect(irods_conn);
         irods_conn = nullptr;
+        ++connect_failure_count;
         LOG(LOG_ERR, "Error on clientLogin() - %i\n", status);
         return lustre_irods::IRODS_ERROR;
     }
 
+    last_used = std::chrono::steady_clock::now();
+    last_handshake_usec = std::chrono::duration_cast<std::chrono::microseconds>(last_used - handshake_start).count();
+    total_handshake_usec += last_handshake_usec;
+    ++connect_count;
+
+    log_connection_stats();
+
     return 0;
 }
 
@@ -6,16 +6,40 @@
 #include "config.hpp"
 #include "rodsClient.h"
 
+#include <vector>
+#include <chrono>
+
 class lustre_irods_connection {
  public:
    unsigned int thread_number;
    rcComm_t *irods_conn;
+
+   // connection statistics
+   unsigned long connect_count;
+   unsigned long connect_failure_count;
+   unsigned long health_check_failure_count;
+   unsigned long long last_handshake_usec;
+   unsigned long long total_handshake_usec;
+
+   // requests written with submit_change_map_to_irods whose replies have not been read
+   unsigned int pending_request_count;
+
    //lustre_irods_connection() : irods_conn(nullptr) {}
-   explicit lustre_irods_connection(unsigned int tnum) : thread_number(tnum), irods_conn(nullptr) {}
+   explicit lustre_irods_connection(unsigned int tnum) : thread_number(tnum), irods_conn(nullptr), connect_count(0),
+       connect_failure_count(0), health_check_failure_count(0), last_handshake_usec(0), total_handshake_usec(0),
+       pending_request_count(0), last_used(std::chrono::steady_clock::now()) {}
    ~lustre_irods_connection(); 
-   int send_change_map_to_irods(irodsLustreApiInp_t *inp) const;
+   int send_change_map_to_irods(irodsLustreApiInp_t *inp, std::vector<int>& failed_entries);
+   int submit_change_map_to_irods(irodsLustreApiInp_t *inp);
+   int receive_change_map_result(std::vector<int>& failed_entries);
    int populate_irods_resc_id(lustre_irods_connector_cfg_t *config_struct_ptr);
    int instantiate_irods_connection(const lustre_irods_connector_cfg_t *config_struct_ptr, int thread_number);
+   int ensure_irods_connection(const lustre_irods_connector_cfg_t *config_struct_ptr, int thread_number);
+   void disconnect();
+   void log_connection_stats() const;
+
+ private:
+   std::chrono::steady_clock::time_point last_used;
 };
 
 #endif
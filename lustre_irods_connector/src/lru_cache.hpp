@@ -0,0 +1,95 @@
+#ifndef LRU_CACHE_HPP
+#define LRU_CACHE_HPP
+
+#include <list>
+#include <utility>
+#include <functional>
+#include <unordered_map>
+
+// Least recently used cache of Key -> Value holding at most max_entries entries.  A capacity of 0
+// disables the cache.  This does no locking so each cache must be used by one thread.
+template <typename Key, typename Value, typename Hash = std::hash<Key> >
+class lru_cache {
+ public:
+   explicit lru_cache(size_t max_entries) : capacity(max_entries), hits(0), misses(0) {}
+
+   // Returns true and sets value if key is in the cache.
+   bool lookup(const Key& key, Value& value) {
+       auto iter = index.find(key);
+       if (index.end() == iter) {
+           ++misses;
+           return false;
+       }
+       ++hits;
+       lru_list.splice(lru_list.begin(), lru_list, iter->second);
+       value = iter->second->second;
+       return true;
+   }
+
+   void insert(const Key& key, const Value& value) {
+       if (0 == capacity) {
+           return;
+       }
+       auto iter = index.find(key);
+       if (index.end() != iter) {
+           iter->second->second = value;
+           lru_list.splice(lru_list.begin(), lru_list, iter->second);
+           return;
+       }
+       if (index.size() >= capacity) {
+           index.erase(lru_list.back().first);
+           lru_list.pop_back();
+       }
+       lru_list.emplace_front(key, value);
+       index[key] = lru_list.begin();
+   }
+
+   void erase(const Key& key) {
+       auto iter = index.find(key);
+       if (index.end() != iter) {
+           lru_list.erase(iter->second);
+           index.erase(iter);
+       }
+   }
+
+   // Removes every entry for which pred(key, value) is true.
+   template <typename Predicate>
+   void erase_if(Predicate pred) {
+       for (auto iter = lru_list.begin(); iter != lru_list.end();) {
+           if (pred(iter->first, iter->second)) {
+               index.erase(iter->first);
+               iter = lru_list.erase(iter);
+           } else {
+               ++iter;
+           }
+       }
+   }
+
+   void clear() {
+       index.clear();
+       lru_list.clear();
+   }
+
+   void set_capacity(size_t max_entries) {
+       capacity = max_entries;
+       while (index.size() > capacity) {
+           index.erase(lru_list.back().first);
+           lru_list.pop_back();
+       }
+   }
+
+   size_t size() const { return index.size(); }
+   unsigned long long hit_count() const { return hits; }
+   unsigned long long miss_count() const { return misses; }
+
+ private:
+   typedef std::list<std::pair<Key, Value> > lru_list_t;
+
+   size_t capacity;
+   unsigned long long hits;
+   unsigned long long misses;
+   lru_list_t lru_list;
+   std::unordered_map<Key, typename lru_list_t::iterator, Hash> index;
+};
+
+#endif
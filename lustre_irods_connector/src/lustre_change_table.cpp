@@ -1,12 +1,15 @@
 #include <string>
 #include <set>
+#include <algorithm>
 #include <ctime>
 #include <sstream>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <string.h>
 
 
 // boost headers
@@ -20,6 +23,7 @@
 #include "logging.hpp"
 #include "config.hpp"
 #include "lustre_irods_errors.hpp"
+#include "batch_ack.hpp"
 
 // capnproto
 #include "change_table.capnp.h"
@@ -29,36 +33,378 @@
 // sqlite
 #include <sqlite3.h>
 
-std::string event_type_to_str(ChangeDescriptor::EventTypeEnum type);
-std::string object_type_to_str(ChangeDescriptor::ObjectTypeEnum type);
-
 
 //using namespace boost::interprocess;
 
-//static boost::shared_mutex change_table_mutex;
-static std::mutex change_table_mutex;
+// Bounds the scan for a batch to this many blocked entries per entry that can go in the batch
+// so a large backlog under one busy directory does not hold the partition lock for long.
+static const size_t MAXIMUM_SKIPPED_ENTRIES_PER_BATCH_ENTRY = 8;
+
+// An entry iRODS fails to apply is retried after a delay that doubles with each attempt up to the
+// maximum.  After MAXIMUM_ENTRY_ATTEMPTS failures it is logged and dropped.
+static const unsigned int MAXIMUM_ENTRY_ATTEMPTS = 10;
+static const time_t RETRY_BACKOFF_INITIAL_SECONDS = 1;
+static const time_t RETRY_BACKOFF_MAXIMUM_SECONDS = 300;
+
+// Lock ordering:  partition locks are taken in partition order, then the active fid set mutex or
+// the journal mutex.  The only thread that holds more than one partition lock at a time is the change
+// table owner, and the dispatcher only ever try_locks a second partition.
+
+size_t get_change_table_size(change_table_t& change_table) {
+    size_t size = 0;
+    for (auto& partition : change_table.partitions) {
+        std::lock_guard<std::mutex> lock(partition->mutex);
+        size += partition->change_map.size();
+    }
+    return size;
+}
 
-size_t get_change_table_size(change_map_t& change_map) {
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-    return change_map.size();
+// Takes every partition lock in order.
+static std::vector<std::unique_lock<std::mutex> > lock_all_partitions(change_table_t& change_table) {
+    std::vector<std::unique_lock<std::mutex> > locks;
+    locks.reserve(change_table.partition_count());
+    for (auto& partition : change_table.partitions) {
+        locks.emplace_back(partition->mutex);
+    }
+    return locks;
 }
     
 
-int lustre_write_fidstr_to_root_dir(const std::string& lustre_root_path, const std::string& fidstr, change_map_t& change_map) {
+// The change map journal.  Each batch of changes to the change table is mirrored into the
+// change_map table of the serialization database in a single transaction (WAL mode,
+// synchronous=NORMAL) so that the table survives a crash rather than only a clean shutdown.
+// Rows are keyed on (fidstr, cr_index) so that a newer change to a fid does not overwrite the row
+// of an entry for the same fid that is in flight.  A fid has at most two rows, one for its entry
+// in the table and one for its entry in flight, and rows stay in the journal until iRODS has
+// acknowledged them.  On startup the rows for a fid are merged.  The statements are only
+// used while holding the journal mutex.  Each MDT's change table has its own journal in the
+// database named for the MDT.
+
+static const char *upsert_change_map_sql = "insert or replace into change_map (fidstr, parent_fidstr, object_name, lustre_path, last_event, "
+                                           "timestamp, oper_complete, object_type, file_size, cr_index) values (?1, ?2, ?3, ?4, "
+                                           "?5, ?6, ?7, ?8, ?9, ?10);";
+
+static int bind_change_descriptor(sqlite3_stmt *stmt, const change_descriptor& entry) {
+    sqlite3_bind_text(stmt, 1, fid_to_fidstr(entry.fid).c_str(), -1, SQLITE_TRANSIENT); 
+    sqlite3_bind_text(stmt, 2, fid_to_fidstr(entry.parent_fid).c_str(), -1, SQLITE_TRANSIENT); 
+    sqlite3_bind_text(stmt, 3, entry.object_name.c_str(), -1, SQLITE_STATIC); 
+    sqlite3_bind_text(stmt, 4, entry.lustre_path.c_str(), -1, SQLITE_STATIC); 
+    sqlite3_bind_text(stmt, 5, event_type_to_str(entry.last_event).c_str(), -1, SQLITE_TRANSIENT); 
+    sqlite3_bind_int64(stmt, 6, entry.timestamp); 
+    sqlite3_bind_int(stmt, 7, entry.oper_complete ? 1 : 0);
+    sqlite3_bind_text(stmt, 8, object_type_to_str(entry.object_type).c_str(), -1, SQLITE_TRANSIENT); 
+    sqlite3_bind_int64(stmt, 9, entry.file_size); 
+    return sqlite3_bind_int64(stmt, 10, entry.cr_index); 
+}
+
+static int step_and_reset(sqlite3 *db, sqlite3_stmt *stmt) {
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (SQLITE_DONE != rc) {
+        LOG(LOG_ERR, "ERROR writing to change_map journal: %s\n", sqlite3_errmsg(db));
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+    return lustre_irods::SUCCESS;
+}
+
+int open_change_map_journal(change_table_t& change_table, const std::string& db_file) {
+
+    change_map_journal& journal = change_table.journal;
+    std::lock_guard<std::mutex> lock(journal.mutex);
+
+    std::string serialize_file = db_file + ".db";
+
+    if (sqlite3_open(serialize_file.c_str(), &journal.db)) {
+        LOG(LOG_ERR, "Can't open %s for the change_map journal.\n", serialize_file.c_str());
+        sqlite3_close(journal.db);
+        journal.db = nullptr;
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    char *zErrMsg = 0;
+    if (sqlite3_exec(journal.db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, &zErrMsg)) {
+        LOG(LOG_ERR, "Error setting journal mode on %s: %s\n", serialize_file.c_str(), zErrMsg);
+        sqlite3_free(zErrMsg);
+        sqlite3_close(journal.db);
+        journal.db = nullptr;
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    if (SQLITE_OK != sqlite3_prepare_v2(journal.db, upsert_change_map_sql, -1, &journal.upsert_stmt, NULL) ||
+            SQLITE_OK != sqlite3_prepare_v2(journal.db, "delete from change_map where fidstr = ?1 and cr_index != ?2 and cr_index != ?3;", -1,
+                &journal.delete_superseded_stmt, NULL) ||
+            SQLITE_OK != sqlite3_prepare_v2(journal.db, "delete from change_map where fidstr = ?1 and cr_index = ?2;", -1, &journal.delete_acked_stmt, NULL) ||
+            SQLITE_OK != sqlite3_prepare_v2(journal.db, "insert or ignore into last_cr_index (cr_index) values (?1);", -1, &journal.cr_index_stmt, NULL) ||
+            SQLITE_OK != sqlite3_prepare_v2(journal.db, "delete from last_cr_index where cr_index < ?1;", -1, &journal.trim_cr_index_stmt, NULL)) {
+        LOG(LOG_ERR, "Error preparing change_map journal statements: %s\n", sqlite3_errmsg(journal.db));
+        sqlite3_finalize(journal.upsert_stmt);
+        sqlite3_finalize(journal.delete_superseded_stmt);
+        sqlite3_finalize(journal.delete_acked_stmt);
+        sqlite3_finalize(journal.cr_index_stmt);
+        sqlite3_finalize(journal.trim_cr_index_stmt);
+        journal.upsert_stmt = journal.delete_superseded_stmt = journal.delete_acked_stmt = journal.cr_index_stmt = journal.trim_cr_index_stmt = nullptr;
+        sqlite3_close(journal.db);
+        journal.db = nullptr;
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    return lustre_irods::SUCCESS;
+}
+
+void close_change_map_journal(change_table_t& change_table) {
+
+    change_map_journal& journal = change_table.journal;
+    std::lock_guard<std::mutex> lock(journal.mutex);
+
+    if (nullptr == journal.db) {
+        return;
+    }
+
+    sqlite3_finalize(journal.upsert_stmt);
+    sqlite3_finalize(journal.delete_superseded_stmt);
+    sqlite3_finalize(journal.delete_acked_stmt);
+    sqlite3_finalize(journal.cr_index_stmt);
+    sqlite3_finalize(journal.trim_cr_index_stmt);
+    journal.upsert_stmt = journal.delete_superseded_stmt = journal.delete_acked_stmt = journal.cr_index_stmt = journal.trim_cr_index_stmt = nullptr;
+
+    // fold the WAL back into the database file
+    sqlite3_wal_checkpoint_v2(journal.db, NULL, SQLITE_CHECKPOINT_TRUNCATE, NULL, NULL);
+    sqlite3_close(journal.db);
+    journal.db = nullptr;
+}
+
+unsigned long long get_journaled_cr_index(change_table_t& change_table) {
+    return change_table.journal.journaled_cr_index.load();
+}
+
+// A row to write to the journal.  Any other rows for the fid are deleted unless they belong to
+// the entry in flight.  If the fid is no longer in the table remove is set and no row is written.
+// A cr_index of 0 means there is no such entry.
+struct journal_row {
+    fid_key fid;
+    bool remove;
+    change_descriptor entry;
+    unsigned long long inflight_cr_index;
+};
+
+// Deletes the rows of acknowledged entries from the journal.
+// Precondition:  journal.mutex is held and a transaction is open.
+static int delete_acked_rows(change_map_journal& journal, const std::vector<std::pair<fid_key, unsigned long long> >& acked_entries) {
+    for (auto& acked : acked_entries) {
+        sqlite3_bind_text(journal.delete_acked_stmt, 1, fid_to_fidstr(acked.first).c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(journal.delete_acked_stmt, 2, acked.second);
+        int rc = step_and_reset(journal.db, journal.delete_acked_stmt);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return lustre_irods::SUCCESS;
+}
+
+// Writes rows to the journal along with the cr_index watermark in one transaction.  Rows of
+// acknowledged entries that could not be deleted earlier are deleted as well.
+// Precondition:  journal.mutex is held.
+static int journal_change_batch(change_map_journal& journal, const std::vector<journal_row>& rows, unsigned long long max_cr_index) {
+
+    if (nullptr == journal.db) {
+        return lustre_irods::SUCCESS;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(journal.db, "begin transaction", NULL, NULL, NULL)) {
+        LOG(LOG_ERR, "ERROR starting change_map journal transaction: %s\n", sqlite3_errmsg(journal.db));
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    int rc = lustre_irods::SUCCESS;
+
+    for (auto& row : rows) {
+        if (!row.remove) {
+            bind_change_descriptor(journal.upsert_stmt, row.entry);
+            rc = step_and_reset(journal.db, journal.upsert_stmt);
+        }
+        if (lustre_irods::SUCCESS == rc) {
+            sqlite3_bind_text(journal.delete_superseded_stmt, 1, fid_to_fidstr(row.fid).c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(journal.delete_superseded_stmt, 2, row.remove ? 0 : row.entry.cr_index);
+            sqlite3_bind_int64(journal.delete_superseded_stmt, 3, row.inflight_cr_index);
+            rc = step_and_reset(journal.db, journal.delete_superseded_stmt);
+        }
+        if (rc < 0) {
+            break;
+        }
+    }
+
+    if (lustre_irods::SUCCESS == rc) {
+        rc = delete_acked_rows(journal, journal.undeleted_acks);
+    }
+
+    if (lustre_irods::SUCCESS == rc && max_cr_index > 0) {
+        sqlite3_bind_int64(journal.cr_index_stmt, 1, max_cr_index);
+        rc = step_and_reset(journal.db, journal.cr_index_stmt);
+        if (lustre_irods::SUCCESS == rc) {
+            sqlite3_bind_int64(journal.trim_cr_index_stmt, 1, max_cr_index);
+            rc = step_and_reset(journal.db, journal.trim_cr_index_stmt);
+        }
+    }
+
+    if (lustre_irods::SUCCESS == rc && SQLITE_OK != sqlite3_exec(journal.db, "commit", NULL, NULL, NULL)) {
+        LOG(LOG_ERR, "ERROR committing change_map journal transaction: %s\n", sqlite3_errmsg(journal.db));
+        rc = lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    if (lustre_irods::SUCCESS != rc) {
+        sqlite3_exec(journal.db, "rollback", NULL, NULL, NULL);
+    } else {
+        journal.undeleted_acks.clear();
+    }
+
+    return rc;
+}
+
+// Rewrites the paths of the entries under a renamed directory and adds them to touched_fids.
+// Precondition:  the partition lock is held.
+static void rename_descendant_paths(change_map_t& change_map, const std::string& old_lustre_path, const std::string& lustre_path,
+        std::vector<fid_key>& touched_fids) {
+
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
+    std::string old_dir_prefix = old_lustre_path + "/";
+
+    for (auto iter = change_map_fid.begin(); iter != change_map_fid.end(); ++iter) {
+        if (boost::starts_with(iter->lustre_path, old_dir_prefix)) {
+            change_map_fid.modify(iter, [&old_lustre_path, &lustre_path](change_descriptor &cd){ cd.lustre_path.replace(0, old_lustre_path.length(), lustre_path); });
+            touched_fids.push_back(iter->fid);
+        }
+    }
+}
+
+int apply_change_records(const std::string& lustre_root_path, std::vector<change_record>& records, change_table_t& change_table) {
+
+    // records land in any partition so take them all once for the whole batch
+    std::vector<std::unique_lock<std::mutex> > partition_locks = lock_all_partitions(change_table);
+
+    // fids whose entries were changed by this batch - these are written to the journal.  This
+    // starts with the fids of any earlier batch whose journal write failed so they are written
+    // again from the current state of the table.
+    std::vector<fid_key> touched_fids;
+    {
+        std::lock_guard<std::mutex> journal_lock(change_table.journal.mutex);
+        touched_fids.swap(change_table.journal.unjournaled_fids);
+    }
+    touched_fids.reserve(touched_fids.size() + records.size());
+    unsigned long long max_cr_index = 0;
+
+    for (auto& record : records) {
+
+        if (record.cr_index > max_cr_index) {
+            max_cr_index = record.cr_index;
+        }
+
+        change_map_t& change_map = change_table.partitions[change_table.partition_for(record.fid)]->change_map;
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
+        int rc;
+        if (record.is_rename) {
+
+            // remove any entry for the file that was overwritten by the rename
+            if (!fid_is_zero(record.overwritten_fid)) {
+                change_table.partitions[change_table.partition_for(record.overwritten_fid)]->change_map.
+                    get<change_descriptor_fid_idx>().erase(record.overwritten_fid);
+                touched_fids.push_back(record.overwritten_fid);
+            }
+
+            // lustre_rename rewrites the paths under a renamed directory in its own partition
+            rc = lustre_rename(record.cr_index, lustre_root_path, record.fid, record.parent_fid, record.object_name,
+                    record.lustre_path, record.old_lustre_path, change_map);
+            touched_fids.push_back(record.fid);
+
+            // renaming a directory rewrites the paths of all entries underneath it
+            auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
+            auto iter = change_map_fid.find(record.fid);
+            if (change_map_fid.end() != iter && ChangeDescriptor::ObjectTypeEnum::DIR == iter->object_type) {
+                std::string dir_prefix = record.lustre_path + "/";
+                for (auto& entry : change_map_fid) {
+                    if (boost::starts_with(entry.lustre_path, dir_prefix)) {
+                        touched_fids.push_back(entry.fid);
+                    }
+                }
+                for (auto& partition : change_table.partitions) {
+                    if (&partition->change_map != &change_map) {
+                        rename_descendant_paths(partition->change_map, record.old_lustre_path, record.lustre_path, touched_fids);
+                    }
+                }
+            }
+        } else if (nullptr == record.operation) {
+            // watermark only - the reader skipped this record
+            continue;
+        } else {
+            rc = record.operation(record.cr_index, lustre_root_path, record.fid, record.parent_fid, record.object_name,
+                    record.lustre_path, change_map);
+            touched_fids.push_back(record.fid);
+        }
+
+        if (rc < 0) {
+            LOG(LOG_ERR, "applying record %llu to change table failed for %s rc = %i\n", record.cr_index,
+                    fid_to_fidstr(record.fid).c_str(), rc);
+        }
+    }
+
+    // copy out the journal rows so the partitions can be released before writing to sqlite
+    std::vector<journal_row> rows;
+    rows.reserve(touched_fids.size());
+    for (auto& fid : touched_fids) {
+        change_table_partition& partition = *change_table.partitions[change_table.partition_for(fid)];
+        auto inflight_iter = partition.inflight_cr_index.find(fid);
+        unsigned long long inflight_cr_index = partition.inflight_cr_index.end() == inflight_iter ? 0 : inflight_iter->second;
+        auto &change_map_fid = partition.change_map.get<change_descriptor_fid_idx>();
+        auto iter = change_map_fid.find(fid);
+        if (change_map_fid.end() != iter) {
+            // the root directory entry is regenerated on every start
+            if (ChangeDescriptor::EventTypeEnum::WRITE_FID == iter->last_event) {
+                continue;
+            }
+            rows.push_back(journal_row{fid, false, *iter, inflight_cr_index});
+        } else {
+            rows.push_back(journal_row{fid, true, change_descriptor{}, inflight_cr_index});
+        }
+    }
+
+    // The journal lock is taken before the partitions are released.  Otherwise a batch could be
+    // sent and acknowledged, and its journal rows deleted, before the rows are written here.
+    change_map_journal& journal = change_table.journal;
+    std::lock_guard<std::mutex> journal_lock(journal.mutex);
+    partition_locks.clear();
+
+    if (journal_change_batch(journal, rows, max_cr_index) < 0) {
+        // The changelog must not be cleared past records that are not durable, so the watermark
+        // stays where it is until these fids have been written with a later batch.
+        LOG(LOG_ERR, "failed to write batch ending at record %llu to the change_map journal, retrying with the next batch\n", max_cr_index);
+        journal.unjournaled_fids.insert(journal.unjournaled_fids.end(), touched_fids.begin(), touched_fids.end());
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    // the reader may clear the changelog up to this point
+    if (max_cr_index > journal.journaled_cr_index.load()) {
+        journal.journaled_cr_index.store(max_cr_index);
+    }
+
+    return lustre_irods::SUCCESS;
+}
+
+int lustre_write_fidstr_to_root_dir(const std::string& lustre_root_path, const fid_key& fid, change_table_t& change_table) {
+
+    change_table_partition& partition = *change_table.partitions[change_table.partition_for(fid)];
+    std::lock_guard<std::mutex> lock(partition.mutex);
 
     change_descriptor entry{};
     entry.cr_index = 0;
-    entry.fidstr = fidstr;
-    entry.parent_fidstr = "";
+    entry.fid = fid;
+    entry.parent_fid = fid_key{};
     entry.object_name = "";
     entry.object_type = ChangeDescriptor::ObjectTypeEnum::DIR;
     entry.lustre_path = lustre_root_path;
     entry.oper_complete = true;
     entry.timestamp = time(NULL);
     entry.last_event = ChangeDescriptor::EventTypeEnum::WRITE_FID;
-    change_map.insert(entry);
+    partition.change_map.insert(entry);
 
     return lustre_irods::SUCCESS;
 
@@ -66,13 +412,11 @@ int lustre_write_fidstr_to_root_dir(const std::string& lustre_root_path, const s
 
 
 
-int lustre_close(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_close(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                  const std::string& object_name, const std::string& lustre_path, change_map_t& change_map) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
- 
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
 
     struct stat st;
     int result = stat(lustre_path.c_str(), &st);
@@ -80,20 +424,22 @@ int lustre_close(unsigned long long cr_index, const std::string& lustre_root_pat
     LOG(LOG_DBG, "stat(%s, &st)\n", lustre_path.c_str());
     LOG(LOG_DBG, "handle_close:  stat_result = %i, file_size = %ld\n", result, st.st_size);
 
-    auto iter = change_map_fidstr.find(fidstr);
-    if (change_map_fidstr.end() != iter) {
-        change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.oper_complete = true; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.timestamp = time(NULL); });
-        if (0 == result) {
-            change_map_fidstr.modify(iter, [st](change_descriptor &cd){ cd.file_size = st.st_size; });
-        }
+    auto iter = change_map_fid.find(fid);
+    if (change_map_fid.end() != iter) {
+        change_map_fid.modify(iter, [cr_index, result, &st](change_descriptor &cd) {
+            cd.cr_index = cr_index;
+            cd.oper_complete = true;
+            cd.timestamp = time(NULL);
+            if (0 == result) {
+                cd.file_size = st.st_size;
+            }
+        });
     } else {
         // this is probably an append so no file update is done
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
-        entry.parent_fidstr = parent_fidstr;
+        entry.fid = fid;
+        entry.parent_fid = parent_fid;
         entry.object_name = object_name;
         entry.object_type = (result == 0 && S_ISDIR(st.st_mode)) ? ChangeDescriptor::ObjectTypeEnum::DIR : ChangeDescriptor::ObjectTypeEnum::FILE;
         entry.lustre_path = lustre_path; 
@@ -110,25 +456,25 @@ int lustre_close(unsigned long long cr_index, const std::string& lustre_root_pat
 
 }
 
-int lustre_mkdir(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_mkdir(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                  const std::string& object_name, const std::string& lustre_path, change_map_t& change_map) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
-
-    auto iter = change_map_fidstr.find(fidstr);
-    if(iter != change_map_fidstr.end()) {
-        change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.oper_complete = true; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.timestamp = time(NULL); });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.last_event = ChangeDescriptor::EventTypeEnum::MKDIR; });
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
+
+    auto iter = change_map_fid.find(fid);
+    if(iter != change_map_fid.end()) {
+        change_map_fid.modify(iter, [cr_index](change_descriptor &cd) {
+            cd.cr_index = cr_index;
+            cd.oper_complete = true;
+            cd.timestamp = time(NULL);
+            cd.last_event = ChangeDescriptor::EventTypeEnum::MKDIR;
+        });
     } else {
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
-        entry.parent_fidstr = parent_fidstr;
+        entry.fid = fid;
+        entry.parent_fid = parent_fid;
         entry.object_name = object_name;
         entry.lustre_path = lustre_path;
         entry.oper_complete = true;
@@ -141,34 +487,34 @@ int lustre_mkdir(unsigned long long cr_index, const std::string& lustre_root_pat
 
 }
 
-int lustre_rmdir(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_rmdir(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                  const std::string& object_name, const std::string& lustre_path, change_map_t& change_map) {
 
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
 
 
-    auto iter = change_map_fidstr.find(fidstr);
-    if(iter != change_map_fidstr.end()) {
-        change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-        change_map_fidstr.modify(iter, [parent_fidstr](change_descriptor &cd){ cd.parent_fidstr = parent_fidstr; });
-        change_map_fidstr.modify(iter, [object_name](change_descriptor &cd){ cd.object_name = object_name; });
-        change_map_fidstr.modify(iter, [lustre_path](change_descriptor &cd){ cd.lustre_path = lustre_path; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.oper_complete = true; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.last_event = ChangeDescriptor::EventTypeEnum::RMDIR; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.timestamp = time(NULL); });
+    auto iter = change_map_fid.find(fid);
+    if(iter != change_map_fid.end()) {
+        change_map_fid.modify(iter, [cr_index, &parent_fid, &object_name, &lustre_path](change_descriptor &cd) {
+            cd.cr_index = cr_index;
+            cd.parent_fid = parent_fid;
+            cd.object_name = object_name;
+            cd.lustre_path = lustre_path;
+            cd.oper_complete = true;
+            cd.last_event = ChangeDescriptor::EventTypeEnum::RMDIR;
+            cd.timestamp = time(NULL);
+        });
     } else {
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
+        entry.fid = fid;
         entry.oper_complete = true;
         entry.last_event = ChangeDescriptor::EventTypeEnum::RMDIR;
         entry.timestamp = time(NULL);
         entry.object_type = ChangeDescriptor::ObjectTypeEnum::DIR;
-        entry.parent_fidstr = parent_fidstr;
+        entry.parent_fid = parent_fid;
         entry.object_name = object_name;
         change_map.insert(entry);
     }
@@ -177,32 +523,32 @@ int lustre_rmdir(unsigned long long cr_index, const std::string& lustre_root_pat
 
 }
 
-int lustre_unlink(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_unlink(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                   const std::string& object_name, const std::string& lustre_path, change_map_t& change_map) {
   
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
 
 
-    auto iter = change_map_fidstr.find(fidstr);
-    if(iter != change_map_fidstr.end()) {   
+    auto iter = change_map_fid.find(fid);
+    if(iter != change_map_fid.end()) {   
 
         // If an add and a delete occur in the same transactional unit, just delete the transaction
         if (ChangeDescriptor::EventTypeEnum::CREATE == iter->last_event) {
-            change_map_fidstr.erase(iter);
+            change_map_fid.erase(iter);
         } else {
-            change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-            change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.oper_complete = true; });
-            change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.last_event = ChangeDescriptor::EventTypeEnum::UNLINK; });
-            change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.timestamp = time(NULL); });
+            change_map_fid.modify(iter, [cr_index](change_descriptor &cd) {
+                cd.cr_index = cr_index;
+                cd.oper_complete = true;
+                cd.last_event = ChangeDescriptor::EventTypeEnum::UNLINK;
+                cd.timestamp = time(NULL);
+            });
        }
     } else {
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
-        //entry.parent_fidstr = parent_fidstr;
+        entry.fid = fid;
+        entry.parent_fid = parent_fid;
         //entry.lustre_path = lustre_path;
         entry.oper_complete = true;
         entry.last_event = ChangeDescriptor::EventTypeEnum::UNLINK;
@@ -215,15 +561,13 @@ int lustre_unlink(unsigned long long cr_index, const std::string& lustre_root_pa
     return lustre_irods::SUCCESS; 
 }
 
-int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                   const std::string& object_name, const std::string& lustre_path, const std::string& old_lustre_path, change_map_t& change_map) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
 
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
-
-    auto iter = change_map_fidstr.find(fidstr);
+    auto iter = change_map_fid.find(fid);
     std::string original_path;
 
     struct stat statbuf;
@@ -231,16 +575,18 @@ int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_pa
 
     // if there is a previous entry, just update the lustre_path to the new path
     // otherwise, add a new entry
-    if(iter != change_map_fidstr.end()) {
-        change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-        change_map_fidstr.modify(iter, [parent_fidstr](change_descriptor &cd){ cd.parent_fidstr = parent_fidstr; });
-        change_map_fidstr.modify(iter, [object_name](change_descriptor &cd){ cd.object_name = object_name; });
-        change_map_fidstr.modify(iter, [lustre_path](change_descriptor &cd){ cd.lustre_path = lustre_path; });
+    if(iter != change_map_fid.end()) {
+        change_map_fid.modify(iter, [cr_index, &parent_fid, &object_name, &lustre_path](change_descriptor &cd) {
+            cd.cr_index = cr_index;
+            cd.parent_fid = parent_fid;
+            cd.object_name = object_name;
+            cd.lustre_path = lustre_path;
+        });
     } else {
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
-        entry.parent_fidstr = parent_fidstr;
+        entry.fid = fid;
+        entry.parent_fid = parent_fid;
         entry.object_name = object_name;
         entry.lustre_path = lustre_path;
         entry.oper_complete = true;
@@ -252,9 +598,9 @@ int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_pa
             entry.object_type = ChangeDescriptor::ObjectTypeEnum::FILE;
         }
         /*if (is_dir) {
-            change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.object_type = ChangeDescriptor::ObjectTypeEnum::DIR; });
+            change_map_fid.modify(iter, [](change_descriptor &cd){ cd.object_type = ChangeDescriptor::ObjectTypeEnum::DIR; });
         } else {
-            change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.object_type = ChangeDescriptor::ObjectTypeEnum::FILE; });
+            change_map_fid.modify(iter, [](change_descriptor &cd){ cd.object_type = ChangeDescriptor::ObjectTypeEnum::FILE; });
         }*/
         change_map.insert(entry);
     }
@@ -264,10 +610,11 @@ int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_pa
     if (is_dir) {
 
         // search through and update all references in table
-        for (auto iter = change_map_fidstr.begin(); iter != change_map_fidstr.end(); ++iter) {
-            std::string p = iter->lustre_path;
-            if (p.length() > 0 && p.length() != old_lustre_path.length() && boost::starts_with(p, old_lustre_path)) {
-                change_map_fidstr.modify(iter, [old_lustre_path, lustre_path](change_descriptor &cd){ cd.lustre_path.replace(0, old_lustre_path.length(), lustre_path); });
+        std::string old_dir_prefix = old_lustre_path + "/";
+        for (auto iter = change_map_fid.begin(); iter != change_map_fid.end(); ++iter) {
+            const std::string& p = iter->lustre_path;
+            if (boost::starts_with(p, old_dir_prefix)) {
+                change_map_fid.modify(iter, [&old_lustre_path, &lustre_path](change_descriptor &cd){ cd.lustre_path.replace(0, old_lustre_path.length(), lustre_path); });
             }
         }
     }
@@ -276,28 +623,28 @@ int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_pa
 
 }
 
-int lustre_create(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_create(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                   const std::string& object_name, const std::string& lustre_path, change_map_t& change_map) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
-
-    auto iter = change_map_fidstr.find(fidstr);
-    if(iter != change_map_fidstr.end()) {
-        change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-        change_map_fidstr.modify(iter, [parent_fidstr](change_descriptor &cd){ cd.parent_fidstr = parent_fidstr; });
-        change_map_fidstr.modify(iter, [object_name](change_descriptor &cd){ cd.object_name = object_name; });
-        change_map_fidstr.modify(iter, [lustre_path](change_descriptor &cd){ cd.lustre_path = lustre_path; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.oper_complete = false; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.last_event = ChangeDescriptor::EventTypeEnum::CREATE; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.timestamp = time(NULL); });
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
+
+    auto iter = change_map_fid.find(fid);
+    if(iter != change_map_fid.end()) {
+        change_map_fid.modify(iter, [cr_index, &parent_fid, &object_name, &lustre_path](change_descriptor &cd) {
+            cd.cr_index = cr_index;
+            cd.parent_fid = parent_fid;
+            cd.object_name = object_name;
+            cd.lustre_path = lustre_path;
+            cd.oper_complete = false;
+            cd.last_event = ChangeDescriptor::EventTypeEnum::CREATE;
+            cd.timestamp = time(NULL);
+        });
     } else {
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
-        entry.parent_fidstr = parent_fidstr;
+        entry.fid = fid;
+        entry.parent_fid = parent_fid;
         entry.object_name = object_name;
         entry.lustre_path = lustre_path;
         entry.oper_complete = false;
@@ -311,24 +658,24 @@ int lustre_create(unsigned long long cr_index, const std::string& lustre_root_pa
 
 }
 
-int lustre_mtime(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_mtime(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                  const std::string& object_name, const std::string& lustre_path, change_map_t& change_map) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
 
-    auto iter = change_map_fidstr.find(fidstr);
-    if(iter != change_map_fidstr.end()) {   
-        change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.oper_complete = false; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.timestamp = time(NULL); });
+    auto iter = change_map_fid.find(fid);
+    if(iter != change_map_fid.end()) {   
+        change_map_fid.modify(iter, [cr_index](change_descriptor &cd) {
+            cd.cr_index = cr_index;
+            cd.oper_complete = false;
+            cd.timestamp = time(NULL);
+        });
     } else {
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
-        //entry.parent_fidstr = parent_fidstr;
+        entry.fid = fid;
+        //entry.parent_fid = parent_fid;
         //entry.lustre_path = lustre_path;
         //entry.object_name = object_name;
         entry.last_event = ChangeDescriptor::EventTypeEnum::OTHER;
@@ -341,32 +688,32 @@ int lustre_mtime(unsigned long long cr_index, const std::string& lustre_root_pat
 
 }
 
-int lustre_trunc(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_trunc(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                  const std::string& object_name, const std::string& lustre_path, change_map_t& change_map) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    // get change map with hashed index of fidstr
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
+    // get change map with hashed index of fid
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
 
     struct stat st;
     int result = stat(lustre_path.c_str(), &st);
 
     LOG(LOG_DBG, "handle_trunc:  stat_result = %i, file_size = %ld\n", result, st.st_size);
 
-    auto iter = change_map_fidstr.find(fidstr);
-    if(iter != change_map_fidstr.end()) {
-        change_map_fidstr.modify(iter, [cr_index](change_descriptor &cd){ cd.cr_index = cr_index; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.oper_complete = false; });
-        change_map_fidstr.modify(iter, [](change_descriptor &cd){ cd.timestamp = time(NULL); });
-        if (0 == result) {
-            change_map_fidstr.modify(iter, [st](change_descriptor &cd){ cd.file_size = st.st_size; });
-        }
+    auto iter = change_map_fid.find(fid);
+    if(iter != change_map_fid.end()) {
+        change_map_fid.modify(iter, [cr_index, result, &st](change_descriptor &cd) {
+            cd.cr_index = cr_index;
+            cd.oper_complete = false;
+            cd.timestamp = time(NULL);
+            if (0 == result) {
+                cd.file_size = st.st_size;
+            }
+        });
     } else {
         change_descriptor entry{};
         entry.cr_index = cr_index;
-        entry.fidstr = fidstr;
-        //entry.parent_fidstr = parent_fidstr;
+        entry.fid = fid;
+        //entry.parent_fid = parent_fid;
         //entry.lustre_path = lustre_path;
         //entry.object_name = object_name;
         entry.oper_complete = false;
@@ -382,14 +729,28 @@ int lustre_trunc(unsigned long long cr_index, const std::string& lustre_root_pat
 
 }
 
-int remove_fidstr_from_table(const std::string& fidstr, change_map_t& change_map) {
+int remove_fid_from_table(const fid_key& fid, change_table_t& change_table) {
+
+    change_table_partition& partition = *change_table.partitions[change_table.partition_for(fid)];
+    std::lock_guard<std::mutex> lock(partition.mutex);
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
+    // get change map with index of fid 
+    auto &change_map_fid = partition.change_map.get<change_descriptor_fid_idx>();
 
-    // get change map with index of fidstr 
-    auto &change_map_fidstr = change_map.get<change_descriptor_fidstr_idx>();
+    change_map_fid.erase(fid);
 
-    change_map_fidstr.erase(fidstr);
+    // the row of an entry in flight is removed when its batch is acknowledged
+    auto inflight_iter = partition.inflight_cr_index.find(fid);
+    unsigned long long inflight_cr_index = partition.inflight_cr_index.end() == inflight_iter ? 0 : inflight_iter->second;
+
+    change_map_journal& journal = change_table.journal;
+    std::lock_guard<std::mutex> journal_lock(journal.mutex);
+    if (nullptr != journal.db) {
+        sqlite3_bind_text(journal.delete_superseded_stmt, 1, fid_to_fidstr(fid).c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(journal.delete_superseded_stmt, 2, 0);
+        sqlite3_bind_int64(journal.delete_superseded_stmt, 3, inflight_cr_index);
+        return step_and_reset(journal.db, journal.delete_superseded_stmt);
+    }
 
     return lustre_irods::SUCCESS;
 }
@@ -423,16 +784,11 @@ int remove_fidstr_from_table(const std::string& fidstr, change_map_t& change_map
 }*/
 
 // This is just a debugging function
-void lustre_write_change_table_to_str(const change_map_t& change_map, std::string& buffer) {
+void lustre_write_change_table_to_str(change_table_t& change_table, std::string& buffer) {
 
     boost::format change_record_header_format_obj("%-15s %-30s %-30s %-12s %-20s %-30s %-17s %-11s %-15s %-10s\n");
     boost::format change_record_format_obj("%015u %-30s %-30s %-12s %-20s %-30s %-17s %-11s %-15s %lu\n");
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    // get change map with sequenced index  
-    auto &change_map_seq = change_map.get<change_descriptor_seq_idx>();
-
     char time_str[18];
 
     buffer = str(change_record_header_format_obj % "CR_INDEX" % "FIDSTR" % "PARENT_FIDSTR" % "OBJECT_TYPE" % "OBJECT_NAME" % "LUSTRE_PATH" % "TIME" %
@@ -441,101 +797,152 @@ void lustre_write_change_table_to_str(const change_map_t& change_map, std::strin
     buffer += str(change_record_header_format_obj % "--------" % "------" % "-------------" % "-----------"% "-----------" % "-----------" % "----" % 
             "----------" % "--------------" % "---------");
 
-    for (auto iter = change_map_seq.begin(); iter != change_map_seq.end(); ++iter) {
-         std::string fidstr = iter->fidstr;
+    for (auto& partition : change_table.partitions) {
+
+      std::lock_guard<std::mutex> lock(partition->mutex);
+
+      // get change map with sequenced index  
+      auto &change_map_seq = partition->change_map.get<change_descriptor_seq_idx>();
+
+      for (auto iter = change_map_seq.begin(); iter != change_map_seq.end(); ++iter) {
+         std::string fidstr = fid_to_fidstr(iter->fid);
+         std::string parent_fidstr = fid_to_fidstr(iter->parent_fid);
 
          struct tm *timeinfo;
          timeinfo = localtime(&iter->timestamp);
          strftime(time_str, sizeof(time_str), "%Y%m%d %I:%M:%S", timeinfo);
 
-         buffer += str(change_record_format_obj % iter->cr_index % fidstr.c_str() % iter->parent_fidstr.c_str() %
+         buffer += str(change_record_format_obj % iter->cr_index % fidstr.c_str() % parent_fidstr.c_str() %
                  object_type_to_str(iter->object_type).c_str() %
                  iter->object_name.c_str() % 
                  iter->lustre_path.c_str() % time_str % 
                  event_type_to_str(iter->last_event).c_str() %
                  (iter->oper_complete == 1 ? "true" : "false") % iter->file_size);
 
+      }
     }
 
 }
 
 // This is just a debugging function
-void lustre_print_change_table(const change_map_t& change_map) {
+void lustre_print_change_table(change_table_t& change_table) {
    
     std::string change_table_str; 
-    lustre_write_change_table_to_str(change_map, change_table_str);
+    lustre_write_change_table_to_str(change_table, change_table_str);
     LOG(LOG_DBG, "%s", change_table_str.c_str());
 }
 
-// Sets the update status.  This copies the message to a new buffer which must be deleted by the caller.
-int set_update_status_in_capnproto_buf(unsigned char*& buf, size_t& buflen, const std::string& new_status) {
+// Reads the batch id and number of entries from a batch written by write_change_table_to_capnproto_buf.
+int get_batch_info_from_capnproto_buf(const unsigned char *buf, size_t buflen, uint64_t& batch_id, uint32_t& entry_count) {
 
     if (nullptr == buf) {
         LOG(LOG_ERR, "Null buffer sent to %s - %d\n", __FUNCTION__, __LINE__);
         return lustre_irods::INVALID_OPERAND_ERROR;
     }
 
-    const kj::ArrayPtr<const capnp::word> array_ptr{ reinterpret_cast<const capnp::word*>(&(*(buf))),
-        reinterpret_cast<const capnp::word*>(&(*(buf + buflen)))};
-
-    capnp::FlatArrayMessageReader message_reader(array_ptr);
+    const kj::ArrayPtr<const capnp::word> array_ptr{ reinterpret_cast<const capnp::word*>(buf),
+        reinterpret_cast<const capnp::word*>(buf + buflen)};
+    capnp::FlatArrayMessageReader message(array_ptr);
 
-    capnp::MallocMessageBuilder message_builder;
-    //ChangeMap::Builder changeMap = message.initRoot<ChangeMap>();
+    ChangeMap::Reader changeMap = message.getRoot<ChangeMap>();
+    batch_id = changeMap.getBatchId();
+    entry_count = changeMap.getEntries().size();
+    return lustre_irods::SUCCESS;
+}
 
-    message_builder.setRoot(message_reader.getRoot<ChangeMap>());
-    ChangeMap::Builder changeMap = message_builder.getRoot<ChangeMap>();
-    changeMap.setUpdateStatus(new_status.c_str());
+// Returns true if the directory that entry is created in or moved to is itself waiting to be
+// created or moved by an earlier entry in another partition.  The entry has to wait for that one
+// to be sent.  If the other partition is busy the entry is treated as blocked rather than waiting
+// on its lock.
+// Precondition:  the lock for partition_index is held.
+static bool parent_pending_in_other_partition(change_table_t& change_table, size_t partition_index, const change_descriptor& entry) {
 
+    if (fid_is_zero(entry.parent_fid)) {
+        return false;
+    }
 
-    kj::Array<capnp::word> array = capnp::messageToFlatArray(message_builder);
-    size_t message_size = array.size() * sizeof(capnp::word);
+    size_t parent_partition_index = change_table.partition_for(entry.parent_fid);
+    if (parent_partition_index == partition_index) {
+        // earlier entries in this partition are handled by the scan in cr_index order
+        return false;
+    }
 
-    buf = (unsigned char*)malloc(message_size);
-    buflen = message_size;
-    memcpy(buf, std::begin(array), message_size);
+    change_table_partition& parent_partition = *change_table.partitions[parent_partition_index];
+    std::unique_lock<std::mutex> lock(parent_partition.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return true;
+    }
 
-    return lustre_irods::SUCCESS;
+    auto &change_map_fid = parent_partition.change_map.get<change_descriptor_fid_idx>();
+    auto iter = change_map_fid.find(entry.parent_fid);
+    return change_map_fid.end() != iter && iter->cr_index < entry.cr_index &&
+        (ChangeDescriptor::EventTypeEnum::MKDIR == iter->last_event || ChangeDescriptor::EventTypeEnum::RENAME == iter->last_event);
 }
 
+// Returns true if a change underneath the directory that entry removes is still in flight, or is
+// waiting to be sent with an earlier cr_index.  The RMDIR has to wait for those.  Entries in this
+// partition that are ready to send are handled by the scan in cr_index order.  If another
+// partition is busy the entry is treated as blocked rather than waiting on its lock.
+// Precondition:  the lock for partition_index and the active fid set mutex are held.
+static bool children_pending(change_table_t& change_table, size_t partition_index, const change_descriptor& entry) {
 
-int get_update_status_from_capnproto_buf(unsigned char* buf, size_t buflen, std::string& update_status) {
-
-    if (nullptr == buf) {
-        LOG(LOG_ERR, "Null buffer sent to %s - %d\n", __FUNCTION__, __LINE__);
-        return lustre_irods::INVALID_OPERAND_ERROR;
+    if (change_table.active_fids.parent_fids.count(entry.fid) > 0) {
+        return true;
     }
 
-    const kj::ArrayPtr<const capnp::word> array_ptr{ reinterpret_cast<const capnp::word*>(&(*(buf))),
-        reinterpret_cast<const capnp::word*>(&(*(buf + buflen)))};
-    capnp::FlatArrayMessageReader message(array_ptr);
+    for (size_t i = 0; i < change_table.partition_count(); ++i) {
 
-    ChangeMap::Reader changeMap = message.getRoot<ChangeMap>();
-    update_status = changeMap.getUpdateStatus().cStr();
-    return lustre_irods::SUCCESS;
-}
+        change_table_partition& child_partition = *change_table.partitions[i];
+        std::unique_lock<std::mutex> lock;
+        if (i != partition_index) {
+            lock = std::unique_lock<std::mutex>(child_partition.mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                return true;
+            }
+        }
+
+        auto range = child_partition.change_map.get<change_descriptor_parent_idx>().equal_range(entry.fid);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (iter->cr_index < entry.cr_index && (i != partition_index || !iter->oper_complete)) {
+                return true;
+            }
+        }
+    }
 
+    return false;
+}
 
-// Processes change table by writing records ready to be sent to iRODS into capnproto buffer (buf).
-// The size of the buffer is written to buflen.
-// Note:  The buf is malloced and must be freed by caller.
-int write_change_table_to_capnproto_buf(const lustre_irods_connector_cfg_t *config_struct_ptr, void*& buf, size_t& buflen, 
-        change_map_t& change_map, std::set<std::string>& active_fidstr_list) {
+// Processes change table by writing records ready to be sent to iRODS into a flat capnproto array.
+// This is the only copy of the batch that is made.  The caller hands the array to zmq as is.
+// Only the entries in the given partition are considered.
+int write_change_table_to_capnproto_buf(const lustre_irods_connector_cfg_t *config_struct_ptr, kj::Array<capnp::word>& flat_message,
+        change_table_t& change_table, size_t partition_index) {
 
 
-    // store up a list of fidstr that are being added to this buffer
-    std::set<std::string> temp_fidstr_list;
+    // store up a list of fids that are being added to this buffer
+    std::vector<fid_key> temp_fid_list;
 
     if (nullptr == config_struct_ptr) {
         LOG(LOG_ERR, "Null config_struct_ptr sent to %s - %d\n", __FUNCTION__, __LINE__);
         return lustre_irods::INVALID_OPERAND_ERROR;
     }
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
+    if (partition_index >= change_table.partition_count()) {
+        LOG(LOG_ERR, "Invalid partition %lu sent to %s - %d\n", partition_index, __FUNCTION__, __LINE__);
+        return lustre_irods::INVALID_OPERAND_ERROR;
+    }
+
+    change_table_partition& partition = *change_table.partitions[partition_index];
+    change_map_t& change_map = partition.change_map;
+
+    std::lock_guard<std::mutex> lock(partition.mutex);
 
     // get change map with sequenced index  
     auto &change_map_seq = change_map.get<change_descriptor_seq_idx>();
 
+    // get change map with index on (oper_complete, cr_index)
+    auto &change_map_ready = change_map.get<change_descriptor_ready_idx>();
+
     //initialize capnproto message
     capnp::MallocMessageBuilder message;
     ChangeMap::Builder changeMap = message.initRoot<ChangeMap>();
@@ -549,6 +956,8 @@ int write_change_table_to_capnproto_buf(const lustre_irods_connector_cfg_t *conf
     changeMap.setMaximumRecordsPerSqlCommand(config_struct_ptr->maximum_records_per_sql_command);
     changeMap.setSetMetadataForStorageTieringTimeViolation(config_struct_ptr->set_metadata_for_storage_tiering_time_violation);
     changeMap.setMetadataKeyForStorageTieringTimeViolation(config_struct_ptr->metadata_key_for_storage_tiering_time_violation);
+    changeMap.setSingleTransactionPerBatch(config_struct_ptr->single_transaction_per_batch);
+    changeMap.setFidstrObjectCacheSize(config_struct_ptr->fidstr_object_cache_size);
 
     // build the register map
     capnp::List<RegisterMapEntry>::Builder reg_map = changeMap.initRegisterMap(config_struct_ptr->register_map.size());
@@ -561,162 +970,328 @@ int write_change_table_to_capnproto_buf(const lustre_irods_connector_cfg_t *conf
     }
 
 
-    size_t write_count = change_map_seq.size() >= config_struct_ptr->maximum_records_per_update_to_irods 
-        ? config_struct_ptr->maximum_records_per_update_to_irods : change_map_seq.size() ;
+    size_t write_count = config_struct_ptr->maximum_records_per_update_to_irods;
 
-    capnp::List<ChangeDescriptor>::Builder entries = changeMap.initEntries(write_count);
+    // Pick the entries for this batch.  An entry is blocked if its fid (or for MKDIR, CREATE, and
+    // RENAME its parent fid) is in a batch another thread is still working on.  An RMDIR is also
+    // blocked while changes underneath it are pending.  Blocked entries are skipped rather than
+    // ending the batch so that unrelated subtrees are not held up behind one busy directory.  To
+    // keep the changes for a fid in order, once an entry is skipped its fid and, for everything
+    // but an OTHER, its parent fid are blocked for the rest of the scan as well, so later entries
+    // that depend on it, including an RMDIR of its parent, wait for the next batch too.
+    std::vector<change_map_t::index<change_descriptor_ready_idx>::type::iterator> selected;
+    fid_set_t blocked_fid_list;
+    size_t skipped_count = 0;
+    size_t maximum_skipped_count = write_count * MAXIMUM_SKIPPED_ENTRIES_PER_BATCH_ENTRY;
 
-    bool collision_in_fidstr = false;
-    cnt = 0;
-    for (auto iter = change_map_seq.begin(); iter != change_map_seq.end() && cnt < write_count;) { 
+    // entries waiting out a retry backoff - these do not count against maximum_skipped_count so
+    // that a run of failing entries at the front of the table cannot hold up the rest
+    size_t deferred_count = 0;
+    time_t now = time(NULL);
 
-        LOG(LOG_DBG, "fidstr=%s oper_complete=%i\n", iter->fidstr.c_str(), iter->oper_complete);
+    std::unique_lock<std::mutex> active_lock(change_table.active_fids.mutex);
+    fid_set_t& active_fid_list = change_table.active_fids.fids;
 
-        LOG(LOG_DBG, "change_map size = %lu\n", change_map_seq.size()); 
+    // only walk the entries that are ready to send - these are in cr_index order
+    for (auto iter = change_map_ready.lower_bound(boost::make_tuple(true));
+            iter != change_map_ready.end() && selected.size() < write_count && skipped_count < maximum_skipped_count; ++iter) { 
 
-        if (iter->oper_complete) {
+        LOG(LOG_DBG, "fidstr=%s oper_complete=%i\n", fid_to_fidstr(iter->fid).c_str(), iter->oper_complete);
 
-            // break out of the main loop if we reach an fidstr that is already being operated on
-            // by another thread.  In the case of MKDIR, CREATE, and RENAME, break out if the parent_fidstr is already being
-            // operated on by another thread.
+        bool depends_on_parent = iter->last_event == ChangeDescriptor::EventTypeEnum::MKDIR ||
+                iter->last_event == ChangeDescriptor::EventTypeEnum::CREATE ||
+                iter->last_event == ChangeDescriptor::EventTypeEnum::RENAME;
 
-            if (iter->last_event == ChangeDescriptor::EventTypeEnum::MKDIR ||
-                    iter->last_event == ChangeDescriptor::EventTypeEnum::CREATE ||
-                    iter->last_event == ChangeDescriptor::EventTypeEnum::RENAME) {
+        // an UNLINK or RMDIR has to go out before an RMDIR of its parent
+        bool blocks_parent = depends_on_parent ||
+                iter->last_event == ChangeDescriptor::EventTypeEnum::UNLINK ||
+                iter->last_event == ChangeDescriptor::EventTypeEnum::RMDIR;
 
-                if (active_fidstr_list.find(iter->parent_fidstr) != active_fidstr_list.end()) {
-                    LOG(LOG_DBG, "fidstr %s is already in active fidstr list - breaking out \n", iter->parent_fidstr.c_str());
-                    collision_in_fidstr = true;
-                    break;
-                }
-            }
+        bool blocked = active_fid_list.find(iter->fid) != active_fid_list.end() ||
+                blocked_fid_list.find(iter->fid) != blocked_fid_list.end();
 
-            if (active_fidstr_list.find(iter->fidstr) != active_fidstr_list.end()) {
-                LOG(LOG_DBG, "fidstr %s is already in active fidstr list - breaking out\n", iter->fidstr.c_str());
-                collision_in_fidstr = true;
-                break;
-            }
+        if (!blocked && depends_on_parent) {
+            blocked = active_fid_list.find(iter->parent_fid) != active_fid_list.end() ||
+                blocked_fid_list.find(iter->parent_fid) != blocked_fid_list.end() ||
+                parent_pending_in_other_partition(change_table, partition_index, *iter);
+        }
 
-           
-            LOG(LOG_DBG, "adding fidstr %s to active fidstr list\n", iter->fidstr.c_str());
-            temp_fidstr_list.insert(iter->fidstr);
+        if (!blocked && iter->last_event == ChangeDescriptor::EventTypeEnum::RMDIR) {
+            blocked = children_pending(change_table, partition_index, *iter);
+        }
 
-            entries[cnt].setCrIndex(iter->cr_index);
-            entries[cnt].setFidstr(iter->fidstr);
-            entries[cnt].setParentFidstr(iter->parent_fidstr);
-            entries[cnt].setObjectType(iter->object_type);
-            entries[cnt].setObjectName(iter->object_name);
-            entries[cnt].setLustrePath(iter->lustre_path);
-            entries[cnt].setEventType(iter->last_event);
-            entries[cnt].setFileSize(iter->file_size);
+        // a failed entry waiting to be retried holds back later changes to its fid and children
+        bool deferred = !blocked && iter->retry_after > now;
 
-            // **** debug **** 
-            std::string fidstr(entries[cnt].getFidstr().cStr());
-            std::string lustre_path(entries[cnt].getLustrePath().cStr());
-            std::string object_name(entries[cnt].getObjectName().cStr());
-            std::string parent_fidstr(entries[cnt].getParentFidstr().cStr());
-            LOG(LOG_DBG, "Entry: [fidstr=%s][parent_fidstr=%s][object_name=%s][lustre_path=%s]", fidstr.c_str(), fidstr.c_str(), object_name.c_str(), lustre_path.c_str());
-            // *************
+        if (blocked || deferred) {
+            if (blocked) {
+                LOG(LOG_DBG, "fidstr %s, its parent, or its children are already in active fidstr list - skipping\n", fid_to_fidstr(iter->fid).c_str());
+                ++skipped_count;
+            } else {
+                LOG(LOG_DBG, "fidstr %s is waiting to be retried - skipping\n", fid_to_fidstr(iter->fid).c_str());
+                ++deferred_count;
+            }
+            blocked_fid_list.insert(iter->fid);
+            if (blocks_parent && !fid_is_zero(iter->parent_fid)) {
+                blocked_fid_list.insert(iter->parent_fid);
+            }
+            continue;
+        }
 
-            // before deleting write the entry to removed_entries 
-            //removed_entries->insert(*iter);
+        LOG(LOG_DBG, "adding fidstr %s to active fidstr list\n", fid_to_fidstr(iter->fid).c_str());
+        temp_fid_list.push_back(iter->fid);
+        selected.push_back(iter);
+    }
 
-            // delete entry from table 
-            iter = change_map_seq.erase(iter);
+    // add all fids from temp_fid_list to active_fid_list
+    active_fid_list.insert(temp_fid_list.begin(), temp_fid_list.end());
+    for (auto& iter : selected) {
+        change_table.active_fids.parent_fids.insert(iter->parent_fid);
+    }
+    active_lock.unlock();
 
-            ++cnt;
+    bool collision_in_fidstr = skipped_count > 0 || deferred_count > 0;
 
-            LOG(LOG_DBG, "after erase change_map size = %lu\n", change_map_seq.size());
+    // size the list by what was selected so no empty entries are sent
+    capnp::List<ChangeDescriptor>::Builder entries = changeMap.initEntries(selected.size());
 
-        } else {
-            ++iter;
-        }
-        
-    }
+    cnt = 0;
 
+    uint64_t batch_id = (static_cast<uint64_t>(change_table.mdt_index) << BATCH_ID_MDT_SHIFT) |
+        (change_table.next_batch_sequence++ * change_table.partition_count() + partition_index);
+    changeMap.setBatchId(batch_id);
+    std::vector<change_descriptor>& batch_entries = partition.inflight_batches[batch_id];
+    batch_entries.reserve(selected.size());
+
+    for (auto& iter : selected) {
+
+        // this is the point where the fids are rendered as text
+        char fidstr_buf[FIDSTR_BUFFER_SIZE];
+        entries[cnt].setCrIndex(iter->cr_index);
+        fid_to_fidstr(iter->fid, fidstr_buf, sizeof(fidstr_buf));
+        entries[cnt].setFidstr(fidstr_buf);
+        fid_to_fidstr(iter->parent_fid, fidstr_buf, sizeof(fidstr_buf));
+        entries[cnt].setParentFidstr(fidstr_buf);
+        entries[cnt].setObjectType(iter->object_type);
+        entries[cnt].setObjectName(iter->object_name);
+        entries[cnt].setLustrePath(iter->lustre_path);
+        entries[cnt].setEventType(iter->last_event);
+        entries[cnt].setFileSize(iter->file_size);
+
+        LOG(LOG_DBG, "Entry: [fidstr=%s][parent_fidstr=%s][object_name=%s][lustre_path=%s]", entries[cnt].getFidstr().cStr(),
+                fidstr_buf, iter->object_name.c_str(), iter->lustre_path.c_str());
+
+        // move the entry from the table to the in-flight batch
+        batch_entries.push_back(*iter);
+        partition.inflight_cr_index[iter->fid] = iter->cr_index;
+        change_map_ready.erase(iter);
 
-    LOG(LOG_DBG, "write_count=%lu cnt=%lu\n", write_count, cnt);
+        ++cnt;
+    }
 
-    kj::Array<capnp::word> array = capnp::messageToFlatArray(message);
-    size_t message_size = array.size() * sizeof(capnp::word);
+    LOG(LOG_DBG, "after erase change_map size = %lu skipped = %lu\n", change_map_seq.size(), skipped_count);
 
-    LOG(LOG_DBG, "message_size=%lu\n", message_size);
+    LOG(LOG_DBG, "write_count=%lu cnt=%lu\n", write_count, cnt);
 
-    buf = (unsigned char*)malloc(message_size);
-    buflen = message_size;
-    memcpy(buf, std::begin(array), message_size);
+    flat_message = capnp::messageToFlatArray(message);
 
-    // add all fid strings from tmp_fidstr to active_fidstr_list
-    active_fidstr_list.insert(temp_fidstr_list.begin(), temp_fidstr_list.end());
+    LOG(LOG_DBG, "message_size=%lu\n", flat_message.size() * sizeof(capnp::word));
 
-    if (collision_in_fidstr) {
-        return lustre_irods::COLLISION_IN_FIDSTR;
+    // only report the collision if nothing could be sent, otherwise the entries that were
+    // written must still go out
+    if (0 == cnt) {
+        partition.inflight_batches.erase(batch_id);
+        if (collision_in_fidstr) {
+            return lustre_irods::COLLISION_IN_FIDSTR;
+        }
     }
 
     return lustre_irods::SUCCESS;
 }
 
-// If we get a failure, the accumulator needs to add the entry back to the list.
-int add_capnproto_buffer_back_to_change_table(unsigned char* buf, size_t buflen, change_map_t& change_map, std::set<std::string>& active_fidstr_list) {
+// Puts an entry that iRODS failed to apply back into the change table.  If a newer change for the
+// fid arrived while the batch was in flight the two are merged as if the failed entry had never
+// left the table, so the newer path and size are kept along with the event the table would have
+// ended up with:
+//   - a failed CREATE, MKDIR, or RENAME replaces a newer OTHER or RENAME so the object still gets
+//     registered or moved
+//   - a failed UNLINK or RMDIR replaces a newer OTHER so the object still gets removed
+//   - a newer UNLINK, RMDIR, CREATE, or MKDIR replaces the failed event, as does any newer event
+//     when the failed one is an OTHER
+// Rename records do not carry a size so the failed entry's size is kept when the newer entry is a
+// RENAME.  A failed event that is replaced is logged and dropped.
+// Precondition:  the partition lock is held.
+static void merge_failed_entry(change_map_t& change_map, change_descriptor&& entry) {
+
+    auto &change_map_fid = change_map.get<change_descriptor_fid_idx>();
+
+    auto iter = change_map_fid.find(entry.fid);
+    if (change_map_fid.end() == iter) {
+        entry.timestamp = time(NULL);
+        change_map.insert(std::move(entry));
+        return;
+    }
+
+    bool failed_event_wins = false;
+    switch (entry.last_event) {
+        case ChangeDescriptor::EventTypeEnum::CREATE:
+        case ChangeDescriptor::EventTypeEnum::MKDIR:
+        case ChangeDescriptor::EventTypeEnum::RENAME:
+            failed_event_wins = ChangeDescriptor::EventTypeEnum::OTHER == iter->last_event ||
+                ChangeDescriptor::EventTypeEnum::RENAME == iter->last_event;
+            break;
+        case ChangeDescriptor::EventTypeEnum::UNLINK:
+        case ChangeDescriptor::EventTypeEnum::RMDIR:
+            failed_event_wins = ChangeDescriptor::EventTypeEnum::OTHER == iter->last_event;
+            break;
+        default:
+            break;
+    }
 
-    if (nullptr == buf) {
-        LOG(LOG_ERR, "Null buffer sent to %s - %d\n", __FUNCTION__, __LINE__);
-        return lustre_irods::INVALID_OPERAND_ERROR;
+    bool keep_failed_size = ChangeDescriptor::EventTypeEnum::RENAME == iter->last_event &&
+        (failed_event_wins || ChangeDescriptor::EventTypeEnum::OTHER == entry.last_event);
+
+    if (!failed_event_wins) {
+        LOG(LOG_INFO, "dropping failed %s for fidstr %s [cr_index=%llu] since it is replaced by a newer %s [cr_index=%llu]\n",
+                event_type_to_str(entry.last_event).c_str(), fid_to_fidstr(entry.fid).c_str(), entry.cr_index,
+                event_type_to_str(iter->last_event).c_str(), iter->cr_index);
+    } else {
+        LOG(LOG_DBG, "merging failed %s for fidstr %s into newer %s\n", event_type_to_str(entry.last_event).c_str(),
+                fid_to_fidstr(entry.fid).c_str(), event_type_to_str(iter->last_event).c_str());
     }
 
+    if (!failed_event_wins && !keep_failed_size) {
+        return;
+    }
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
+    change_map_fid.modify(iter, [&entry, failed_event_wins, keep_failed_size](change_descriptor &cd) {
+        if (keep_failed_size) {
+            cd.file_size = entry.file_size;
+        }
+        if (failed_event_wins) {
+            cd.last_event = entry.last_event;
+            cd.attempt_count = entry.attempt_count;
+            cd.retry_after = entry.retry_after;
+        }
+    });
+}
 
-    const kj::ArrayPtr<const capnp::word> array_ptr{ reinterpret_cast<const capnp::word*>(&(*(buf))),
-        reinterpret_cast<const capnp::word*>(&(*(buf + buflen)))};
-    capnp::FlatArrayMessageReader message(array_ptr);
+// Called by the accumulator when a batch has been acknowledged.  Entries that failed are merged
+// back into the change table so they are retried after a backoff, or dropped once they have
+// failed MAXIMUM_ENTRY_ATTEMPTS times.  Entries that succeeded or were dropped are removed from
+// the journal.  Either way the fids are no longer active.
+int process_batch_ack(const batch_ack_header& ack, const unsigned char *failure_bitmap, change_table_t& change_table) {
+
+    change_table_partition& partition = *change_table.partitions[change_table.partition_from_batch_id(ack.batch_id)];
+
+    // (fid, cr_index) of the entries iRODS now has or that were dropped
+    std::vector<std::pair<fid_key, unsigned long long> > acked_entries;
+
+    // fids of the entries that are retried.  Their rows are written again from the table, which
+    // also removes the row of a failed entry that was merged into a newer one.
+    std::vector<fid_key> retried_fids;
+
+    {
+        std::lock_guard<std::mutex> lock(partition.mutex);
+
+        auto batch_iter = partition.inflight_batches.find(ack.batch_id);
+        if (partition.inflight_batches.end() == batch_iter) {
+            LOG(LOG_ERR, "received acknowledgement for unknown batch %llu\n", static_cast<unsigned long long>(ack.batch_id));
+            return lustre_irods::INVALID_OPERAND_ERROR;
+        }
+
+        std::vector<change_descriptor>& batch_entries = batch_iter->second;
+        acked_entries.reserve(batch_entries.size());
+
+        std::lock_guard<std::mutex> active_lock(change_table.active_fids.mutex);
 
-    ChangeMap::Reader change_map_from_message = message.getRoot<ChangeMap>();
+        size_t failed_count = 0;
+        for (size_t i = 0; i < batch_entries.size(); ++i) {
 
-    for (ChangeDescriptor::Reader entry : change_map_from_message.getEntries()) {
+            change_descriptor& entry = batch_entries[i];
+            change_table.active_fids.fids.erase(entry.fid);
+            auto parent_iter = change_table.active_fids.parent_fids.find(entry.parent_fid);
+            if (change_table.active_fids.parent_fids.end() != parent_iter) {
+                change_table.active_fids.parent_fids.erase(parent_iter);
+            }
+            partition.inflight_cr_index.erase(entry.fid);
+
+            if (batch_ack_entry_failed(ack, failure_bitmap, i)) {
 
-        change_descriptor record {};
-        record.cr_index = entry.getCrIndex();
-        record.last_event = entry.getEventType();
-        record.fidstr = entry.getFidstr().cStr();
-        record.lustre_path = entry.getLustrePath().cStr();
-        record.object_name = entry.getObjectName().cStr();
-        record.object_type = entry.getObjectType();
-        record.parent_fidstr = entry.getParentFidstr().cStr();
-        record.file_size = entry.getFileSize();
-        record.oper_complete = true;
-        record.timestamp = time(NULL);
+                if (++entry.attempt_count >= MAXIMUM_ENTRY_ATTEMPTS) {
+                    LOG(LOG_ERR, "giving up on %s for fidstr %s [lustre_path=%s][cr_index=%llu] after %u attempts\n",
+                            event_type_to_str(entry.last_event).c_str(), fid_to_fidstr(entry.fid).c_str(),
+                            entry.lustre_path.c_str(), entry.cr_index, entry.attempt_count);
+                    acked_entries.emplace_back(entry.fid, entry.cr_index);
+                    ++failed_count;
+                    continue;
+                }
 
-        LOG(LOG_DBG, "writing entry back to change_map.\n");
+                time_t backoff = RETRY_BACKOFF_INITIAL_SECONDS << (entry.attempt_count - 1);
+                entry.retry_after = time(NULL) + std::min(backoff, RETRY_BACKOFF_MAXIMUM_SECONDS);
 
-        change_map.insert(record);
+                LOG(LOG_DBG, "writing entry back to change_map.\n");
+                retried_fids.push_back(entry.fid);
+                merge_failed_entry(partition.change_map, std::move(entry));
+                ++failed_count;
+            } else {
+                acked_entries.emplace_back(entry.fid, entry.cr_index);
+            }
+        }
 
-        // remove fidstr from active fidstr list
-        //LOG(LOG_DBG, "add_capnproto_buffer_back_to_change_table: removing fidstr %s from active fidstr list - lustre_path is %s\n", record.fidstr.c_str(), record.lustre_path.c_str());
-        active_fidstr_list.erase(record.fidstr);
+        LOG(LOG_DBG, "batch %llu acknowledged: %lu entries, %lu failed\n", static_cast<unsigned long long>(ack.batch_id),
+                batch_entries.size(), failed_count);
+
+        partition.inflight_batches.erase(batch_iter);
     }
 
-    return lustre_irods::SUCCESS;
-}   
+    // iRODS has the changes so drop their rows from the journal.  A newer row for the fid has a
+    // different cr_index so this is safe outside the partition lock.
+    change_map_journal& journal = change_table.journal;
+    std::lock_guard<std::mutex> journal_lock(journal.mutex);
 
-void remove_fidstr_from_active_list(unsigned char* buf, size_t buflen, std::set<std::string>& active_fidstr_list) {
+    // the next apply_change_records writes these again from the table
+    journal.unjournaled_fids.insert(journal.unjournaled_fids.end(), retried_fids.begin(), retried_fids.end());
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-    const kj::ArrayPtr<const capnp::word> array_ptr{ reinterpret_cast<const capnp::word*>(&(*(buf))),
-        reinterpret_cast<const capnp::word*>(&(*(buf + buflen)))};
-    capnp::FlatArrayMessageReader message(array_ptr);
+    if (nullptr == journal.db) {
+        return lustre_irods::SUCCESS;
+    }
 
-    ChangeMap::Reader change_map_from_message = message.getRoot<ChangeMap>();
+    // rows that could not be deleted before are retried along with these
+    acked_entries.insert(acked_entries.end(), journal.undeleted_acks.begin(), journal.undeleted_acks.end());
+    journal.undeleted_acks.clear();
 
-    for (ChangeDescriptor::Reader entry : change_map_from_message.getEntries()) {
-        std::string fidstr = entry.getFidstr().cStr();
-        std::string lustre_path = entry.getLustrePath().cStr();
-        //LOG(LOG_DBG, "remove_fidstr_from_active_list: removing fidstr %s from active fidstr list - lustre_path is %s\n", fidstr.c_str(), lustre_path.c_str());
-        active_fidstr_list.erase(fidstr.c_str());
+    if (acked_entries.empty()) {
+        return lustre_irods::SUCCESS;
     }
 
-}
+    int rc = lustre_irods::SUCCESS;
+
+    if (SQLITE_OK != sqlite3_exec(journal.db, "begin transaction", NULL, NULL, NULL)) {
+        LOG(LOG_ERR, "ERROR starting change_map journal transaction: %s\n", sqlite3_errmsg(journal.db));
+        rc = lustre_irods::SQLITE_DB_ERROR;
+    } else {
+        rc = delete_acked_rows(journal, acked_entries);
+
+        if (lustre_irods::SUCCESS == rc && SQLITE_OK != sqlite3_exec(journal.db, "commit", NULL, NULL, NULL)) {
+            LOG(LOG_ERR, "ERROR committing change_map journal transaction: %s\n", sqlite3_errmsg(journal.db));
+            rc = lustre_irods::SQLITE_DB_ERROR;
+        }
 
+        if (lustre_irods::SUCCESS != rc) {
+            sqlite3_exec(journal.db, "rollback", NULL, NULL, NULL);
+        }
+    }
+
+    if (lustre_irods::SUCCESS != rc) {
+        // if these rows are still there on a restart the entries are sent to iRODS again
+        LOG(LOG_ERR, "failed to delete %zu acknowledged entries from the change_map journal, retrying with the next batch\n",
+                acked_entries.size());
+        journal.undeleted_acks.swap(acked_entries);
+    }
+
+    return rc;
+}
 
 std::string event_type_to_str(ChangeDescriptor::EventTypeEnum type) {
     switch (type) {
@@ -782,21 +1357,25 @@ ChangeDescriptor::ObjectTypeEnum str_to_object_type(const std::string& str) {
    return ChangeDescriptor::ObjectTypeEnum::FILE;
 } 
 
-bool entries_ready_to_process(change_map_t& change_map) {
+bool entries_ready_to_process(change_table_t& change_table, size_t partition_index) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
+    change_table_partition& partition = *change_table.partitions[partition_index];
+    std::lock_guard<std::mutex> lock(partition.mutex);
 
-    // get change map indexed on oper_complete 
-    auto &change_map_oper_complete = change_map.get<change_descriptor_oper_complete_idx>();
-    bool ready = change_map_oper_complete.count(true) > 0;
-    LOG(LOG_DBG, "change map size: =%lu\n", change_map.size());
+    // get change map indexed on (oper_complete, cr_index) - ready entries sort last
+    auto &change_map_ready = partition.change_map.get<change_descriptor_ready_idx>();
+    bool ready = !change_map_ready.empty() && change_map_ready.rbegin()->oper_complete;
+    LOG(LOG_DBG, "change map partition %lu size: =%lu\n", partition_index, partition.change_map.size());
     LOG(LOG_DBG, "entries_ready_to_process = %i\n", ready);
     return ready; 
 }
 
-int serialize_change_map_to_sqlite(change_map_t& change_map, const std::string& db_file) {
+// Writes the whole change table, including the entries in flight, to the serialization database
+// in one transaction.  With the journal enabled this is a final checkpoint - the rows are normally
+// already there.
+int serialize_change_map_to_sqlite(change_table_t& change_table, const std::string& db_file) {
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
+    std::vector<std::unique_lock<std::mutex> > partition_locks = lock_all_partitions(change_table);
 
     sqlite3 *db;
     int rc;
@@ -807,52 +1386,83 @@ int serialize_change_map_to_sqlite(change_map_t& change_map, const std::string&
 
     if (rc) {
         LOG(LOG_ERR, "Can't open %s for serialization.\n", serialize_file.c_str());
+        sqlite3_close(db);
         return lustre_irods::SQLITE_DB_ERROR;
     }
 
-    // get change map with sequenced index  
-    auto &change_map_seq = change_map.get<change_descriptor_seq_idx>();
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
 
-    for (auto iter = change_map_seq.begin(); iter != change_map_seq.end(); ++iter) {  
+    sqlite3_stmt *stmt;     
+    if (SQLITE_OK != sqlite3_prepare_v2(db, upsert_change_map_sql, -1, &stmt, NULL)) {
+        LOG(LOG_ERR, "ERROR preparing change_map insert: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
 
-        // don't serialize the event that adds the fid to the root directory as this gets generated 
-        // every time on restart
-        if (iter->last_event == ChangeDescriptor::EventTypeEnum::WRITE_FID) {
-            continue;
+    if (SQLITE_OK != sqlite3_exec(db, "begin transaction", NULL, NULL, NULL)) {
+        LOG(LOG_ERR, "ERROR starting change_map serialization transaction: %s\n", sqlite3_errmsg(db));
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    rc = lustre_irods::SUCCESS;
+
+    for (auto& partition : change_table.partitions) {
+
+        // get change map with sequenced index  
+        auto &change_map_seq = partition->change_map.get<change_descriptor_seq_idx>();
+
+        for (auto iter = change_map_seq.begin(); iter != change_map_seq.end() && lustre_irods::SUCCESS == rc; ++iter) {  
+
+            // don't serialize the event that adds the fid to the root directory as this gets generated 
+            // every time on restart
+            if (iter->last_event == ChangeDescriptor::EventTypeEnum::WRITE_FID) {
+                continue;
+            }
+
+            bind_change_descriptor(stmt, *iter);
+            rc = step_and_reset(db, stmt);
         }
 
-        sqlite3_stmt *stmt;     
-        sqlite3_prepare_v2(db, "insert into change_map (fidstr, parent_fidstr, object_name, lustre_path, last_event, "
-                               "timestamp, oper_complete, object_type, file_size, cr_index) values (?1, ?2, ?3, ?4, "
-                               "?5, ?6, ?7, ?8, ?9, ?10);", -1, &stmt, NULL);       
-        sqlite3_bind_text(stmt, 1, iter->fidstr.c_str(), -1, SQLITE_STATIC); 
-        sqlite3_bind_text(stmt, 2, iter->parent_fidstr.c_str(), -1, SQLITE_STATIC); 
-        sqlite3_bind_text(stmt, 3, iter->object_name.c_str(), -1, SQLITE_STATIC); 
-        sqlite3_bind_text(stmt, 4, iter->lustre_path.c_str(), -1, SQLITE_STATIC); 
-        sqlite3_bind_text(stmt, 5, event_type_to_str(iter->last_event).c_str(), -1, SQLITE_STATIC); 
-        sqlite3_bind_int(stmt, 6, iter->timestamp); 
-        sqlite3_bind_int(stmt, 7, iter->oper_complete ? 1 : 0);
-        sqlite3_bind_text(stmt, 8, object_type_to_str(iter->object_type).c_str(), -1, SQLITE_STATIC); 
-        sqlite3_bind_int(stmt, 9, iter->file_size); 
-        sqlite3_bind_int(stmt, 10, iter->cr_index); 
-
-        rc = sqlite3_step(stmt); 
-        if (SQLITE_DONE != rc) {
-            LOG(LOG_ERR, "ERROR inserting data: %s\n", sqlite3_errmsg(db));
+        // batches that were never acknowledged are merged back into the table on startup
+        for (auto& batch : partition->inflight_batches) {
+            for (auto& entry : batch.second) {
+                if (lustre_irods::SUCCESS != rc) {
+                    break;
+                }
+                if (entry.last_event == ChangeDescriptor::EventTypeEnum::WRITE_FID) {
+                    continue;
+                }
+                bind_change_descriptor(stmt, entry);
+                rc = step_and_reset(db, stmt);
+            }
         }
 
-        sqlite3_finalize(stmt);
+        if (lustre_irods::SUCCESS != rc) {
+            break;
+        }
     }
 
+    if (lustre_irods::SUCCESS == rc && SQLITE_OK != sqlite3_exec(db, "commit", NULL, NULL, NULL)) {
+        LOG(LOG_ERR, "ERROR committing change_map serialization transaction: %s\n", sqlite3_errmsg(db));
+        rc = lustre_irods::SQLITE_DB_ERROR;
+    }
+
+    if (lustre_irods::SUCCESS != rc) {
+        sqlite3_exec(db, "rollback", NULL, NULL, NULL);
+    }
+
+    sqlite3_finalize(stmt);
     sqlite3_close(db);
 
-    return lustre_irods::SUCCESS;
+    return rc;
 }
 
-static int query_callback_change_map(void *change_map_void_ptr, int argc, char** argv, char** columnNames) {
+static int query_callback_change_map(void *change_table_void_ptr, int argc, char** argv, char** columnNames) {
 
-    if (nullptr == change_map_void_ptr) {
-        LOG(LOG_ERR, "Invalid nullptr sent to change_map in %s\n", __FUNCTION__);
+    if (nullptr == change_table_void_ptr) {
+        LOG(LOG_ERR, "Invalid nullptr sent to change_table in %s\n", __FUNCTION__);
     }
 
     if (10 != argc) {
@@ -860,24 +1470,26 @@ static int query_callback_change_map(void *change_map_void_ptr, int argc, char**
         return  lustre_irods::SQLITE_DB_ERROR;
     }
 
-    change_map_t *change_map = static_cast<change_map_t*>(change_map_void_ptr);
+    change_table_t *change_table = static_cast<change_table_t*>(change_table_void_ptr);
 
     change_descriptor entry{};
-    entry.fidstr = argv[0];
-    entry.parent_fidstr = argv[1];
+    if (!fidstr_to_fid(argv[0], entry.fid) || !fidstr_to_fid(argv[1], entry.parent_fid)) {
+        LOG(LOG_ERR, "Could not parse fidstr returned from change_map query in database.\n");
+        return  lustre_irods::SQLITE_DB_ERROR;
+    }
     entry.object_name = argv[2];
     entry.object_type = str_to_object_type(argv[3]);
     entry.lustre_path = argv[4]; 
 
     int oper_complete;
-    int timestamp;
-    int file_size;
+    time_t timestamp;
+    int64_t file_size;
     unsigned long long cr_index;
 
     try {
         oper_complete = boost::lexical_cast<int>(argv[5]);
         timestamp = boost::lexical_cast<time_t>(argv[6]);
-        file_size = boost::lexical_cast<off_t>(argv[8]);
+        file_size = boost::lexical_cast<int64_t>(argv[8]);
         cr_index = boost::lexical_cast<unsigned long long>(argv[9]);
     } catch( boost::bad_lexical_cast const& ) {
         LOG(LOG_ERR, "Could not convert the string to int returned from change_map query in database.\n");
@@ -890,8 +1502,21 @@ static int query_callback_change_map(void *change_map_void_ptr, int argc, char**
     entry.file_size = file_size;
     entry.cr_index = cr_index;
 
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-    change_map->insert(entry);
+    change_table_partition& partition = *change_table->partitions[change_table->partition_for(entry.fid)];
+    std::lock_guard<std::mutex> lock(partition.mutex);
+
+    // The rows come newest first.  An older row for a fid that is already in the table was in
+    // flight when the connector stopped, so it is merged into the newer entry the same way as if
+    // iRODS had failed it.  The fid is journaled again so the merged row replaces both.
+    auto &change_map_fid = partition.change_map.get<change_descriptor_fid_idx>();
+    if (change_map_fid.end() == change_map_fid.find(entry.fid)) {
+        partition.change_map.insert(entry);
+    } else {
+        fid_key fid = entry.fid;
+        merge_failed_entry(partition.change_map, std::move(entry));
+        std::lock_guard<std::mutex> journal_lock(change_table->journal.mutex);
+        change_table->journal.unjournaled_fids.push_back(fid);
+    }
 
     return lustre_irods::SUCCESS;
 }
@@ -937,24 +1562,32 @@ int write_cr_index_to_sqlite(unsigned long long cr_index, const std::string& db_
 
     if (rc) {
         LOG(LOG_ERR, "Can't open %s for serialization.\n", serialize_file.c_str());
+        sqlite3_close(db);
         return lustre_irods::SQLITE_DB_ERROR;
     }
 
 
     sqlite3_stmt *stmt;     
-    sqlite3_prepare_v2(db, "insert into last_cr_index (cr_index) values (?1);", -1, &stmt, NULL);       
-    sqlite3_bind_int(stmt, 1, cr_index); 
+    if (SQLITE_OK != sqlite3_prepare_v2(db, "insert into last_cr_index (cr_index) values (?1);", -1, &stmt, NULL)) {
+        LOG(LOG_ERR, "ERROR preparing last_cr_index insert: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return lustre_irods::SQLITE_DB_ERROR;
+    }
+    sqlite3_bind_int64(stmt, 1, cr_index); 
 
     rc = sqlite3_step(stmt); 
 
+    // the journal may already have written this cr_index
+    int result = lustre_irods::SUCCESS;
     if (SQLITE_DONE != rc && SQLITE_CONSTRAINT != rc) {
         LOG(LOG_ERR, "ERROR inserting data: %s\n", sqlite3_errmsg(db));
+        result = lustre_irods::SQLITE_DB_ERROR;
     }
 
     sqlite3_finalize(stmt);
     sqlite3_close(db);
 
-    return lustre_irods::SUCCESS;
+    return result;
 }
 
 
@@ -986,7 +1619,10 @@ int get_cr_index(unsigned long long& cr_index, const std::string& db_file) {
 }
 
 
-int deserialize_change_map_from_sqlite(change_map_t& change_map, const std::string& db_file) {
+// Loads the change table on startup.  This is the journal replay - sqlite applies any WAL
+// frames left over from a crash when the database is opened and every row is an entry that
+// iRODS had not yet acknowledged.
+int deserialize_change_map_from_sqlite(change_table_t& change_table, const std::string& db_file) {
 
     sqlite3 *db;
     char *zErrMsg = 0;
@@ -1001,7 +1637,7 @@ int deserialize_change_map_from_sqlite(change_map_t& change_map, const std::stri
     }
 
     rc = sqlite3_exec(db, "select fidstr, parent_fidstr, object_name, object_type, lustre_path, oper_complete, "
-                          "timestamp, last_event, file_size, cr_index from change_map", query_callback_change_map, &change_map, &zErrMsg);
+                          "timestamp, last_event, file_size, cr_index from change_map order by cr_index desc", query_callback_change_map, &change_table, &zErrMsg);
 
     if (rc) {
         LOG(LOG_ERR, "Error querying change_map from db during de-serialization: %s\n", zErrMsg);
@@ -1009,20 +1645,32 @@ int deserialize_change_map_from_sqlite(change_map_t& change_map, const std::stri
         return lustre_irods::SQLITE_DB_ERROR;
     }
 
-    // delete contents of table using sqlite truncate optimizer
-    rc = sqlite3_exec(db, "delete from change_map", NULL, NULL, &zErrMsg);
-    
-    if (rc) {
-        LOG(LOG_ERR, "Error clearing out change_map from db during de-serialization: %s\n", zErrMsg);
-        sqlite3_close(db);
-        return lustre_irods::SQLITE_DB_ERROR;
-    }
+    // the rows are left in place as they are the journal for the entries that were just loaded.
+    // the rows of merged entries are replaced when their fids are journaled again.
 
     sqlite3_close(db);
 
     return lustre_irods::SUCCESS;
 }
 
+// Returns true if the change_map table exists with only fidstr as its primary key.
+static bool change_map_keyed_on_fidstr(sqlite3 *db) {
+
+    sqlite3_stmt *stmt;
+    if (SQLITE_OK != sqlite3_prepare_v2(db, "select sql from sqlite_master where type = 'table' and name = 'change_map';", -1, &stmt, NULL)) {
+        return false;
+    }
+
+    bool keyed_on_fidstr = false;
+    if (SQLITE_ROW == sqlite3_step(stmt)) {
+        const char *sql = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        keyed_on_fidstr = nullptr != sql && nullptr == strstr(sql, "primary key (fidstr, cr_index)");
+    }
+
+    sqlite3_finalize(stmt);
+    return keyed_on_fidstr;
+}
+
 int initiate_change_map_serialization_database(const std::string& db_file) {
 
     sqlite3 *db;
@@ -1030,7 +1678,7 @@ int initiate_change_map_serialization_database(const std::string& db_file) {
     int rc;
 
     const char *create_table_str = "create table if not exists change_map ("
-       "fidstr char(256) primary key, "
+       "fidstr char(256), "
        "cr_index integer, "
        "parent_fidstr char(256), "
        "object_name char(256), "
@@ -1039,7 +1687,8 @@ int initiate_change_map_serialization_database(const std::string& db_file) {
        "timestamp integer, "
        "oper_complete integer, "
        "object_type char(256), "
-       "file_size integer)";
+       "file_size integer, "
+       "primary key (fidstr, cr_index))";
 
     // note:  storing cr_index as string because integer in sqlite is max of signed 64 bits
     const char *create_last_cr_index_table = "create table if not exists last_cr_index ("
@@ -1053,6 +1702,27 @@ int initiate_change_map_serialization_database(const std::string& db_file) {
         return lustre_irods::SQLITE_DB_ERROR;
     }
 
+    // databases from before the journal kept a row per (fidstr, cr_index) have one row per fid.
+    // copy those rows into a table with the new key.
+    if (change_map_keyed_on_fidstr(db)) {
+        LOG(LOG_INFO, "converting change_map in %s to be keyed on fidstr and cr_index\n", serialize_file.c_str());
+        std::string convert_str = std::string("begin transaction; "
+                "alter table change_map rename to change_map_by_fidstr; ") + create_table_str + "; "
+                "insert into change_map (fidstr, cr_index, parent_fidstr, object_name, lustre_path, last_event, timestamp, "
+                "oper_complete, object_type, file_size) select fidstr, cr_index, parent_fidstr, object_name, lustre_path, "
+                "last_event, timestamp, oper_complete, object_type, file_size from change_map_by_fidstr; "
+                "drop table change_map_by_fidstr; "
+                "commit;";
+        rc = sqlite3_exec(db, convert_str.c_str(), NULL, NULL, &zErrMsg);
+        if (rc) {
+            LOG(LOG_ERR, "Error converting change_map table: %s\n", zErrMsg);
+            sqlite3_free(zErrMsg);
+            sqlite3_exec(db, "rollback", NULL, NULL, NULL);
+            sqlite3_close(db);
+            return lustre_irods::SQLITE_DB_ERROR;
+        }
+    }
+
     rc = sqlite3_exec(db, create_table_str,  NULL, NULL, &zErrMsg);
     
     if (rc) {
@@ -1075,13 +1745,4 @@ int initiate_change_map_serialization_database(const std::string& db_file) {
     return lustre_irods::SUCCESS;
 }
 
-void add_entries_back_to_change_table(change_map_t& change_map, std::shared_ptr<change_map_t>& removed_entries) {
-
-    std::lock_guard<std::mutex> lock(change_table_mutex);
-
-    auto &change_map_seq = removed_entries->get<0>(); 
-    for (auto iter = change_map_seq.begin(); iter != change_map_seq.end(); ++iter) {
-        change_map.insert(*iter);
-    }
-}
 
@@ -4,24 +4,36 @@
 #include "inout_structs.h"
 
 #include "config.hpp"
+#include "lustre_fid.hpp"
+#include "spsc_queue.hpp"
+#include "batch_ack.hpp"
 #include <string>
 #include <ctime>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/composite_key.hpp>
 #include <boost/filesystem.hpp>
 
 #include "change_table.capnp.h"
 
+struct sqlite3;
+struct sqlite3_stmt;
+
 
 struct change_descriptor {
     unsigned long long            cr_index;
-    std::string                   fidstr;
-    std::string                   parent_fidstr;
+    fid_key                       fid;
+    fid_key                       parent_fid;
     std::string                   object_name;
     std::string                   lustre_path;     // the lustre_path can be ascertained by the parent_fid and object_name
                                                    // however, if a parent is moved after calculating the lustre_path, we 
@@ -31,11 +43,14 @@ struct change_descriptor {
     bool                          oper_complete;
     ChangeDescriptor::ObjectTypeEnum object_type;
     off_t                         file_size;
+    unsigned int                  attempt_count;   // times iRODS has failed to apply this entry
+    time_t                        retry_after;     // the entry is not sent again before this time
 };
 
 struct change_descriptor_seq_idx {};
-struct change_descriptor_fidstr_idx {};
-struct change_descriptor_oper_complete_idx {};
+struct change_descriptor_fid_idx {};
+struct change_descriptor_ready_idx {};
+struct change_descriptor_parent_idx {};
 
 typedef boost::multi_index::multi_index_container<
   change_descriptor,
@@ -47,62 +62,206 @@ typedef boost::multi_index::multi_index_container<
       >
     >,
     boost::multi_index::hashed_unique<
-      boost::multi_index::tag<change_descriptor_fidstr_idx>,
+      boost::multi_index::tag<change_descriptor_fid_idx>,
       boost::multi_index::member<
-        change_descriptor, std::string, &change_descriptor::fidstr
+        change_descriptor, fid_key, &change_descriptor::fid
+      >,
+      fid_key_hash
+    >,
+    // entries ordered by (oper_complete, cr_index) so that all of the entries that are ready
+    // to be sent are grouped at the end of the index in changelog order
+    boost::multi_index::ordered_unique<
+      boost::multi_index::tag<change_descriptor_ready_idx>,
+      boost::multi_index::composite_key<
+        change_descriptor,
+        boost::multi_index::member<
+          change_descriptor, bool, &change_descriptor::oper_complete
+        >,
+        boost::multi_index::member<
+          change_descriptor, unsigned long long, &change_descriptor::cr_index
+        >
       >
     >,
+    // entries by the directory they are in so an RMDIR can find the changes underneath it
     boost::multi_index::hashed_non_unique<
-      boost::multi_index::tag<change_descriptor_oper_complete_idx>,
+      boost::multi_index::tag<change_descriptor_parent_idx>,
       boost::multi_index::member<
-        change_descriptor, bool, &change_descriptor::oper_complete
-      >
+        change_descriptor, fid_key, &change_descriptor::parent_fid
+      >,
+      fid_key_hash
     >
 
   >
 > change_map_t;
 
+// One shard of the change table.  An entry lives in the partition picked by its fid so that every
+// change to a fid is merged in one place.  Each partition has its own lock and its own batches in
+// flight so that the changelog owner, the dispatcher, and the accumulator only contend when they
+// are working on the same partition.
+struct change_table_partition {
+    std::mutex mutex;
+    change_map_t change_map;
+
+    // Entries that have been written into a batch and sent to the updaters, keyed by batch id.
+    // These are held here until the accumulator gets the batch acknowledgement so that the
+    // updaters only have to send back a batch id and status.
+    std::unordered_map<uint64_t, std::vector<change_descriptor> > inflight_batches;
+
+    // cr_index of the entry in inflight_batches for each fid.  The journal row for that entry is
+    // kept until the batch is acknowledged even if a newer entry for the fid is in the table.
+    std::unordered_map<fid_key, unsigned long long, fid_key_hash> inflight_cr_index;
+};
+
+// Fids in batches that have not been acknowledged yet.  A fid in this list (or, for entries that
+// create or move something, its parent) is not sent again until the batch holding it has been
+// acknowledged.  Fids are unique across MDTs so one list is shared by the change tables of all
+// of the MDTs, which keeps a change on one MDT from overtaking the parent directory it depends on
+// from another.
+struct active_fid_set {
+    std::mutex mutex;
+    fid_set_t fids;
+
+    // the parent fids of the entries in fids, once for each entry, so that an RMDIR can wait for
+    // the changes underneath it
+    std::unordered_multiset<fid_key, fid_key_hash> parent_fids;
+};
+
+// The sqlite journal for one change table.  See lustre_change_table.cpp.
+struct change_map_journal {
+    change_map_journal() : db(nullptr), upsert_stmt(nullptr), delete_superseded_stmt(nullptr), delete_acked_stmt(nullptr),
+        cr_index_stmt(nullptr), trim_cr_index_stmt(nullptr), journaled_cr_index(0) {}
+
+    std::mutex mutex;
+    sqlite3 *db;
+    sqlite3_stmt *upsert_stmt;
+    sqlite3_stmt *delete_superseded_stmt;
+    sqlite3_stmt *delete_acked_stmt;
+    sqlite3_stmt *cr_index_stmt;
+    sqlite3_stmt *trim_cr_index_stmt;
+
+    // highest cr_index whose effects are durable in the journal
+    std::atomic<unsigned long long> journaled_cr_index;
+
+    // fids changed by a batch whose journal write failed.  They are written with the next batch
+    // and journaled_cr_index does not move until that succeeds.
+    std::vector<fid_key> unjournaled_fids;
+
+    // (fid, cr_index) of acknowledged entries whose rows could not be deleted.  They are deleted
+    // along with the next batch that is journaled or acknowledged.
+    std::vector<std::pair<fid_key, unsigned long long> > undeleted_acks;
+};
+
+// batch ids carry the index of the MDT the batch came from in their upper bits
+const unsigned int BATCH_ID_MDT_SHIFT = 48;
+
+inline size_t mdt_index_from_batch_id(uint64_t batch_id) {
+    return static_cast<size_t>(batch_id >> BATCH_ID_MDT_SHIFT);
+}
+
+// The change table for one MDT.  cr_index values are only unique within an MDT so each MDT has
+// its own table and journal.
+struct change_table_t {
+    change_table_t(size_t partition_count, unsigned int mdt_index, active_fid_set& active_fids)
+            : mdt_index(mdt_index), active_fids(active_fids), next_batch_sequence(1) {
+        if (0 == partition_count) {
+            partition_count = 1;
+        }
+        for (size_t i = 0; i < partition_count; ++i) {
+            partitions.emplace_back(new change_table_partition());
+        }
+    }
+
+    size_t partition_count() const {
+        return partitions.size();
+    }
+
+    size_t partition_for(const fid_key& fid) const {
+        return fid_key_hash()(fid) % partitions.size();
+    }
+
+    // Returns the partition a batch id from this table was built from.
+    size_t partition_from_batch_id(uint64_t batch_id) const {
+        return (batch_id & ((1ULL << BATCH_ID_MDT_SHIFT) - 1)) % partitions.size();
+    }
+
+    unsigned int mdt_index;
+    std::vector<std::unique_ptr<change_table_partition> > partitions;
+    active_fid_set& active_fids;
+    change_map_journal journal;
+
+    // the lower bits of a batch id are (sequence * partition_count + partition) so an ack leads
+    // back to its partition
+    std::atomic<uint64_t> next_batch_sequence;
+};
+
+typedef int (*lustre_operation_t)(unsigned long long, const std::string&, const fid_key&, const fid_key&,
+                                  const std::string&, const std::string&, change_map_t&);
+
+// A changelog record that has been decoded by the changelog reader (fids resolved to paths, etc.)
+// and is waiting to be applied to the change table.
+struct change_record {
+    unsigned long long            cr_index;
+    lustre_operation_t            operation;          // not used for renames, nullptr for a cr_index watermark only
+    bool                          is_rename;
+    fid_key                       fid;
+    fid_key                       parent_fid;
+    fid_key                       overwritten_fid;    // rename only
+    std::string                   object_name;
+    std::string                   lustre_path;
+    std::string                   old_lustre_path;    // rename only
+};
+
+// The changelog reader is the only producer and the change table owner thread is the only consumer.
+typedef spsc_queue<change_record> change_record_queue_t;
+
+// Applies a batch of decoded records to the change table in order while holding the partition
+// locks once for the whole batch.
+int apply_change_records(const std::string& lustre_root_path, std::vector<change_record>& records, change_table_t& change_table);
 
 // This is only to faciliate writing the fidstr to the root directory 
-int lustre_write_fidstr_to_root_dir(const std::string& lustre_root_path, const std::string& fidstr, change_map_t& change_map);
+int lustre_write_fidstr_to_root_dir(const std::string& lustre_root_path, const fid_key& fid, change_table_t& change_table);
 
-int lustre_close(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+// The following handlers work on the partition that holds fid and expect the caller to hold its
+// lock.  They are called through apply_change_records.
+int lustre_close(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, change_map_t& change_map);
-int lustre_mkdir(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_mkdir(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, change_map_t& change_map);
-int lustre_rmdir(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_rmdir(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, change_map_t& change_map);
-int lustre_unlink(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_unlink(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, change_map_t& change_map);
-int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_rename(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, const std::string& old_lustre_path, 
                      change_map_t& change_map);
-int lustre_create(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_create(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, change_map_t& change_map);
-int lustre_mtime(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_mtime(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, change_map_t& change_map);
-int lustre_trunc(unsigned long long cr_index, const std::string& lustre_root_path, const std::string& fidstr, const std::string& parent_fidstr,
+int lustre_trunc(unsigned long long cr_index, const std::string& lustre_root_path, const fid_key& fid, const fid_key& parent_fid,
                      const std::string& object_name, const std::string& lustre_path, change_map_t& change_map);
 
 
-int remove_fidstr_from_table(const std::string& fidstr, change_map_t& change_map);
+int remove_fid_from_table(const fid_key& fid, change_table_t& change_table);
 
-size_t get_change_table_size(change_map_t& change_map);
+size_t get_change_table_size(change_table_t& change_table);
 
-void lustre_print_change_table(const change_map_t& change_map);
-bool entries_ready_to_process(change_map_t& change_map);
-int serialize_change_map_to_sqlite(change_map_t& change_map, const std::string& db_file);
-int deserialize_change_map_from_sqlite(change_map_t& change_map, const std::string& db_file);
+void lustre_print_change_table(change_table_t& change_table);
+bool entries_ready_to_process(change_table_t& change_table, size_t partition);
+int serialize_change_map_to_sqlite(change_table_t& change_table, const std::string& db_file);
+int deserialize_change_map_from_sqlite(change_table_t& change_table, const std::string& db_file);
 int initiate_change_map_serialization_database(const std::string& db_file);
-int set_update_status_in_capnproto_buf(unsigned char*& buf, size_t& buflen, const std::string& new_status);
-int get_update_status_from_capnproto_buf(unsigned char* buf, size_t buflen, std::string& update_status);
-void add_entries_back_to_change_table(change_map_t& change_map, std::shared_ptr<change_map_t>& removed_entries);
-int add_capnproto_buffer_back_to_change_table(unsigned char* buf, size_t buflen, change_map_t& change_map, std::set<std::string>& current_active_fidstr_list);
-void remove_fidstr_from_active_list(unsigned char* buf, size_t buflen, std::set<std::string>& current_active_fidstr_list);
-int write_change_table_to_capnproto_buf(const lustre_irods_connector_cfg_t *config_struct_ptr, void*& buf, size_t& buflen,
-                                          change_map_t& change_map, std::set<std::string>& current_active_fidstr_list); 
+int open_change_map_journal(change_table_t& change_table, const std::string& db_file);
+void close_change_map_journal(change_table_t& change_table);
+unsigned long long get_journaled_cr_index(change_table_t& change_table);
+int get_batch_info_from_capnproto_buf(const unsigned char *buf, size_t buflen, uint64_t& batch_id, uint32_t& entry_count);
+int process_batch_ack(const batch_ack_header& ack, const unsigned char *failure_bitmap, change_table_t& change_table);
+int write_change_table_to_capnproto_buf(const lustre_irods_connector_cfg_t *config_struct_ptr, kj::Array<capnp::word>& flat_message,
+                                          change_table_t& change_table, size_t partition); 
 int get_cr_index(unsigned long long& cr_index, const std::string& db_file);
 int write_cr_index_to_sqlite(unsigned long long cr_index, const std::string& db_file);
+std::string event_type_to_str(ChangeDescriptor::EventTypeEnum type);
+std::string object_type_to_str(ChangeDescriptor::ObjectTypeEnum type);
 
 
 #endif
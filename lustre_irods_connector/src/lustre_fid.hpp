@@ -0,0 +1,70 @@
+#ifndef LUSTRE_FID_HPP
+#define LUSTRE_FID_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cinttypes>
+#include <string>
+#include <unordered_set>
+
+// Binary form of a Lustre FID (sequence/object id/version).  This is used as the key into the
+// change table so that records do not have to be formatted into fidstr strings until they are
+// written to capnproto, sqlite, or passed to llapi.
+struct fid_key {
+    uint64_t seq;
+    uint32_t oid;
+    uint32_t ver;
+};
+
+// Longest rendering of a fid - "0x" + 16 + ":0x" + 8 + ":0x" + 8 plus the terminator.
+const size_t FIDSTR_BUFFER_SIZE = 40;
+
+inline bool operator==(const fid_key& lhs, const fid_key& rhs) {
+    return lhs.seq == rhs.seq && lhs.oid == rhs.oid && lhs.ver == rhs.ver;
+}
+
+inline bool operator!=(const fid_key& lhs, const fid_key& rhs) {
+    return !(lhs == rhs);
+}
+
+inline bool fid_is_zero(const fid_key& fid) {
+    return fid.seq == 0 && fid.oid == 0;
+}
+
+struct fid_key_hash {
+    size_t operator()(const fid_key& fid) const {
+        uint64_t h = fid.seq * 0x9e3779b97f4a7c15ULL;
+        h ^= ((static_cast<uint64_t>(fid.oid) << 32) | fid.ver) + 0x7f4a7c159e3779b9ULL + (h << 6) + (h >> 2);
+        return static_cast<size_t>(h);
+    }
+};
+
+typedef std::unordered_set<fid_key, fid_key_hash> fid_set_t;
+
+// Writes the fid in the same format that lfs path2fid uses (without the brackets) into buf.
+// A zero fid, used for entries that have no parent, is written as "0:0x0:0x0".
+inline void fid_to_fidstr(const fid_key& fid, char *buf, size_t buflen) {
+    snprintf(buf, buflen, "%#" PRIx64 ":0x%" PRIx32 ":0x%" PRIx32, fid.seq, fid.oid, fid.ver);
+}
+
+inline std::string fid_to_fidstr(const fid_key& fid) {
+    char buf[FIDSTR_BUFFER_SIZE];
+    fid_to_fidstr(fid, buf, sizeof(buf));
+    return std::string(buf);
+}
+
+// Parses a fidstr (with or without the surrounding brackets) into fid.  An empty string
+// results in a zero fid.  Returns false if the string could not be parsed.
+inline bool fidstr_to_fid(const std::string& fidstr, fid_key& fid) {
+    fid = fid_key{};
+    if (fidstr.empty()) {
+        return true;
+    }
+    const char *start = fidstr.c_str();
+    if ('[' == *start) {
+        ++start;
+    }
+    return 3 == sscanf(start, "%" SCNx64 ":%" SCNx32 ":%" SCNx32, &fid.seq, &fid.oid, &fid.ver);
+}
+
+#endif
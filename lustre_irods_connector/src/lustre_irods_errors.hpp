@@ -19,6 +19,7 @@ const int QUIT = -12;
 const int COLLISION_IN_FIDSTR = -13;
 const int CHANGELOG_START_ERROR = -14;
 const int SKIP_RECORD = -15;
+const int CHANGELOG_CLEAR_ERROR = -16;
 }
 
 #endif
@@ -17,6 +17,11 @@
 #include <iostream>
 #include <sysexits.h>
 #include <utility>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <memory>
 
 // local libraries
 #include "irods_ops.hpp"
@@ -44,17 +49,85 @@ extern "C" {
   #include "llapi_cpp_wrapper.h"
 }
 
-static std::mutex inflight_messages_mutex;
-unsigned int number_inflight_messages = 0;
+// batches sent to the updaters that the accumulator has not seen an acknowledgement for yet
+std::atomic<unsigned int> number_inflight_messages(0);
 
 namespace po = boost::program_options;
 
 std::atomic<bool> keep_running(true);
 
+// set to false once the changelog readers have stopped so the change table owners can drain and exit
+std::atomic<bool> change_table_owner_running(true);
+
+// set while every updater has lost its iRODS connection so the changelog readers stop reading
+std::atomic<bool> pause_reading(false);
+
+// Used to wake a thread before its poll interval is up when there is new work for it.  The waiter
+// remembers the last generation it saw so a wake that comes before it starts waiting is not lost.
+struct thread_wakeup {
+    std::mutex mutex;
+    std::condition_variable cv;
+    unsigned long long generation = 0;
+
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++generation;
+        }
+        cv.notify_all();
+    }
+
+    // Sleep for up to period or until wake() is called.
+    void wait_for(std::chrono::milliseconds period, unsigned long long& seen_generation) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait_for(lock, period, [this, &seen_generation]{ return generation != seen_generation; });
+        seen_generation = generation;
+    }
+};
+
+// The dispatcher is woken when entries are added to a change table or a batch is acknowledged.
+static thread_wakeup dispatcher_wakeup;
+
+// Everything that is kept for each MDT.  Only the updaters, the accumulator, and the dispatcher
+// are shared between MDTs.
+struct mdt_context {
+    mdt_context(unsigned int mdt_index, const mdt_cfg_t& mdt, const lustre_irods_connector_cfg_t& config_struct,
+            active_fid_set& active_fids, directory_caches& dir_caches)
+        : mdt(mdt)
+        , change_table(config_struct.change_table_partition_count, mdt_index, active_fids)
+        , record_queue(config_struct.changelog_record_queue_size)
+        , reader_ctx(nullptr)
+        , clear_state{}
+        , last_cr_index(0)
+        , dir_caches(dir_caches)
+        , reader_waiting_for_room(false) {}
+
+    mdt_cfg_t mdt;
+    change_table_t change_table;
+    change_record_queue_t record_queue;
+    cl_ctx_ptr reader_ctx;
+    changelog_clear_state clear_state;
+    unsigned long long last_cr_index;
+    directory_caches& dir_caches;
+
+    // The changelog reader is only woken early when it stopped reading because its change table
+    // and record queue held maximum_records_to_receive_from_lustre_changelog records and the
+    // dispatcher has since sent some of them.
+    thread_wakeup reader_wakeup;
+    std::atomic<bool> reader_waiting_for_room;
+};
+
+typedef std::vector<std::unique_ptr<mdt_context> > mdt_context_list_t;
+
 void interrupt_handler(int dummy) {
     keep_running.store(false);
 }
 
+// zmq deallocation callback for messages built directly on a kj array from write_change_table_to_capnproto_buf
+static void free_flat_message(void *data, void *hint) {
+    delete static_cast<kj::Array<capnp::word>*>(hint);
+}
+
 //  Sends string as 0MQ string, as multipart non-terminal 
 static bool s_sendmore (zmq::socket_t& socket, const std::string& string) {
 
@@ -178,21 +251,79 @@ int read_and_process_command_line_options(int argc, char *argv[], std::string& c
 
 }
 
-// this is the main changelog reader loop.  It reads changelogs, writes the records to an internal data structure, 
-// and sends groups of changelog records to client updater threads.
-void run_main_changelog_reader_loop(const lustre_irods_connector_cfg_t& config_struct, change_map_t& change_map, 
-        cl_ctx_ptr* ctx, zmq::socket_t& publisher, zmq::socket_t& subscriber, zmq::socket_t& sender,
-        std::set<std::string>& active_fidstr_list, unsigned long long& last_cr_index) {
+// Changelog reader thread for one MDT.  It reads the changelog and queues the decoded records for
+// the change table owner of the MDT.
+void changelog_reader_main(const lustre_irods_connector_cfg_t *config_struct_ptr, mdt_context *mdt) {
+
+    const lustre_irods_connector_cfg_t& config_struct = *config_struct_ptr;
+
+    // The poll interval adapts to the load.  When a poll fills its batch the next poll happens right
+    // away.  When nothing is read the wait doubles from the minimum up to changelog_poll_interval_seconds.
+    const std::chrono::milliseconds max_sleep_period(config_struct.changelog_poll_interval_seconds * 1000);
+    const std::chrono::milliseconds min_sleep_period(std::min(static_cast<std::chrono::milliseconds::rep>(config_struct.changelog_poll_min_interval_msec),
+                max_sleep_period.count()));
+    std::chrono::milliseconds sleep_period = min_sleep_period;
+    bool batch_full = false;
+    unsigned int max_number_of_changelog_records = config_struct.maximum_records_to_receive_from_lustre_changelog;
+    unsigned long long wakeup_generation = 0;
+    cl_ctx_ptr *ctx = &mdt->reader_ctx;
+
+    // record types that are not consumed are dropped as soon as they are read
+    changelog_record_filter record_filter(config_struct.changelog_record_type_mask);
+
+    while (keep_running.load()) {
+
+        if (!pause_reading.load()) {
+            LOG(LOG_INFO,"changelog client polling changelog for %s\n", mdt->mdt.mdtname.c_str());
+            // records still sitting in the queue count against the maximum as well
+            size_t outstanding_records = get_change_table_size(mdt->change_table) + mdt->record_queue.size();
+            poll_change_log_and_process(mdt->mdt.mdtname, mdt->mdt.changelog_reader, config_struct.lustre_root_path, 
+                    config_struct.register_map_lookup, mdt->record_queue, mdt->change_table, mdt->dir_caches, record_filter, mdt->clear_state, ctx,
+                    config_struct.changelog_read_batch_size, max_number_of_changelog_records - outstanding_records, mdt->last_cr_index,
+                    batch_full);
+        } else {
+            LOG(LOG_DBG, "in a paused state.  not reading changelog for %s...\n", mdt->mdt.mdtname.c_str());
+        }
+
+        if (pause_reading.load()) {
+            sleep_period = max_sleep_period;
+        } else if (batch_full) {
+            // there are likely more records waiting so poll again immediately
+            sleep_period = min_sleep_period;
+            continue;
+        }
+
+        // ask the dispatcher to wake us once it makes room if there is none left
+        mdt->reader_waiting_for_room.store(get_change_table_size(mdt->change_table) + mdt->record_queue.size() >=
+                max_number_of_changelog_records);
+
+        LOG(LOG_DBG,"changelog client for %s sleeping for up to %lld msec\n", mdt->mdt.mdtname.c_str(),
+                static_cast<long long>(sleep_period.count()));
+        mdt->reader_wakeup.wait_for(sleep_period, wakeup_generation);
+
+        // back off while the changelog stays empty
+        sleep_period = std::min(sleep_period * 2, max_sleep_period);
+    }
+
+    log_dropped_record_counts(mdt->mdt.mdtname, record_filter);
+    LOG(LOG_DBG, "changelog reader for %s exiting\n", mdt->mdt.mdtname.c_str());
+}
+
+// this is the main dispatch loop.  It watches for pause/continue messages from the updaters and
+// sends groups of changelog records from the change tables of all of the MDTs to client updater threads.
+void run_main_dispatch_loop(const lustre_irods_connector_cfg_t& config_struct, mdt_context_list_t& mdt_list,
+        zmq::socket_t& subscriber, zmq::socket_t& sender) {
     
     // create a vector holding the status of the client's connection to irods - true is up, false is down
     std::vector<bool> irods_api_client_connection_status(config_struct.irods_updater_thread_count, true);   
     unsigned int failed_connections_to_irods_count = 0;
 
-    unsigned int number_inflight_messages_limit = config_struct.irods_updater_thread_count * 2;
+    // each updater can have irods_updater_pipeline_depth batches outstanding plus one waiting
+    unsigned int number_inflight_messages_limit = config_struct.irods_updater_thread_count *
+        (std::max(1u, config_struct.irods_updater_pipeline_depth) + 1);
 
-    bool pause_reading = false;
-    unsigned int sleep_period = config_struct.changelog_poll_interval_seconds;
-    unsigned int max_number_of_changelog_records = config_struct.maximum_records_to_receive_from_lustre_changelog;
+    const std::chrono::milliseconds max_sleep_period(config_struct.changelog_poll_interval_seconds * 1000);
+    unsigned long long wakeup_generation = 0;
 
     while (keep_running.load()) {
 
@@ -235,73 +366,118 @@ void run_main_changelog_reader_loop(const lustre_irods_connector_cfg_t& config_s
 
         // if all the status of the irods connection for all threads is down, pause reading changelog until
         // one comes up
-        pause_reading = (failed_connections_to_irods_count >= irods_api_client_connection_status.size()); 
+        pause_reading.store(failed_connections_to_irods_count >= irods_api_client_connection_status.size()); 
 
-        if (!pause_reading) {
-            LOG(LOG_INFO,"changelog client polling changelog\n");
-            poll_change_log_and_process(config_struct.mdtname, config_struct.changelog_reader, config_struct.lustre_root_path, 
-                    config_struct.register_map, change_map, ctx, max_number_of_changelog_records - change_map.size(), last_cr_index);
+        if (!pause_reading.load()) {
 
-            LOG(LOG_DBG, "change_map size: %lu\n", change_map.size());
+            // read log entries and put them on ZMQ queue.  The MDTs and their partitions take turns
+            // so that one busy change table does not use up all of the inflight messages.
+            bool dispatched = true;
+            bool inflight_limit_reached = false;
+            while (dispatched && !inflight_limit_reached) {
 
-            // read log entries and put them on ZMQ queue
-            while (entries_ready_to_process(change_map)) {
+                dispatched = false;
+                for (auto& mdt : mdt_list) {
 
-                // only allow number_inflight_messages_limit outstanding messages on ZMQ queue
-                {
-                    std::lock_guard<std::mutex> lock(inflight_messages_mutex);
-                    if (number_inflight_messages > number_inflight_messages_limit) { 
-                        break;
-                    }
-                    number_inflight_messages++;
-                }
+                    change_table_t& change_table = mdt->change_table;
+                    for (size_t partition = 0; partition < change_table.partition_count() && !inflight_limit_reached; ++partition) {
 
-                LOG(LOG_DBG, "number of inflight messages on ZMQ queue: %d\n", number_inflight_messages);
+                        if (!entries_ready_to_process(change_table, partition)) {
+                            continue;
+                        }
 
-                // get records ready to be processed into buf and buflen
-                void *buf = nullptr;
-                size_t buflen;
-                int rc = write_change_table_to_capnproto_buf(&config_struct, buf, buflen,
-                        change_map, active_fidstr_list);
+                        // only allow number_inflight_messages_limit outstanding messages on ZMQ queue.
+                        // Only this thread adds to the count so the check and increment do not race.
+                        if (number_inflight_messages.load() > number_inflight_messages_limit) { 
+                            inflight_limit_reached = true;
+                            break;
+                        }
+                        number_inflight_messages++;
 
-                if (rc == lustre_irods::COLLISION_IN_FIDSTR) {
-                    LOG(LOG_INFO, "----- Collision!  Breaking out -----\n");
-                }
+                        LOG(LOG_DBG, "number of inflight messages on ZMQ queue: %u\n", number_inflight_messages.load());
 
-                // if we get a failure or we get a return code indicating that we must
-                // wait on the completion of one fid to complete before continuing, 
-                // then break out of this loop
-                if (rc != lustre_irods::SUCCESS) {
-                    free(buf);
-                    break;
-                }
+                        // get records ready to be processed into a flat capnproto array
+                        kj::Array<capnp::word> *flat_message = new kj::Array<capnp::word>();
+                        int rc = write_change_table_to_capnproto_buf(&config_struct, *flat_message,
+                                change_table, partition);
 
-                // send inp to irods updaters
-                LOG(LOG_DBG,"sending to readers\n");
-                zmq::message_t message(buflen);
-                memcpy(message.data(), buf, buflen);
-                sender.send(message);
+                        if (rc == lustre_irods::COLLISION_IN_FIDSTR) {
+                            LOG(LOG_INFO, "----- Collision in %s partition %lu!  Moving on -----\n", mdt->mdt.mdtname.c_str(), partition);
+                        }
 
-                free(buf);
+                        // if we get a failure or we get a return code indicating that we must
+                        // wait on the completion of one fid to complete before continuing, 
+                        // then move on to the next partition
+                        if (rc != lustre_irods::SUCCESS) {
+                            delete flat_message;
+                            number_inflight_messages--;
+                            continue;
+                        }
 
+                        // send inp to irods updaters.  zmq takes ownership of the array and frees it once sent.
+                        LOG(LOG_DBG,"sending to readers\n");
+                        zmq::message_t message(flat_message->begin(), flat_message->size() * sizeof(capnp::word),
+                                free_flat_message, flat_message);
+                        sender.send(message);
+                        dispatched = true;
+
+                        // the entries just sent left room in the change table
+                        if (mdt->reader_waiting_for_room.exchange(false)) {
+                            mdt->reader_wakeup.wake();
+                        }
+                    }
+                }
             }
 
         } else {
-            LOG(LOG_DBG, "in a paused state.  not reading changelog...\n");
+            LOG(LOG_DBG, "in a paused state.  not dispatching...\n");
         }
 
-        LOG(LOG_DBG,"changelog client sleeping for %d seconds\n", sleep_period);
-        sleep(sleep_period);
+        // the change table owners and the accumulator wake us when there may be something to send
+        dispatcher_wakeup.wait_for(max_sleep_period, wakeup_generation);
     }
 }
 
 
+// thread which owns updates to the change table from the changelog.  It drains the records decoded by
+// the changelog reader in batches so that the change table lock is taken once per batch rather than
+// once per record.
+void change_table_owner_main(const lustre_irods_connector_cfg_t *config_struct_ptr,
+        change_table_t* change_table, change_record_queue_t* record_queue) {
+
+    if (nullptr == change_table || nullptr == config_struct_ptr || nullptr == record_queue) {
+        LOG(LOG_ERR, "change table owner received a nullptr and is exiting.");
+        return;
+    }
+
+    std::vector<change_record> batch;
+    batch.reserve(record_queue->capacity());
+
+    // keep draining after the reader stops so that nothing is lost before serializing the table
+    while (change_table_owner_running.load() || !record_queue->empty()) {
+
+        batch.clear();
+        if (0 == record_queue->pop_batch(batch, record_queue->capacity())) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        LOG(LOG_DBG, "change table owner applying %lu records\n", batch.size());
+        apply_change_records(config_struct_ptr->lustre_root_path, batch, *change_table);
+
+        // the new entries may be ready to send
+        dispatcher_wakeup.wake();
+    }
+
+    LOG(LOG_DBG, "change table owner exiting\n");
+}
+
 // thread which reads the results from the irods updater threads and updates
 // the change table in memory
 void result_accumulator_main(const lustre_irods_connector_cfg_t *config_struct_ptr,
-        change_map_t* change_map, std::set<std::string>* active_fidstr_list) {
+        mdt_context_list_t* mdt_list) {
 
-    if (nullptr == change_map || nullptr == config_struct_ptr) {
+    if (nullptr == mdt_list || nullptr == config_struct_ptr) {
         LOG(LOG_ERR, "result accumulator received a nullptr and is exiting.");
         return;
     }
@@ -334,33 +510,27 @@ void result_accumulator_main(const lustre_irods_connector_cfg_t *config_struct_p
 
         if (bytes_received > 0) {
 
-            {
-                std::lock_guard<std::mutex> lock(inflight_messages_mutex);
-                number_inflight_messages--;
-            }
+            number_inflight_messages--;
 
-            LOG(LOG_DBG, "accumulator received message of size: %lu.\n", message.size());
-            unsigned char *buf = static_cast<unsigned char*>(message.data());
-            std::string update_status;
-            get_update_status_from_capnproto_buf(buf, message.size(), update_status);
-            LOG(LOG_INFO, "accumulator received update status of %s\n", update_status.c_str());
+            batch_ack_header ack;
+            const unsigned char *failure_bitmap = nullptr;
+            if (decode_batch_ack(static_cast<const unsigned char*>(message.data()), message.size(), ack, failure_bitmap)) {
+                LOG(LOG_INFO, "accumulator received status %u for batch %llu\n", ack.status, static_cast<unsigned long long>(ack.batch_id));
 
-            if (update_status == "FAIL") {
-                add_capnproto_buffer_back_to_change_table(buf, message.size(), *change_map, *active_fidstr_list);
+                // the batch id carries the index of the MDT whose change table the batch came from
+                size_t mdt_index = mdt_index_from_batch_id(ack.batch_id);
+                if (mdt_index < mdt_list->size()) {
+                    process_batch_ack(ack, failure_bitmap, (*mdt_list)[mdt_index]->change_table);
+                } else {
+                    LOG(LOG_ERR, "accumulator received an acknowledgement for unknown mdt index %lu\n", mdt_index);
+                }
             } else {
-                // remove all fidstr from active_fidstr_list 
-                remove_fidstr_from_active_list(buf, message.size(), *active_fidstr_list);
-            } 
-            /*char response_flag[5];
-            memcpy(response_flag, message.data(), 4);
-            response_flag[4] = '\0';
-            LOG(LOG_DBG, "response_flag is %s\n", response_flag);
-            unsigned char *tmp= static_cast<unsigned char*>(message.data());
-            unsigned char *response_buffer = tmp + 4;
-
-            if (0 == strcmp(response_flag, "FAIL")) {
-                add_capnproto_buffer_back_to_change_table(response_buffer, message.size() - 4, *change_map);
-            }*/
+                LOG(LOG_ERR, "accumulator received a malformed acknowledgement of size %lu\n", message.size());
+            }
+
+            // an inflight slot and possibly some fids were just freed up so let the dispatcher
+            // send any queued work now
+            dispatcher_wakeup.wake();
         } 
 
         if ("terminate" == receive_message(subscriber)) {
@@ -373,12 +543,62 @@ void result_accumulator_main(const lustre_irods_connector_cfg_t *config_struct_p
 
 }
 
+// Sends the result of one batch to the accumulator.  Only the entries iRODS reported as failed
+// are retried unless the whole batch failed.
+static void send_batch_ack(zmq::socket_t& sender, unsigned int thread_number, uint64_t batch_id,
+        batch_ack_status_t status, uint32_t entry_count, const std::vector<int>& failed_entries) {
+
+    std::vector<bool> failed_entry_flags(entry_count, false);
+    for (int index : failed_entries) {
+        if (index >= 0 && static_cast<uint32_t>(index) < entry_count) {
+            failed_entry_flags[index] = true;
+        }
+    }
+    if (failed_entries.size() > 0) {
+        LOG(LOG_INFO, "irods client (%u): %lu entries in batch %llu failed\n", thread_number, failed_entries.size(),
+                static_cast<unsigned long long>(batch_id));
+    }
+
+    std::vector<unsigned char> ack;
+    encode_batch_ack(batch_id, status, entry_count, failed_entry_flags, ack);
+    zmq::message_t response_message(ack.size());
+    memcpy(response_message.data(), ack.data(), ack.size());
+    sender.send(response_message);
+}
+
+// Reads the result of the oldest outstanding batch on conn and acknowledges it.  Returns
+// non-zero if the connection failed, in which case that batch has been failed back to the
+// accumulator but the rest of pending_batches has not.
+static int receive_oldest_batch_result(lustre_irods_connection& conn, zmq::socket_t& sender, unsigned int thread_number,
+        std::deque<std::pair<uint64_t, uint32_t> >& pending_batches) {
+
+    uint64_t batch_id = pending_batches.front().first;
+    uint32_t entry_count = pending_batches.front().second;
+    pending_batches.pop_front();
+
+    std::vector<int> failed_entries;
+    int rc = conn.receive_change_map_result(failed_entries);
+    if (rc < 0) {
+        send_batch_ack(sender, thread_number, batch_id, BATCH_ACK_FAIL, entry_count, std::vector<int>());
+
+        // any other error is the status of the batch itself and the connection is still good
+        if (lustre_irods::IRODS_ERROR == rc || lustre_irods::IRODS_CONNECTION_ERROR == rc) {
+            return rc;
+        }
+        LOG(LOG_ERR, "batch %llu failed with status %i\n", static_cast<unsigned long long>(batch_id), rc);
+        return 0;
+    }
+
+    send_batch_ack(sender, thread_number, batch_id, BATCH_ACK_PASS, entry_count, failed_entries);
+    return 0;
+}
+
 // irods api client thread main routine
 // this is the main loop that reads the change entries in memory and sends them to iRODS via the API.
 void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr,
-        change_map_t* change_map, unsigned int thread_number) {
+        unsigned int thread_number) {
 
-    if (nullptr == change_map || nullptr == config_struct_ptr) {
+    if (nullptr == config_struct_ptr) {
         LOG(LOG_ERR, "irods api client received a nullptr and is exiting.");
         return;
     }
@@ -411,22 +631,33 @@ void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr
     bool quit = false;
     bool irods_error_detected = false;
 
+    // long lived connection for this thread - connected on first use and replaced only when it fails
+    lustre_irods_connection conn(thread_number);
+
+    // batches written to the connection whose results have not been read yet, oldest first
+    std::deque<std::pair<uint64_t, uint32_t> > pending_batches;   // batch id, entry count
+    size_t pipeline_depth = std::max(1u, config_struct_ptr->irods_updater_pipeline_depth);
+
     while (!quit) {
 
         zmq::message_t message;
 
-        // initiate a connection object
-        lustre_irods_connection conn(thread_number);
-
         size_t bytes_received = 0;
-        try {
-            bytes_received = receiver.recv(&message);
-        } catch (const zmq::error_t& e) {
-             bytes_received = 0;
-        } 
+        if (pending_batches.size() < pipeline_depth) {
+            try {
+                // only wait for new work when there are no results to read
+                if (pending_batches.empty()) {
+                    bytes_received = receiver.recv(&message);
+                } else {
+                    bytes_received = receiver.recv(&message, ZMQ_DONTWAIT);
+                }
+            } catch (const zmq::error_t& e) {
+                 bytes_received = 0;
+            } 
+        }
 
 
-        if (!irods_error_detected && bytes_received > 0) {
+        if (bytes_received > 0) {
 
             irodsLustreApiInp_t inp {};
             inp.buf = static_cast<unsigned char*>(message.data());
@@ -434,10 +665,17 @@ void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr
 
             LOG(LOG_INFO, "irods client (%u): received message of length %d\n", thread_number, inp.buflen);
 
-            if (0 == conn.instantiate_irods_connection(config_struct_ptr, thread_number )) {
+            uint64_t batch_id = 0;
+            uint32_t entry_count = 0;
+            get_batch_info_from_capnproto_buf(inp.buf, inp.buflen, batch_id, entry_count);
+
+            // the connection is only checked when it has no outstanding requests
+            if (!pending_batches.empty() || 0 == conn.ensure_irods_connection(config_struct_ptr, thread_number )) {
 
-                // send to irods
-                if (lustre_irods::IRODS_ERROR == conn.send_change_map_to_irods(&inp)) {
+                // write to irods, the result is read later
+                if (0 == conn.submit_change_map_to_irods(&inp)) {
+                    pending_batches.emplace_back(batch_id, entry_count);
+                } else {
                     irods_error_detected = true;
                 }
             } else {
@@ -445,37 +683,35 @@ void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr
             }
 
             if (irods_error_detected) {
+                send_batch_ack(sender, thread_number, batch_id, BATCH_ACK_FAIL, entry_count, std::vector<int>());
+            }
+        }
+
+        // read the oldest result when the window is full or when there is no new work to overlap it with
+        if (!irods_error_detected && !pending_batches.empty() && (0 == bytes_received || pending_batches.size() >= pipeline_depth)) {
+            if (0 != receive_oldest_batch_result(conn, sender, thread_number, pending_batches)) {
+                irods_error_detected = true;
+            }
+        }
 
-                // irods was previous up but now is down
+        if (irods_error_detected) {
 
-                // send message to changelog reader to pause reading changelog
-                LOG(LOG_DBG, "irods client (%u): sending pause message to changelog_reader\n", thread_number);
-                s_sendmore(publisher, "changelog_reader");
-                std::string msg = str(boost::format("pause:%u") % thread_number);
-                s_send(publisher, msg.c_str());
+            // irods was previous up but now is down
 
-                // update the status to fail and send to accumulator
-                unsigned char *buf = static_cast<unsigned char*>(message.data());
-                size_t bufflen = message.size();
-                set_update_status_in_capnproto_buf(buf, bufflen, "FAIL");
-                zmq::message_t response_message(bufflen);
-                memcpy(static_cast<char*>(response_message.data()), buf, bufflen);
-                sender.send(response_message);
-                free(buf);
+            // the connection may be broken so do not reuse it.  Every batch still outstanding on it
+            // is failed back to the accumulator.
+            for (const auto& pending : pending_batches) {
+                send_batch_ack(sender, thread_number, pending.first, BATCH_ACK_FAIL, pending.second, std::vector<int>());
+            }
+            pending_batches.clear();
+            conn.disconnect();
 
-            } else {
-                // update the status to pass and send to accumulator
-                unsigned char *buf = static_cast<unsigned char*>(message.data());
-                size_t bufflen = message.size();
-                set_update_status_in_capnproto_buf(buf, bufflen, "PASS");
-                zmq::message_t response_message(bufflen);
-                memcpy(static_cast<char*>(response_message.data()), buf, bufflen);
-                sender.send(response_message);
-                free(buf);
-
-           }
-
-        }  
+            // send message to changelog reader to pause reading changelog
+            LOG(LOG_DBG, "irods client (%u): sending pause message to changelog_reader\n", thread_number);
+            s_sendmore(publisher, "changelog_reader");
+            std::string msg = str(boost::format("pause:%u") % thread_number);
+            s_send(publisher, msg.c_str());
+        }
         
         if (irods_error_detected) {
     
@@ -484,10 +720,6 @@ void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr
             // try a connection in a loop until irods is back up. 
             do {
 
-                // initiate a connection object
-                lustre_irods_connection conn(thread_number);
-
-
                 // sleep for sleep_period in a 1s loop so we can catch a terminate message
                 for (unsigned int i = 0; i < config_struct_ptr->irods_client_connect_failure_retry_seconds; ++i) {
                     sleep(1);
@@ -496,6 +728,7 @@ void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr
                     if (received_terminate_message(subscriber)) {
                         LOG(LOG_DBG, "irods client (%u) received a terminate message\n", thread_number);
                         LOG(LOG_DBG,"irods client (%u) exiting\n", thread_number);
+                        conn.log_connection_stats();
                         return;
                     }
                 }
@@ -505,7 +738,8 @@ void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr
 
             } while (0 != conn.instantiate_irods_connection(config_struct_ptr, thread_number )); 
             
-            // irods is back up, set status and send a message to the changelog reader
+            // irods is back up, set status and send a message to the changelog reader.  The new
+            // connection is kept for the next batch.
             
             irods_error_detected = false;
             LOG(LOG_DBG, "sending continue message to changelog reader\n");
@@ -518,12 +752,24 @@ void irods_api_client_main(const lustre_irods_connector_cfg_t *config_struct_ptr
         // see if there is a quit message, if so terminate
         if (received_terminate_message(subscriber)) {
              LOG(LOG_DBG, "irods client (%u) received a terminate message\n", thread_number);
+
+             // collect the results already written to irods before exiting
+             while (!pending_batches.empty()) {
+                 if (0 != receive_oldest_batch_result(conn, sender, thread_number, pending_batches)) {
+                     for (const auto& pending : pending_batches) {
+                         send_batch_ack(sender, thread_number, pending.first, BATCH_ACK_FAIL, pending.second, std::vector<int>());
+                     }
+                     pending_batches.clear();
+                 }
+             }
+
              quit = true;
              break;
         }
 
     }
 
+    conn.log_connection_stats();
     LOG(LOG_DBG,"irods client (%u) exiting\n", thread_number);
 }
 
@@ -533,7 +779,6 @@ int main(int argc, char *argv[]) {
     std::string config_file = "lustre_irods_connector_config.json";
     std::string log_file;
     bool fatal_error_detected = false;
-    cl_ctx_ptr reader_ctx;
 
     signal(SIGPIPE, SIG_IGN);
     
@@ -558,29 +803,59 @@ int main(int argc, char *argv[]) {
         return EX_CONFIG;
     }
 
-    LOG(LOG_DBG, "initializing change_map serialized database\n");
-    if (initiate_change_map_serialization_database(config_struct.mdtname) < 0) {
-        LOG(LOG_ERR, "failed to initialize serialization database\n");
-        return EX_SOFTWARE;
+    if (build_changelog_record_type_mask(config_struct.changelog_record_types, config_struct.changelog_record_type_mask) < 0) {
+        return EX_CONFIG;
     }
 
-    // create the changemap in memory and read from serialized DB
-    change_map_t change_map;
+    // fids with an entry in flight are shared between the MDTs since a rename or a create can
+    // reference a directory that lives on another MDT
+    active_fid_set active_fids;
 
-    LOG(LOG_DBG, "reading change_map from serialized database\n");
-    if (deserialize_change_map_from_sqlite(change_map, config_struct.mdtname) < 0) {
-        LOG(LOG_ERR, "failed to deserialize change map on startup\n");
-        return EX_SOFTWARE;
-    }
+    // directory paths and register map verdicts are shared for the same reason.  a rename read by
+    // the reader of one MDT has to invalidate what the readers of the others have cached.
+    directory_caches dir_caches(config_struct.directory_path_cache_size, config_struct.register_map_fid_filter_size);
 
-    lustre_print_change_table(change_map);
+    mdt_context_list_t mdt_list;
+    for (const auto& mdt : config_struct.mdt_list) {
 
-    unsigned long long last_cr_index = 0;
-    if (get_cr_index(last_cr_index, config_struct.mdtname) < 0) {
-        LOG(LOG_ERR, "failed to get last cr_index.  continuing with 0 as index.\n");
-    }
+        mdt_list.emplace_back(new mdt_context(mdt_list.size(), mdt, config_struct, active_fids, dir_caches));
+        mdt_context& mdt_ctx = *mdt_list.back();
 
-    LOG(LOG_DBG, "last_cr_index is %llu\n", last_cr_index);
+        check_mdt_changelog_mask(mdt.mdtname, config_struct.changelog_record_type_mask);
+
+        LOG(LOG_DBG, "initializing change_map serialized database for %s\n", mdt.mdtname.c_str());
+        if (initiate_change_map_serialization_database(mdt.mdtname) < 0) {
+            LOG(LOG_ERR, "failed to initialize serialization database\n");
+            return EX_SOFTWARE;
+        }
+
+        // read the changemap for this mdt from the serialized DB
+        LOG(LOG_DBG, "reading change_map from serialized database for %s\n", mdt.mdtname.c_str());
+        if (deserialize_change_map_from_sqlite(mdt_ctx.change_table, mdt.mdtname) < 0) {
+            LOG(LOG_ERR, "failed to deserialize change map on startup\n");
+            return EX_SOFTWARE;
+        }
+
+        lustre_print_change_table(mdt_ctx.change_table);
+
+        if (get_cr_index(mdt_ctx.last_cr_index, mdt.mdtname) < 0) {
+            LOG(LOG_ERR, "failed to get last cr_index.  continuing with 0 as index.\n");
+        }
+
+        LOG(LOG_DBG, "last_cr_index for %s is %llu\n", mdt.mdtname.c_str(), mdt_ctx.last_cr_index);
+
+        // from here on changes to the change table are journaled as they happen
+        if (open_change_map_journal(mdt_ctx.change_table, mdt.mdtname) < 0) {
+            LOG(LOG_ERR, "failed to open change_map journal\n");
+            return EX_SOFTWARE;
+        }
+
+        // changelog clears are coalesced until one of these watermarks is reached
+        mdt_ctx.clear_state.record_watermark = config_struct.changelog_clear_record_watermark;
+        mdt_ctx.clear_state.interval_seconds = config_struct.changelog_clear_interval_seconds;
+        mdt_ctx.clear_state.last_cleared_cr_index = mdt_ctx.last_cr_index;
+        mdt_ctx.clear_state.last_clear_time = time(NULL);
+    }
 
     // connect to irods and get the resource id from the resource name 
     // uses irods environment for this initial connection
@@ -601,11 +876,6 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // create a std::set of fidstr which is used to pause sending updates to irods client updater threads
-    // when a dependency is detected 
-    std::set<std::string> active_fidstr_list;
-
-
     // start a pub/sub publisher which is used to terminate threads and to send irods up/down messages
     zmq::context_t context(1);
     zmq::socket_t publisher(context, ZMQ_PUB);
@@ -625,37 +895,65 @@ int main(int argc, char *argv[]) {
     sender.bind(config_struct.changelog_reader_push_work_address);
 
     // start accumulator thread which receives results back from iRODS updater threads
-    std::thread accumulator_thread(result_accumulator_main, &config_struct, &change_map, &active_fidstr_list); 
+    std::thread accumulator_thread(result_accumulator_main, &config_struct, &mdt_list); 
 
     // create a vector of irods client updater threads 
     std::vector<std::thread> irods_api_client_thread_list;
 
     // start up the threads
     for (unsigned int i = 0; i < config_struct.irods_updater_thread_count; ++i) {
-        std::thread t(irods_api_client_main, &config_struct, &change_map, i);
+        std::thread t(irods_api_client_main, &config_struct, i);
         irods_api_client_thread_list.push_back(std::move(t));
         //irods_api_client_connection_status.push_back(true);
     }
 
-    rc = start_changelog(config_struct.mdtname, &reader_ctx, last_cr_index+1);
-    if (rc < 0) {
-        LOG(LOG_ERR, "changelog_start: %s  [rc=%d]\n", zmq_strerror(-rc), rc);
-        reader_ctx = nullptr;
-        fatal_error_detected = true;
+    for (auto& mdt : mdt_list) {
+        rc = start_changelog(mdt->mdt.mdtname, &mdt->reader_ctx, mdt->last_cr_index+1);
+        if (rc < 0) {
+            LOG(LOG_ERR, "changelog_start for %s: %s  [rc=%d]\n", mdt->mdt.mdtname.c_str(), zmq_strerror(-rc), rc);
+            mdt->reader_ctx = nullptr;
+            fatal_error_detected = true;
+        }
     }
 
     // add in an event for a  mkdir for the lustre_root so that it will get 
-    // populated with the fidstr
-    std::string root_fidstr = get_fidstr_from_path(config_struct.lustre_root_path);
+    // populated with the fidstr.  This only needs to go into one of the change tables.
+    fid_key root_fid = get_fid_from_path(config_struct.lustre_root_path);
+    std::string root_fidstr = fid_to_fidstr(root_fid);
     LOG(LOG_DBG, "Root fidstr %s\n", root_fidstr.c_str());
     LOG(LOG_INFO, "lustre_write_fidstr_to_root_dir [lustre_root_path=%s][root_fidstr=%s]\n", config_struct.lustre_root_path.c_str(), root_fidstr.c_str());
-    lustre_write_fidstr_to_root_dir(config_struct.lustre_root_path, root_fidstr, change_map);
-
+    lustre_write_fidstr_to_root_dir(config_struct.lustre_root_path, root_fid, mdt_list.front()->change_table);
 
+    // start a changelog reader and a change table owner for each mdt
+    std::vector<std::thread> change_table_owner_thread_list;
+    std::vector<std::thread> changelog_reader_thread_list;
     if (!fatal_error_detected) {
-        run_main_changelog_reader_loop(config_struct, change_map, &reader_ctx, publisher, subscriber, sender, active_fidstr_list, last_cr_index);
+        for (auto& mdt : mdt_list) {
+            change_table_owner_thread_list.emplace_back(change_table_owner_main, &config_struct,
+                    &mdt->change_table, &mdt->record_queue);
+            changelog_reader_thread_list.emplace_back(changelog_reader_main, &config_struct, mdt.get());
+        }
+
+        run_main_dispatch_loop(config_struct, mdt_list, subscriber, sender);
     }
 
+    // keep_running is false at this point so the readers stop after their current poll
+    for (auto& mdt : mdt_list) {
+        mdt->reader_wakeup.wake();
+    }
+    for (auto& t : changelog_reader_thread_list) {
+        t.join();
+    }
+
+    // the readers have stopped, let the owners apply what is left in their queues
+    change_table_owner_running.store(false);
+    for (auto& t : change_table_owner_thread_list) {
+        t.join();
+    }
+
+    // the changelog is only cleared on the way out if it was read
+    bool changelog_read = !fatal_error_detected;
+
     // send message to threads to terminate
     LOG(LOG_DBG, "sending terminate message to clients\n");
     s_sendmore(publisher, "changetable_readers");
@@ -668,25 +966,42 @@ int main(int argc, char *argv[]) {
 
     accumulator_thread.join();
 
-    LOG(LOG_DBG, "serializing change_map to database\n");
-    if (serialize_change_map_to_sqlite(change_map, config_struct.mdtname) < 0) {
-        LOG(LOG_ERR, "failed to serialize change_map upon exit\n");
-        fatal_error_detected = true;
-    }
+    for (auto& mdt : mdt_list) {
 
-    if (write_cr_index_to_sqlite(last_cr_index, config_struct.mdtname) < 0) {
-        LOG(LOG_ERR, "failed to write cr_index to database upon exit\n");
-        fatal_error_detected = true;
-    }
+        // once the whole table is written out everything that was read is durable.  if that fails
+        // only the records that made it into the journal are.
+        unsigned long long durable_cr_index = mdt->last_cr_index;
 
-    if (reader_ctx != nullptr) {
-        LOG(LOG_DBG, "finish_changelog RAN!!!!!!!!!!\n");
-        rc = finish_changelog(&reader_ctx);
-        if (rc) {
-            LOG(LOG_ERR, "changelog_fini: %s\n", zmq_strerror(-rc));
+        LOG(LOG_DBG, "serializing change_map for %s to database\n", mdt->mdt.mdtname.c_str());
+        if (serialize_change_map_to_sqlite(mdt->change_table, mdt->mdt.mdtname) < 0) {
+            LOG(LOG_ERR, "failed to serialize change_map upon exit\n");
             fatal_error_detected = true;
-        } else {
-            LOG(LOG_ERR, "finish_changelog exited normally\n");
+            durable_cr_index = std::min(mdt->last_cr_index, get_journaled_cr_index(mdt->change_table));
+        }
+
+        if (write_cr_index_to_sqlite(durable_cr_index, mdt->mdt.mdtname) < 0) {
+            LOG(LOG_ERR, "failed to write cr_index to database upon exit\n");
+            fatal_error_detected = true;
+        }
+
+        // flush any clear that is still being held back by the watermark
+        if (changelog_read) {
+            clear_changelog_if_needed(mdt->mdt.mdtname, mdt->mdt.changelog_reader, durable_cr_index, mdt->clear_state, true);
+            LOG(LOG_INFO, "changelog clear calls for %s [made=%llu][saved=%llu]\n", mdt->mdt.mdtname.c_str(),
+                    mdt->clear_state.clear_calls, mdt->clear_state.clear_calls_saved);
+        }
+
+        close_change_map_journal(mdt->change_table);
+
+        if (mdt->reader_ctx != nullptr) {
+            LOG(LOG_DBG, "finish_changelog RAN!!!!!!!!!!\n");
+            rc = finish_changelog(&mdt->reader_ctx);
+            if (rc) {
+                LOG(LOG_ERR, "changelog_fini: %s\n", zmq_strerror(-rc));
+                fatal_error_detected = true;
+            } else {
+                LOG(LOG_ERR, "finish_changelog exited normally\n");
+            }
         }
     }
 
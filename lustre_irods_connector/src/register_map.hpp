@@ -0,0 +1,192 @@
+#ifndef REGISTER_MAP_HPP
+#define REGISTER_MAP_HPP
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Where a path lies relative to the registered trees.
+enum register_map_match_t {
+    REGISTER_MAP_INSIDE,        // the path is at or under a registered prefix
+    REGISTER_MAP_OUTSIDE,       // nothing at or under the path is registered
+    REGISTER_MAP_ANCESTOR       // the path is not registered but a registered prefix is under it
+};
+
+// The register_map compiled into a trie of path components so that a path can be matched
+// against every prefix in one pass over the path.  This is shared by the connector and the
+// iRODS plugin so both sides agree on what is registered.
+//
+// Matching is done on whole path components and the longest matching prefix wins.  For example
+// the prefix /lustre01/proj matches /lustre01/proj and /lustre01/proj/file but not
+// /lustre01/project2.  Repeated and trailing slashes in a prefix are ignored.  If a prefix is
+// listed more than once the first mapping is kept.
+class register_map_trie {
+ public:
+   register_map_trie() : nodes(1) {}
+
+   // When reverse is true the trie is built on the irods paths and maps them to lustre paths.
+   explicit register_map_trie(const std::vector<std::pair<std::string, std::string> >& register_map, bool reverse = false)
+       : nodes(1) {
+       for (auto& iter : register_map) {
+           if (reverse) {
+               insert(iter.second, iter.first);
+           } else {
+               insert(iter.first, iter.second);
+           }
+       }
+   }
+
+   void insert(const std::string& prefix, const std::string& mapped_prefix) {
+       size_t node_index = 0;
+       size_t start = 0;
+       size_t length = 0;
+       while (next_component(prefix, start, length)) {
+           size_t child_index = find_child(node_index, prefix, start, length);
+           if (NO_NODE == child_index) {
+               child_index = nodes.size();
+               nodes.emplace_back();
+               std::vector<child_entry>& children = nodes[node_index].children;
+               children.emplace_back(prefix.substr(start, length), child_index);
+               std::sort(children.begin(), children.end());
+           }
+           node_index = child_index;
+           start += length;
+       }
+
+       trie_node& node = nodes[node_index];
+       if (!node.terminal) {
+           node.terminal = true;
+           node.mapped_prefix = mapped_prefix;
+
+           // the remainder of a matched path always starts with a slash
+           while (!node.mapped_prefix.empty() && '/' == node.mapped_prefix.back()) {
+               node.mapped_prefix.pop_back();
+           }
+       }
+   }
+
+   // Finds the longest prefix that path is at or under.  On a match prefix_length is set to the
+   // number of characters of path that the prefix covers and mapped_prefix points to what the
+   // prefix maps to.
+   bool longest_prefix_match(const std::string& path, size_t& prefix_length, const std::string*& mapped_prefix) const {
+       bool found = false;
+       size_t node_index = 0;
+       size_t start = 0;
+       size_t length = 0;
+
+       if (nodes[0].terminal) {
+           found = true;
+           prefix_length = 0;
+           mapped_prefix = &nodes[0].mapped_prefix;
+       }
+
+       while (next_component(path, start, length)) {
+           node_index = find_child(node_index, path, start, length);
+           if (NO_NODE == node_index) {
+               break;
+           }
+           start += length;
+           if (nodes[node_index].terminal) {
+               found = true;
+               prefix_length = start;
+               mapped_prefix = &nodes[node_index].mapped_prefix;
+           }
+       }
+
+       return found;
+   }
+
+   // Unlike the prefix match this also reports whether a registered prefix lies under path, in
+   // which case some of the entries under path are registered and some are not.
+   register_map_match_t classify(const std::string& path) const {
+       size_t node_index = 0;
+       size_t start = 0;
+       size_t length = 0;
+
+       while (!nodes[node_index].terminal) {
+           if (!next_component(path, start, length)) {
+               return nodes[node_index].children.empty() ? REGISTER_MAP_OUTSIDE : REGISTER_MAP_ANCESTOR;
+           }
+           node_index = find_child(node_index, path, start, length);
+           if (NO_NODE == node_index) {
+               return REGISTER_MAP_OUTSIDE;
+           }
+           start += length;
+       }
+       return REGISTER_MAP_INSIDE;
+   }
+
+   bool contains(const std::string& path) const {
+       size_t prefix_length;
+       const std::string *mapped_prefix;
+       return longest_prefix_match(path, prefix_length, mapped_prefix);
+   }
+
+   // Replaces the longest matching prefix of path with what it maps to.  Returns false if path is
+   // not under any prefix.
+   bool translate(const std::string& path, std::string& translated_path) const {
+       size_t prefix_length;
+       const std::string *mapped_prefix;
+       if (!longest_prefix_match(path, prefix_length, mapped_prefix)) {
+           return false;
+       }
+       translated_path = *mapped_prefix + path.substr(prefix_length);
+       return true;
+   }
+
+   bool empty() const {
+       return 1 == nodes.size() && !nodes[0].terminal;
+   }
+
+ private:
+   typedef std::pair<std::string, size_t> child_entry;   // component, node index
+
+   struct trie_node {
+       trie_node() : terminal(false) {}
+
+       std::vector<child_entry> children;   // sorted by component
+       bool terminal;
+       std::string mapped_prefix;
+   };
+
+   static const size_t NO_NODE = static_cast<size_t>(-1);
+
+   // Advances start past any slashes and sets length to the length of the component that follows.
+   // Returns false when there are no more components.
+   static bool next_component(const std::string& path, size_t& start, size_t& length) {
+       start = path.find_first_not_of('/', start);
+       if (std::string::npos == start) {
+           start = path.length();
+           return false;
+       }
+       size_t end = path.find('/', start);
+       length = (std::string::npos == end ? path.length() : end) - start;
+       return true;
+   }
+
+   // Binary search of the children of node_index for path[start, start + length) without copying
+   // the component out of path.
+   size_t find_child(size_t node_index, const std::string& path, size_t start, size_t length) const {
+       const std::vector<child_entry>& children = nodes[node_index].children;
+       size_t low = 0;
+       size_t high = children.size();
+       while (low < high) {
+           size_t mid = low + (high - low) / 2;
+           int cmp = path.compare(start, length, children[mid].first);
+           if (0 == cmp) {
+               return children[mid].second;
+           } else if (cmp > 0) {
+               low = mid + 1;
+           } else {
+               high = mid;
+           }
+       }
+       return NO_NODE;
+   }
+
+   // nodes[0] is the root.  Nodes refer to each other by index so the trie can be copied.
+   std::vector<trie_node> nodes;
+};
+
+#endif
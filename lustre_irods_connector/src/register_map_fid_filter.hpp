@@ -0,0 +1,36 @@
+#ifndef REGISTER_MAP_FID_FILTER_HPP
+#define REGISTER_MAP_FID_FILTER_HPP
+
+#include "lustre_fid.hpp"
+#include "register_map.hpp"
+#include "lru_cache.hpp"
+
+// LRU cache of directory fid -> whether the directory is inside or outside of the registered
+// trees.  The changelog reader checks the parent fid of a record here before resolving its path
+// so that records under unregistered directories can be skipped without a fid2path call.
+// Directories that have a registered prefix under them are never cached since their entries
+// can go either way.  This does no locking.  The changelog readers share one through
+// directory_caches which does.
+//
+// clear() is used when a rename may have moved directories across the edge of a registered
+// tree.  The fids of the directories underneath are not known so everything is dropped.
+class register_map_fid_filter : public lru_cache<fid_key, register_map_match_t, fid_key_hash> {
+ public:
+   explicit register_map_fid_filter(size_t max_entries) : lru_cache(max_entries), skipped(0) {}
+
+   void insert(const fid_key& fid, register_map_match_t match) {
+       if (REGISTER_MAP_ANCESTOR == match) {
+           return;
+       }
+       lru_cache::insert(fid, match);
+   }
+
+   void record_skipped() { ++skipped; }
+
+   unsigned long long skipped_count() const { return skipped; }
+
+ private:
+   unsigned long long skipped;
+};
+
+#endif
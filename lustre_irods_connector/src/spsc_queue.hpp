@@ -0,0 +1,78 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+// The producer only writes tail and the consumer only writes head so neither side ever
+// blocks the other.  The capacity is rounded up to a power of two.
+template <typename T>
+class spsc_queue {
+ public:
+   explicit spsc_queue(size_t requested_capacity) : head(0), tail(0) {
+       size_t capacity = 2;
+       while (capacity < requested_capacity) {
+           capacity <<= 1;
+       }
+       buffer.resize(capacity);
+       mask = capacity - 1;
+   }
+
+   spsc_queue(const spsc_queue&) = delete;
+   spsc_queue& operator=(const spsc_queue&) = delete;
+
+   // Producer side.  Returns false if the queue is full, in which case item is untouched.
+   bool try_push(T& item) {
+       size_t t = tail.load(std::memory_order_relaxed);
+       if (t - head.load(std::memory_order_acquire) > mask) {
+           return false;
+       }
+       buffer[t & mask] = std::move(item);
+       tail.store(t + 1, std::memory_order_release);
+       return true;
+   }
+
+   // Consumer side.  Moves up to max_items entries onto the end of out and returns how many
+   // were moved.
+   size_t pop_batch(std::vector<T>& out, size_t max_items) {
+       size_t h = head.load(std::memory_order_relaxed);
+       size_t available = tail.load(std::memory_order_acquire) - h;
+       size_t count = available < max_items ? available : max_items;
+       for (size_t i = 0; i < count; ++i) {
+           out.push_back(std::move(buffer[(h + i) & mask]));
+       }
+       head.store(h + count, std::memory_order_release);
+       return count;
+   }
+
+   // Approximate when called from a thread that is neither the producer nor the consumer.
+   size_t size() const {
+       size_t h = head.load(std::memory_order_acquire);
+       return tail.load(std::memory_order_acquire) - h;
+   }
+
+   bool empty() const {
+       return 0 == size();
+   }
+
+   size_t capacity() const {
+       return mask + 1;
+   }
+
+ private:
+   std::vector<T> buffer;
+   size_t mask;
+
+   // keep the producer and consumer indices on separate cache lines.  This is done with padding
+   // rather than alignas so that queues can be allocated with new before C++17.
+   static const size_t CACHE_LINE_SIZE = 64;
+   char head_padding[CACHE_LINE_SIZE];
+   std::atomic<size_t> head;
+   char tail_padding[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+   std::atomic<size_t> tail;
+   char end_padding[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+#endif
@@ -0,0 +1,179 @@
+// Unit tests for how the change table takes back entries that iRODS failed to apply.
+//
+// Each case puts a newer entry for a fid in the change table while an entry for the same fid is
+// in flight, fails the in-flight batch, and checks the entry that is left in the table.
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "lustre_change_table.hpp"
+#include "lustre_irods_errors.hpp"
+#include "logging.hpp"
+#include "batch_ack.hpp"
+
+FILE *dbgstream = stdout;
+int  log_level = LOG_ERR;
+
+typedef ChangeDescriptor::EventTypeEnum event_t;
+
+namespace {
+
+const fid_key test_fid{0x200000401ULL, 0x1, 0x0};
+const fid_key test_parent_fid{0x200000401ULL, 0x2, 0x0};
+
+const off_t failed_size = 100;
+const off_t newer_size = 200;
+
+change_descriptor make_entry(unsigned long long cr_index, event_t event, const std::string& lustre_path, off_t file_size) {
+    change_descriptor entry{};
+    entry.cr_index = cr_index;
+    entry.fid = test_fid;
+    entry.parent_fid = test_parent_fid;
+    entry.object_name = lustre_path.substr(lustre_path.rfind('/') + 1);
+    entry.lustre_path = lustre_path;
+    entry.last_event = event;
+    entry.oper_complete = true;
+    entry.object_type = ChangeDescriptor::ObjectTypeEnum::FILE;
+    entry.file_size = file_size;
+    return entry;
+}
+
+struct merge_case {
+    event_t failed_event;
+    event_t newer_event;
+    event_t expected_event;
+    off_t expected_size;
+};
+
+// Fails the in-flight entry for failed_event while newer_event is in the table and checks the
+// entry that is left.
+bool run_merge_case(const merge_case& c) {
+
+    active_fid_set active_fids;
+    change_table_t change_table(1, 0, active_fids);
+    change_table_partition& partition = *change_table.partitions[0];
+
+    // a RENAME record does not carry the size of the file
+    off_t newer_file_size = event_t::RENAME == c.newer_event ? 0 : newer_size;
+
+    const uint64_t batch_id = 1;
+    partition.inflight_batches[batch_id].push_back(make_entry(10, c.failed_event, "/lustre/old_name", failed_size));
+    partition.inflight_cr_index[test_fid] = 10;
+    active_fids.fids.insert(test_fid);
+    partition.change_map.insert(make_entry(20, c.newer_event, "/lustre/new_name", newer_file_size));
+
+    batch_ack_header ack{batch_id, BATCH_ACK_FAIL, 1};
+    if (lustre_irods::SUCCESS != process_batch_ack(ack, nullptr, change_table)) {
+        printf("  process_batch_ack failed\n");
+        return false;
+    }
+
+    auto &change_map_fid = partition.change_map.get<change_descriptor_fid_idx>();
+    auto iter = change_map_fid.find(test_fid);
+    if (change_map_fid.end() == iter || 1 != partition.change_map.size()) {
+        printf("  expected one entry in the change table, found %zu\n", partition.change_map.size());
+        return false;
+    }
+
+    bool passed = true;
+    if (c.expected_event != iter->last_event) {
+        printf("  expected event %s, found %s\n", event_type_to_str(c.expected_event).c_str(), event_type_to_str(iter->last_event).c_str());
+        passed = false;
+    }
+    if ("/lustre/new_name" != iter->lustre_path) {
+        printf("  expected the newer path, found %s\n", iter->lustre_path.c_str());
+        passed = false;
+    }
+    if (20 != iter->cr_index) {
+        printf("  expected the newer cr_index, found %llu\n", iter->cr_index);
+        passed = false;
+    }
+    if (c.expected_size != iter->file_size) {
+        printf("  expected size %lld, found %lld\n", static_cast<long long>(c.expected_size), static_cast<long long>(iter->file_size));
+        passed = false;
+    }
+    if (active_fids.fids.end() != active_fids.fids.find(test_fid) || !partition.inflight_batches.empty()) {
+        printf("  the fid is still in flight\n");
+        passed = false;
+    }
+    return passed;
+}
+
+// With no newer entry the failed entry goes back into the table as it was.
+bool run_no_newer_entry_case() {
+
+    active_fid_set active_fids;
+    change_table_t change_table(1, 0, active_fids);
+    change_table_partition& partition = *change_table.partitions[0];
+
+    const uint64_t batch_id = 1;
+    partition.inflight_batches[batch_id].push_back(make_entry(10, event_t::CREATE, "/lustre/old_name", failed_size));
+    active_fids.fids.insert(test_fid);
+
+    batch_ack_header ack{batch_id, BATCH_ACK_FAIL, 1};
+    process_batch_ack(ack, nullptr, change_table);
+
+    auto &change_map_fid = partition.change_map.get<change_descriptor_fid_idx>();
+    auto iter = change_map_fid.find(test_fid);
+    if (change_map_fid.end() == iter) {
+        printf("  the failed entry was not put back\n");
+        return false;
+    }
+    if (event_t::CREATE != iter->last_event || 10 != iter->cr_index || 1 != iter->attempt_count || 0 == iter->retry_after) {
+        printf("  the failed entry was not put back as it was\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+
+    const merge_case cases[] = {
+        // a failed CREATE or MKDIR still registers the object
+        {event_t::CREATE, event_t::OTHER,  event_t::CREATE, newer_size},
+        {event_t::CREATE, event_t::RENAME, event_t::CREATE, failed_size},
+        {event_t::CREATE, event_t::UNLINK, event_t::UNLINK, newer_size},
+        {event_t::MKDIR,  event_t::OTHER,  event_t::MKDIR,  newer_size},
+        {event_t::MKDIR,  event_t::RENAME, event_t::MKDIR,  failed_size},
+        {event_t::MKDIR,  event_t::RMDIR,  event_t::RMDIR,  newer_size},
+
+        // a failed RENAME still moves the object to the newer path
+        {event_t::RENAME, event_t::OTHER,  event_t::RENAME, newer_size},
+        {event_t::RENAME, event_t::RENAME, event_t::RENAME, failed_size},
+        {event_t::RENAME, event_t::UNLINK, event_t::UNLINK, newer_size},
+        {event_t::RENAME, event_t::RMDIR,  event_t::RMDIR,  newer_size},
+
+        // a failed UNLINK or RMDIR still removes the object
+        {event_t::UNLINK, event_t::OTHER,  event_t::UNLINK, newer_size},
+        {event_t::UNLINK, event_t::RENAME, event_t::RENAME, 0},
+        {event_t::UNLINK, event_t::CREATE, event_t::CREATE, newer_size},
+        {event_t::RMDIR,  event_t::OTHER,  event_t::RMDIR,  newer_size},
+        {event_t::RMDIR,  event_t::MKDIR,  event_t::MKDIR,  newer_size},
+
+        // a failed OTHER is replaced by anything newer
+        {event_t::OTHER,  event_t::OTHER,  event_t::OTHER,  newer_size},
+        {event_t::OTHER,  event_t::RENAME, event_t::RENAME, failed_size},
+        {event_t::OTHER,  event_t::CREATE, event_t::CREATE, newer_size},
+        {event_t::OTHER,  event_t::UNLINK, event_t::UNLINK, newer_size},
+    };
+
+    int failures = 0;
+
+    for (const merge_case& c : cases) {
+        printf("failed %s, newer %s\n", event_type_to_str(c.failed_event).c_str(), event_type_to_str(c.newer_event).c_str());
+        if (!run_merge_case(c)) {
+            ++failures;
+        }
+    }
+
+    printf("failed CREATE, no newer entry\n");
+    if (!run_no_newer_entry_case()) {
+        ++failures;
+    }
+
+    printf("%d failures\n", failures);
+    return 0 == failures ? 0 : 1;
+}
@@ -85,7 +85,7 @@ class Test_Lustre(unittest.TestCase):
             f.write(contents)
 
     @staticmethod
-    def setup_configuration_file(filename, mode, mdtname, begin_port):
+    def setup_configuration_file(filename, mode, mdtname, begin_port, extra_settings=None):
         register_map1 = {
             'lustre_path': '/lustreResc/lustre01/home',
             'irods_register_path': '/tempZone/home'
@@ -96,13 +96,19 @@ class Test_Lustre(unittest.TestCase):
             'irods_register_path': '/tempZone/a'
         }
 
+        # shares a string prefix with register_map2 but not a path prefix
+        register_map_ab = {
+            'lustre_path': '/lustreResc/lustre01/ab',
+            'irods_register_path': '/tempZone/lustre_ab'
+        }
+
         register_map3 = {
             'lustre_path': '/lustreResc/lustre01',
             'irods_register_path': '/tempZone/lustre01'
         }
 
 
-        register_map_list = [register_map1, register_map2, register_map3]
+        register_map_list = [register_map1, register_map2, register_map_ab, register_map3]
 
 
         lustre_config = {
@@ -126,6 +132,9 @@ class Test_Lustre(unittest.TestCase):
 
         }
 
+        if extra_settings is not None:
+            lustre_config.update(extra_settings)
+
         with open(filename, 'wt') as f:
             json.dump(lustre_config, f, indent=4, ensure_ascii=False)
 
@@ -181,6 +190,54 @@ class Test_Lustre(unittest.TestCase):
         time.sleep(10)
         self.perform_standard_tests()
 
+    def test_lustre_direct_nested_mkdir(self):
+        config_file = '/etc/irods/MDT0000.json'
+        self.setup_configuration_file(config_file, 'direct', 'lustre01-MDT0000', 5555)
+        self.connector_list.append(subprocess.Popen(['/bin/lustre_irods_connector',  '-c', config_file], shell=False))
+        time.sleep(10)
+
+        # the directories arrive in one batch so the parents are registered along with their children
+        lib.execute_command(['mkdir', '-p', '/lustreResc/lustre01/dir1/dir2/dir3'])
+        self.write_to_file('/lustreResc/lustre01/dir1/file1', 'contents of file1')
+        self.write_to_file('/lustreResc/lustre01/dir1/dir2/dir3/file3', 'contents of file3')
+        time.sleep(3)
+        self.admin.assert_icommand(['ils', '/tempZone/lustre01/dir1'], 'STDOUT_MULTILINE',
+                ['/tempZone/lustre01/dir1:', '  file1', '  C- /tempZone/lustre01/dir1/dir2'])
+        self.admin.assert_icommand(['ils', '/tempZone/lustre01/dir1/dir2'], 'STDOUT_MULTILINE',
+                ['/tempZone/lustre01/dir1/dir2:', '  C- /tempZone/lustre01/dir1/dir2/dir3'])
+        self.admin.assert_icommand(['ils', '/tempZone/lustre01/dir1/dir2/dir3'], 'STDOUT_MULTILINE',
+                ['/tempZone/lustre01/dir1/dir2/dir3:', '  file3'])
+        self.admin.assert_icommand(['iget', '/tempZone/lustre01/dir1/dir2/dir3/file3', '-'], 'STDOUT_MULTILINE', ['contents of file3'])
+
+        lib.execute_command(['rm',  '-rf', '/lustreResc/lustre01/dir1'])
+        time.sleep(3)
+        self.admin.assert_icommand(['ils', '/tempZone/lustre01/dir1'], 'STDERR_SINGLELINE', 'does not exist')
+
+    def test_lustre_direct_register_map_sibling_prefix(self):
+        config_file = '/etc/irods/MDT0000.json'
+        self.setup_configuration_file(config_file, 'direct', 'lustre01-MDT0000', 5555)
+        self.connector_list.append(subprocess.Popen(['/bin/lustre_irods_connector',  '-c', config_file], shell=False))
+        time.sleep(10)
+
+        # /lustreResc/lustre01/ab must use its own entry and not the one for /lustreResc/lustre01/a
+        lib.execute_command(['mkdir', '/lustreResc/lustre01/ab'])
+        self.write_to_file('/lustreResc/lustre01/ab/file1', 'contents of file1')
+        time.sleep(3)
+        self.admin.assert_icommand(['ils', '/tempZone/lustre_ab/file1'], 'STDOUT_MULTILINE', ['  /tempZone/lustre_ab/file1'])
+        self.admin.assert_icommand(['ils', '/tempZone/ab/file1'], 'STDERR_SINGLELINE', 'does not exist')
+        self.admin.assert_icommand(['ils', '/tempZone/a/b/file1'], 'STDERR_SINGLELINE', 'does not exist')
+
+        lib.execute_command(['rm',  '-rf', '/lustreResc/lustre01/ab'])
+        time.sleep(3)
+        self.admin.assert_icommand(['ils', '/tempZone/lustre_ab'], 'STDERR_SINGLELINE', 'does not exist')
+
+    def test_lustre_direct_single_transaction(self):
+        config_file = '/etc/irods/MDT0000.json'
+        self.setup_configuration_file(config_file, 'direct', 'lustre01-MDT0000', 5555, {"single_transaction_per_batch": True})
+        self.connector_list.append(subprocess.Popen(['/bin/lustre_irods_connector',  '-c', config_file], shell=False))
+        time.sleep(10)
+        self.perform_standard_tests()
+
     def test_lustre_policy(self):
         config_file = '/etc/irods/MDT0000.json'
         self.setup_configuration_file(config_file, 'policy', 'lustre01-MDT0000', 5555)
@@ -198,3 +255,45 @@ class Test_Lustre(unittest.TestCase):
         self.connector_list.append(subprocess.Popen(['/bin/lustre_irods_connector',  '-c', config_file2], shell=False))
         time.sleep(10)
         self.perform_multi_mdt_tests()
+
+    def test_lustre_multi_mdt_single_connector(self):
+        config_file = '/etc/irods/MDT0000.json'
+        mdt_list = [
+            {'mdtname': 'lustre01-MDT0000', 'changelog_reader': 'cl1'},
+            {'mdtname': 'lustre01-MDT0001', 'changelog_reader': 'cl1'}
+        ]
+        self.setup_configuration_file(config_file, 'direct', 'lustre01-MDT0000', 5555, {'mdt_list': mdt_list})
+        self.connector_list.append(subprocess.Popen(['/bin/lustre_irods_connector',  '-c', config_file], shell=False))
+        time.sleep(10)
+        self.perform_multi_mdt_tests()
+
+    def test_lustre_multi_mdt_single_connector_directory_rename(self):
+        config_file = '/etc/irods/MDT0000.json'
+        mdt_list = [
+            {'mdtname': 'lustre01-MDT0000', 'changelog_reader': 'cl1'},
+            {'mdtname': 'lustre01-MDT0001', 'changelog_reader': 'cl1'}
+        ]
+        self.setup_configuration_file(config_file, 'direct', 'lustre01-MDT0000', 5555, {'mdt_list': mdt_list})
+        self.connector_list.append(subprocess.Popen(['/bin/lustre_irods_connector',  '-c', config_file], shell=False))
+        time.sleep(10)
+
+        # the create is logged on MDT0001 and caches the path of MDT0001dir
+        self.write_to_file('/lustreResc/lustre01/MDT0001dir/file1', 'contents of file1')
+        time.sleep(3)
+        self.admin.assert_icommand(['ils', '/tempZone/lustre01/MDT0001dir/file1'], 'STDOUT_MULTILINE', ['  /tempZone/lustre01/MDT0001dir/file1'])
+
+        # the rename of MDT0001dir is logged on MDT0000 and has to invalidate the path cached from MDT0001
+        try:
+            lib.execute_command(['mv',  '/lustreResc/lustre01/MDT0001dir', '/lustreResc/lustre01/MDT0001dir_renamed'])
+            time.sleep(3)
+            self.write_to_file('/lustreResc/lustre01/MDT0001dir_renamed/file2', 'contents of file2')
+            time.sleep(3)
+            self.admin.assert_icommand(['ils', '/tempZone/lustre01/MDT0001dir'], 'STDERR_SINGLELINE', 'does not exist')
+            self.admin.assert_icommand(['ils', '/tempZone/lustre01/MDT0001dir_renamed'], 'STDOUT_MULTILINE',
+                    ['/tempZone/lustre01/MDT0001dir_renamed:', '  file1', '  file2'])
+            self.admin.assert_icommand(['iget', '/tempZone/lustre01/MDT0001dir_renamed/file2', '-'], 'STDOUT_MULTILINE', ['contents of file2'])
+        finally:
+            # clean_up_lustre_files only preserves MDT0001dir under its original name
+            if os.path.isdir('/lustreResc/lustre01/MDT0001dir_renamed'):
+                lib.execute_command(['mv',  '/lustreResc/lustre01/MDT0001dir_renamed', '/lustreResc/lustre01/MDT0001dir'])
+                time.sleep(3)